@@ -0,0 +1,236 @@
+/* Copyright (C) 2002--2005 Chris Vaill
+   This file is part of nid3lib.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * We copy by having the files share blocks (a reflink) where the
+ * filesystem can, in the kernel with copy_file_range() or sendfile()
+ * where it can't, and through a large buffer when all else fails.
+ * copy_file_range() makes reflinks of its own on filesystems that
+ * support them, so copying part of a file can share blocks too.
+ */
+
+#define _GNU_SOURCE /* for copy_file_range() */
+
+#include "config.h"
+
+#include <stdio.h>
+#if STDC_HEADERS
+# include <stdlib.h>
+#else
+# if HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+#endif
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_ERRNO_H
+# include <errno.h>
+#endif
+#if HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#if HAVE_SYS_IOCTL_H
+# include <sys/ioctl.h>
+#endif
+#if HAVE_LINUX_FS_H
+# include <linux/fs.h>
+#endif
+#if HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+
+#include "fcopy.h"
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+#define FCOPY_CHUNK (1L << 30)   /* the most we ask the kernel for at once */
+#define FCOPY_BUFSIZE (1 << 20)  /* for copying through our own buffer */
+#define FCOPY_ALIGN 4096         /* our buffer starts on a page boundary */
+
+/* how much to ask for next, out of len bytes with done copied */
+static size_t
+_fcopy_want(off_t len, off_t done, size_t most)
+{
+  if (len >= 0 && len - done < (off_t)most)
+    return len - done;
+  return most;
+}
+
+/* nonzero if errno says this way of copying won't work for these files */
+static int
+_fcopy_unsupported(void)
+{
+  return errno == ENOSYS || errno == EXDEV || errno == EINVAL
+    || errno == EOPNOTSUPP || errno == EBADF;
+}
+
+off_t
+fcopy_fd(int in_fd, int out_fd, off_t len)
+{
+  off_t done = 0;
+  size_t want, pos;
+  ssize_t n, m;
+  char *buf;
+
+#if HAVE_COPY_FILE_RANGE
+  while ((want = _fcopy_want(len, done, FCOPY_CHUNK)) > 0) {
+    n = copy_file_range(in_fd, NULL, out_fd, NULL, want, 0);
+    if (n == 0)
+      return done;
+    if (n > 0) {
+      done += n;
+      continue;
+    }
+    if (errno == EINTR)
+      continue;
+    if (!_fcopy_unsupported())
+      return -1;
+    /* carry on some other way, from where we got to */
+    break;
+  }
+  if (len >= 0 && done == len)
+    return done;
+#endif
+
+#if HAVE_SENDFILE && HAVE_SYS_SENDFILE_H
+  while ((want = _fcopy_want(len, done, FCOPY_CHUNK)) > 0) {
+    n = sendfile(out_fd, in_fd, NULL, want);
+    if (n == 0)
+      return done;
+    if (n > 0) {
+      done += n;
+      continue;
+    }
+    if (errno == EINTR)
+      continue;
+    if (!_fcopy_unsupported())
+      return -1;
+    break;
+  }
+  if (len >= 0 && done == len)
+    return done;
+#endif
+
+#if HAVE_POSIX_MEMALIGN
+  if (posix_memalign((void **)&buf, FCOPY_ALIGN, FCOPY_BUFSIZE) != 0)
+    buf = NULL;
+#else
+  buf = (char *)malloc(FCOPY_BUFSIZE);
+#endif
+  if (buf == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  while ((want = _fcopy_want(len, done, FCOPY_BUFSIZE)) > 0) {
+    n = read(in_fd, buf, want);
+    if (n == -1) {
+      if (errno == EINTR)
+	continue;
+      goto error;
+    }
+    if (n == 0)
+      break;
+    for (pos = 0; pos < (size_t)n; pos += m) {
+      m = write(out_fd, buf + pos, n - pos);
+      if (m == -1) {
+	if (errno == EINTR) {
+	  m = 0;
+	  continue;
+	}
+	goto error;
+      }
+    }
+    done += n;
+  }
+
+  free(buf);
+  return done;
+
+ error:
+  free(buf);
+  return -1;
+}
+
+off_t
+fcopy_stream(FILE *in, FILE *out, off_t len)
+{
+  long in_pos, out_pos;
+  off_t done;
+
+  /* bring the descriptors' offsets up to where the streams are */
+  if (fflush(out) == EOF)
+    return -1;
+  in_pos = ftell(in);
+  out_pos = ftell(out);
+  if (in_pos == -1 || out_pos == -1)
+    return -1;
+  if (lseek(fileno(in), in_pos, SEEK_SET) == -1
+      || lseek(fileno(out), out_pos, SEEK_SET) == -1)
+    return -1;
+
+  done = fcopy_fd(fileno(in), fileno(out), len);
+  if (done == -1)
+    return -1;
+
+  /* and the streams up to where the descriptors are */
+  if (fseek(in, in_pos + done, SEEK_SET) == -1
+      || fseek(out, out_pos + done, SEEK_SET) == -1)
+    return -1;
+  return done;
+}
+
+int
+fcopy_file(const char *oldpath, const char *newpath)
+{
+  int in, out, ret, err;
+
+  in = open(oldpath, O_RDONLY | O_BINARY);
+  if (in == -1)
+    return -1;
+  out = open(newpath, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+  if (out == -1)
+    goto error1;
+
+  /* a reflink only works within a filesystem, but that can span mounts */
+  ret = -1;
+#ifdef FICLONE
+  ret = ioctl(out, FICLONE, in);
+#endif
+  if (ret == -1 && fcopy_fd(in, out, -1) == -1)
+    goto error2;
+
+  if (close(out) == -1)
+    goto error1;
+  return close(in);
+
+ error2:
+  err = errno;
+  close(out);
+  errno = err;
+ error1:
+  err = errno;
+  close(in);
+  errno = err;
+  return -1;
+}
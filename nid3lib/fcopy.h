@@ -0,0 +1,60 @@
+/* Copyright (C) 2002--2005 Chris Vaill
+   This file is part of nid3lib.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * Copying data from one file to another, as fast as the system lets
+ * us.  Used by the tag writer, and by normalize when it has to move a
+ * file to another filesystem.
+ */
+
+/* config.h must be included before this */
+
+#ifndef _FCOPY_H_
+#define _FCOPY_H_
+
+#include <stdio.h>
+#if HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Copy len bytes, or everything up to the end of the file if len is
+ * -1, from in_fd to out_fd, each from its current offset, which is
+ * moved past what was copied.  Returns the number of bytes copied,
+ * which is less than len only at the end of the file, or -1 on error.
+ */
+off_t fcopy_fd(int in_fd, int out_fd, off_t len);
+
+/* fcopy_fd() between stdio streams, each from its current position */
+off_t fcopy_stream(FILE *in, FILE *out, off_t len);
+
+/*
+ * Copy the file oldpath to newpath, which is created or truncated.
+ * Where the filesystem allows, the copy shares the original's blocks
+ * instead of duplicating them.  Returns 0 on success, -1 on error.
+ */
+int fcopy_file(const char *oldpath, const char *newpath);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FCOPY_H_ */
@@ -128,6 +128,8 @@ int id3_write(id3_t id3);
 void id3_strip(id3_t id3);
 
 id3_frame_t id3_add_text_frame(id3_t id3, const char *id, const char *text, int encoding);
+char *id3_user_text_get(id3_t tag, const char *desc);
+int id3_user_text_set(id3_t tag, const char *desc, const char *text);
 
 char *id3_title_get(id3_t tag);
 int id3_title_set(id3_t tag, const char *s, enum id3_text_encoding enc);
@@ -147,3 +147,96 @@ id3_add_text_frame(id3_t tag, const char *id, const char *text, int encoding)
 
   return fr;
 }
+
+static const char *
+_user_text_id(id3_t tag)
+{
+  return id3_get_version(tag) == ID3_VERSION_2_2 ? "TXX" : "TXXX";
+}
+
+/*
+ * Find the user defined text frame with the given description.  Only
+ * ISO-8859-1 and UTF-8 frames are considered.
+ */
+static id3_frame_t
+_get_user_text_frame(id3_t tag, const char *desc)
+{
+  const char *id = _user_text_id(tag);
+  unsigned char *s;
+  id3_frame_t f;
+  int desclen = strlen(desc);
+
+  if (id3_frame_count(tag) == -1) /* make sure headers are read */
+    return NULL;
+  for (f = tag->frame_hd; f; f = f->next) {
+    if (strcmp(f->id, id) != 0)
+      continue;
+    s = id3_frame_get_raw(f);
+    if (s == NULL || f->sz < desclen + 2)
+      continue;
+    if (s[0] != ID3_TEXT_ISO && s[0] != ID3_TEXT_UTF8)
+      continue;
+    if (memcmp(s + 1, desc, desclen + 1) == 0)
+      return f;
+  }
+
+  return NULL;
+}
+
+/*
+ * Get the value of the user defined text (TXXX) frame with
+ * description desc, or NULL if there isn't one.
+ */
+char *
+id3_user_text_get(id3_t tag, const char *desc)
+{
+  id3_frame_t f = _get_user_text_frame(tag, desc);
+
+  if (f == NULL)
+    return NULL;
+  return (char *)f->data + 1 + strlen(desc) + 1;
+}
+
+/*
+ * Set the value of the user defined text frame with description
+ * desc, adding the frame if needed.  Both strings are in ISO-8859-1.
+ */
+int
+id3_user_text_set(id3_t tag, const char *desc, const char *text)
+{
+  id3_frame_t f;
+  unsigned char *data;
+  int desclen, textlen, sz;
+
+  desclen = strlen(desc);
+  textlen = strlen(text);
+  sz = 1 + desclen + 1 + textlen;
+
+  /* calloc, with room for the terminating nul chars */
+  data = (unsigned char *)calloc(sz + 2, 1);
+  if (data == NULL)
+    return -1;
+  data[0] = ID3_TEXT_ISO;
+  memcpy(data + 1, desc, desclen);
+  memcpy(data + 1 + desclen + 1, text, textlen);
+
+  f = _get_user_text_frame(tag, desc);
+  if (f == NULL) {
+    /* not id3_frame_add(), which would reuse some other TXXX frame */
+    f = _id3_frame_new();
+    if (f == NULL) {
+      free(data);
+      return -1;
+    }
+    strncpy(f->id, _user_text_id(tag), 4);
+    f->id3 = tag;
+    _id3_frame_add(tag, f);
+  }
+
+  if (f->data)
+    free(f->data);
+  f->data = data;
+  f->sz = sz;
+
+  return 0;
+}
@@ -69,6 +69,7 @@ int ftruncate();
 #endif
 
 #include "nid3P.h"
+#include "fcopy.h"
 
 #define USE_TEMPFILE 1
 
@@ -573,7 +574,7 @@ id3_write(id3_t tag)
   int sz, written, nframes;
   char copybuf[4096];
   char v1buf[128];
-  off_t new_offset;
+  off_t new_offset, copied;
 #if USE_TEMPFILE
   char *tmpfname = NULL, *p;
   int fd, err, write_in_place;
@@ -674,10 +675,8 @@ id3_write(id3_t tag)
     rewind(out);
     if (fseek(tag->fp, tag->offset, SEEK_SET) == -1)
       goto error_free;
-    while ((sz = fread(copybuf, 1, 4096, out)) > 0) {
-      if (fwrite(copybuf, 1, sz, tag->fp) < sz)
-	goto error_free;
-    }
+    if (fcopy_stream(out, tag->fp, -1) == -1)
+      goto error_free;
 
     /* temp file is deleted automatically */
     fclose(out); out = NULL;
@@ -783,11 +782,9 @@ id3_write(id3_t tag)
 	if (fseek(tag->fp, old_tagsz, SEEK_SET) == -1)
 	  goto error_free;
 	tag->curr_off = old_tagsz;
-	while ((sz = fread(copybuf, 1, 4096, tag->fp)) > 0) {
-	  if (fwrite(copybuf, 1, sz, out) < sz)
-	    goto error_free;
-	  tag->curr_off += sz;
-	}
+	if ((copied = fcopy_stream(tag->fp, out, -1)) == -1)
+	  goto error_free;
+	tag->curr_off += copied;
       }
 
       if (tag->v1.exists) {
@@ -832,10 +829,8 @@ id3_write(id3_t tag)
        * if we're not appending, copy rest of file last
        */
       fseek(tag->fp, tag->offset + old_tagsz, SEEK_SET);
-      while ((sz = fread(copybuf, 1, 4096, tag->fp)) > 0) {
-	if (fwrite(copybuf, 1, sz, out) < sz)
-	  goto error_free;
-      }
+      if (fcopy_stream(tag->fp, out, -1) == -1)
+	goto error_free;
 
       /* we're not appending, so if we have an ID3v1 tag,
        * fseek and write the v1 tag. */
@@ -902,12 +897,13 @@ id3_write(id3_t tag)
 
 
 /*
- * like the BSD mkstemp
+ * like the BSD mkstemp; the suffix is counted afresh each call, so
+ * tags may be written from several threads at once
  */
 static int
 xmkstemp(char *template)
 {
-  static char sfx[7] = "AAAAAA";
+  char sfx[7] = "AAAAAA";
   char *p;
   int fd, i, done;
 
@@ -952,10 +948,6 @@ xmkstemp(char *template)
 static int
 xrename(const char *oldpath, const char *newpath)
 {
-  FILE *in, *out;
-  char buf[4096];
-  size_t sz;
-
   if (strcmp(oldpath, newpath) == 0)
     return 0;
 
@@ -969,31 +961,8 @@ xrename(const char *oldpath, const char *newpath)
       /* files are on different filesystems, so we have to copy */
       if (unlink(newpath) == -1 && errno != ENOENT)
 	return -1;
-
-      in = fopen(oldpath, "rb");
-      if (in == NULL)
+      if (fcopy_file(oldpath, newpath) == -1)
 	return -1;
-      out = fopen(newpath, "wb");
-      if (out == NULL) {
-	fclose(in);
-	return -1;
-      }
-
-      while ((sz = fread(buf, 1, 4096, in)) > 0)
-	fwrite(buf, 1, sz, out);
-
-      if (ferror(in) || ferror(out)) {
-	fclose(in);
-	fclose(out);
-	return -1;
-      }
-      if (fclose(in) == EOF) {
-	fclose(out);
-	return -1;
-      }
-      if (fclose(out) == EOF)
-	return -1;
-
       if (unlink(oldpath) == -1)
 	return -1;
     } else {
@@ -15,7 +15,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
 
-#define _POSIX_C_SOURCE 2
+#define _POSIX_C_SOURCE 199506L
 
 #include "config.h"
 
@@ -63,6 +63,9 @@
 #else
 # include "wiener_af.h"
 #endif
+#if USE_PTHREADS
+# include <pthread.h>
+#endif
 
 #ifdef ENABLE_NLS
 # define _(msgid) gettext (msgid)
@@ -73,9 +76,9 @@
 #define N_(msgid) (msgid)
 
 #include "common.h"
-
-/* warn about clipping if we clip more than this fraction of the samples */
-#define CLIPPING_WARN_THRESH 0.001
+#include "kernels.h"
+#include "jobs.h"
+#include "fcopy.h"
 
 /* Should we write to a temp file, which we then rename, rather than
  * just writing in place?  This must be 1 for the -w option to work.  */
@@ -91,9 +94,14 @@ extern char *progname;
 extern int verbose;
 extern int do_compute_levels;
 extern int use_limiter;
+extern int exact_limiter;
 extern int output_bitwidth;
 extern double lmtr_lvl;
 extern double adjust_thresh;
+extern long io_block_size;
+extern int jobs;
+extern int file_jobs;
+extern int show_progress;
 extern int batch_mode; /* FIXME: remove */
 
 #if USE_TEMPFILE
@@ -101,66 +109,6 @@ int xmkstemp(char *template);
 int xrename(const char *oldpath, const char *newpath);
 #endif
 
-static inline long
-get_sample(unsigned char *pdata, int bytes_per_sample)
-{
-  long sample;
-
-  switch(bytes_per_sample) {
-  case 1:
-    sample = *((int8_t *)pdata);
-    break;
-  case 2:
-    /* audiofile returns frames with bytes in host order, so this is okay */
-    sample = *((int16_t *)pdata);
-    break;
-  case 3:
-    /* audiofile aligns 24-bit data on 32-bit boundaries,
-     * so 3 and 4 are the same */
-  case 4:
-    /* audiofile returns frames with bytes in host order, so this is okay */
-    sample = *((int32_t *)pdata);
-    break;
-  default:
-    /* shouldn't happen */
-    /* FIXME: could this happen now? */
-    fprintf(stderr,
-	    _("%s: I don't know what to do with %d bytes per sample\n"),
-	    progname, bytes_per_sample);
-    abort();
-  }
-
-  return sample;
-}
-
-
-static inline void
-put_sample(long sample, unsigned char *pdata, int bytes_per_sample)
-{
-  switch(bytes_per_sample) {
-  case 1:
-    *((int8_t *)pdata) = (int8_t)sample;
-    break;
-  case 2:
-    /* audiofile expects data in host byte order, so this is okay */
-    *((int16_t *)pdata) = (int16_t)sample;
-    break;
-  case 3:
-  case 4:
-    /* audiofile expects data in host byte order, so this is okay */
-    *((int32_t *)pdata) = (int32_t)sample;
-    break;
-  default:
-    /* shouldn't happen */
-    /* FIXME: could this happen now? */
-    fprintf(stderr,
-	    _("%s: I don't know what to do with %d bytes per sample\n"),
-	    progname, bytes_per_sample);
-    abort();
-  }
-}
-
-
 /*
  * Limiter function:
  *
@@ -189,6 +137,442 @@ limiter(double x)
 }
 
 
+#if USE_LOOKUPTABLE
+/*
+ * A lookup table applying gain to 8- or 16-bit samples.  Building
+ * one means calling limiter() for every possible sample, so we keep
+ * the last few around: in batch mode, or with -g, every file gets
+ * the same gain, and we only need to build one.
+ */
+struct gain_lut {
+  /* what the table was built for */
+  double gain;              /* after changing the sample width */
+  int src_bytes, dst_bytes;
+  int limit;                /* TRUE if built with the limiter */
+  double level;             /* the limiter level */
+
+  int32_t *mem;
+  int32_t *lut;             /* mem, offset so it's indexed by sample value */
+  long min_pos_clipped;     /* the smallest positive sample that clips */
+  long max_neg_clipped;     /* the largest negative sample that clips */
+
+  int refs;                 /* files using the table right now */
+  unsigned long last_used;
+  int cached;               /* FALSE if not in lut_cache */
+};
+
+#define LUT_CACHE_SIZE 4
+
+/* protected by jobs_lock() */
+static struct gain_lut *lut_cache[LUT_CACHE_SIZE];
+static unsigned long lut_clock = 0;
+
+/* one thread's share of building a table */
+#define LUT_MAX_PARTS 16
+
+struct lut_part {
+  struct gain_lut *gl;
+  long start, end;          /* sample values [start, end) */
+  long src_samplemin, src_samplemax, dst_samplemin, dst_samplemax;
+  long min_pos_clipped, max_neg_clipped;
+#if USE_PTHREADS
+  pthread_t thread;
+  int started;
+#endif
+};
+
+static void
+build_lut_part(struct lut_part *lp)
+{
+  struct gain_lut *gl = lp->gl;
+  int32_t *lut = gl->lut;
+  double gain = gl->gain;
+  long i, sample;
+
+  lp->min_pos_clipped = lp->src_samplemax + 1;
+  lp->max_neg_clipped = lp->src_samplemin - 1;
+  if (gain > 1.0) {
+    if (gl->limit) {
+      /* apply gain, and apply limiter to avoid clipping */
+      for (i = lp->start; i < 0 && i < lp->end; i++)
+	lut[i] = ROUND(-lp->dst_samplemin
+		       * limiter(i * gain / (double)-lp->dst_samplemin));
+      for (; i < lp->end; i++)
+	lut[i] = ROUND(lp->dst_samplemax
+		       * limiter(i * gain / (double)lp->dst_samplemax));
+    } else {
+      /* apply gain, and do clipping */
+      for (i = lp->start; i < lp->end; i++) {
+	sample = ROUND(i * gain);
+	if (sample > lp->dst_samplemax) {
+	  sample = lp->dst_samplemax;
+	  if (i < lp->min_pos_clipped)
+	    lp->min_pos_clipped = i;
+	} else if (sample < lp->dst_samplemin) {
+	  sample = lp->dst_samplemin;
+	  if (i > lp->max_neg_clipped)
+	    lp->max_neg_clipped = i;
+	}
+	lut[i] = sample; /* negative indices are okay, see above */
+      }
+    }
+  } else {
+    /* just apply gain if it's less than 1 */
+    for (i = lp->start; i < lp->end; i++)
+      lut[i] = ROUND(i * gain);
+  }
+}
+
+#if USE_PTHREADS
+static void *
+build_lut_thread(void *arg)
+{
+  build_lut_part((struct lut_part *)arg);
+  return NULL;
+}
+#endif
+
+/*
+ * Fill in gl->lut, splitting the work between threads if we're
+ * allowed more than one and the table is big enough to be worth it.
+ */
+static void
+build_lut(struct gain_lut *gl)
+{
+  struct lut_part parts[LUT_MAX_PARTS];
+  long src_samplemax, src_samplemin, dst_samplemax, dst_samplemin, n;
+  int nparts, p;
+
+  src_samplemax = (1L << (gl->src_bytes * 8 - 1)) - 1;
+  src_samplemin = -src_samplemax - 1;
+  dst_samplemax = (1L << (gl->dst_bytes * 8 - 1)) - 1;
+  dst_samplemin = -dst_samplemax - 1;
+  n = src_samplemax - src_samplemin + 1;
+
+  gl->mem = (int32_t *)xmalloc(n * sizeof(int32_t));
+  gl->lut = gl->mem - src_samplemin; /* so indices don't have to be offset */
+
+  /*
+   * Only the limiter is slow enough to be worth the threads.  If
+   * run_jobs() is busy, the other processors already have work.
+   */
+  nparts = 1;
+  if (gl->limit && gl->gain > 1.0 && n > 256 && !jobs_parallel())
+    nparts = jobs < LUT_MAX_PARTS ? jobs : LUT_MAX_PARTS;
+  for (p = 0; p < nparts; p++) {
+    parts[p].gl = gl;
+    parts[p].start = src_samplemin + n * p / nparts;
+    parts[p].end = src_samplemin + n * (p + 1) / nparts;
+    parts[p].src_samplemin = src_samplemin;
+    parts[p].src_samplemax = src_samplemax;
+    parts[p].dst_samplemin = dst_samplemin;
+    parts[p].dst_samplemax = dst_samplemax;
+  }
+
+#if USE_PTHREADS
+  for (p = 1; p < nparts; p++)
+    parts[p].started = pthread_create(&parts[p].thread, NULL,
+				      build_lut_thread, &parts[p]) == 0;
+#endif
+  build_lut_part(&parts[0]);
+  for (p = 1; p < nparts; p++) {
+#if USE_PTHREADS
+    if (parts[p].started) {
+      pthread_join(parts[p].thread, NULL);
+      continue;
+    }
+#endif
+    /* no thread for this one, so do it ourselves */
+    build_lut_part(&parts[p]);
+  }
+
+  gl->min_pos_clipped = parts[0].min_pos_clipped;
+  gl->max_neg_clipped = parts[0].max_neg_clipped;
+  for (p = 1; p < nparts; p++) {
+    if (parts[p].min_pos_clipped < gl->min_pos_clipped)
+      gl->min_pos_clipped = parts[p].min_pos_clipped;
+    if (parts[p].max_neg_clipped > gl->max_neg_clipped)
+      gl->max_neg_clipped = parts[p].max_neg_clipped;
+  }
+}
+
+/*
+ * Get a lookup table for the given gain and sample widths, from the
+ * cache if we can.  Give it back with put_gain_lut() when done.
+ */
+static struct gain_lut *
+get_gain_lut(double gain, int src_bytes, int dst_bytes, int limit)
+{
+  struct gain_lut *gl;
+  int i, victim;
+
+  jobs_lock();
+  for (i = 0; i < LUT_CACHE_SIZE; i++) {
+    gl = lut_cache[i];
+    if (gl && gl->gain == gain && gl->src_bytes == src_bytes
+	&& gl->dst_bytes == dst_bytes && gl->limit == limit
+	&& gl->level == lmtr_lvl) {
+      gl->refs++;
+      gl->last_used = ++lut_clock;
+      jobs_unlock();
+      return gl;
+    }
+  }
+  jobs_unlock();
+
+  gl = (struct gain_lut *)xmalloc(sizeof(struct gain_lut));
+  gl->gain = gain;
+  gl->src_bytes = src_bytes;
+  gl->dst_bytes = dst_bytes;
+  gl->limit = limit;
+  gl->level = lmtr_lvl;
+  build_lut(gl);
+  gl->refs = 1;
+  gl->cached = FALSE;
+
+  /* put it in an empty slot, or replace the least recently used */
+  jobs_lock();
+  victim = -1;
+  for (i = 0; i < LUT_CACHE_SIZE; i++) {
+    if (lut_cache[i] == NULL) {
+      victim = i;
+      break;
+    }
+    if (lut_cache[i]->refs == 0
+	&& (victim == -1
+	    || lut_cache[i]->last_used < lut_cache[victim]->last_used))
+      victim = i;
+  }
+  if (victim != -1) {
+    if (lut_cache[victim]) {
+      free(lut_cache[victim]->mem);
+      free(lut_cache[victim]);
+    }
+    lut_cache[victim] = gl;
+    gl->cached = TRUE;
+    gl->last_used = ++lut_clock;
+  }
+  jobs_unlock();
+
+  return gl;
+}
+
+static void
+put_gain_lut(struct gain_lut *gl)
+{
+  int done;
+
+  jobs_lock();
+  done = --gl->refs == 0 && !gl->cached;
+  jobs_unlock();
+  if (done) {
+    free(gl->mem);
+    free(gl);
+  }
+}
+#endif /* USE_LOOKUPTABLE */
+
+
+/*
+ * What it takes to apply the gain to a block of frames; the same for
+ * every block of a file.
+ */
+struct apply {
+  AFfilehandle fhin, fhout;
+  int channels;
+  int src_format, dst_format; /* as the kernels take them */
+  int src_framesz, dst_framesz;
+  double gain;              /* after changing the sample width */
+  long dst_samplemax, dst_samplemin;
+  int limit;                /* TRUE to limit instead of clipping */
+#if USE_LOOKUPTABLE
+  struct gain_lut *gl;      /* or NULL, if there's no table */
+#endif
+};
+
+/*
+ * Apply the gain to nframes frames from src, storing them in dst.
+ * Returns the number of samples clipped.
+ */
+static unsigned int
+apply_block(const struct apply *ap, const void *src, void *dst, int nframes)
+{
+  int n = nframes * ap->channels;
+#if USE_LOOKUPTABLE
+  unsigned int lut_clippings;
+
+  if (ap->gl) {
+    /* use the lookup table if we have one */
+    lut_clippings = lut_samples(src, ap->src_format, dst, ap->dst_format, n,
+				ap->gl->lut, ap->gl->min_pos_clipped,
+				ap->gl->max_neg_clipped);
+    return use_limiter ? 0 : lut_clippings;
+  }
+#endif
+
+  /* no lookup table, do it by hand */
+
+  if (ap->limit && exact_limiter && verbose >= VERBOSE_INFO)
+    fprintf(stderr,
+	    _("%s: Warning: no lookup table available; this may be slow...\n"),
+	    progname);
+
+  if (ap->gain > 1.0 && ap->limit) {
+    /*
+     * The gain doesn't depend on the channel, so we go through the
+     * samples in the order they're stored, using the limiter
+     * function instead of clipping.  Unless we're told otherwise,
+     * we use a close approximation of the function that's much
+     * faster than calling tanh() for every sample.
+     */
+    if (exact_limiter)
+      limit_samples(src, ap->src_format, dst, ap->dst_format, n,
+		    ap->gain, ap->dst_samplemax, limiter);
+    else
+      softlimit_samples(src, ap->src_format, dst, ap->dst_format, n,
+			ap->gain, ap->dst_samplemax, lmtr_lvl);
+    return 0;
+  }
+
+  /* apply the gain, and clip if it's more than 1 */
+  return gain_samples(src, ap->src_format, dst, ap->dst_format, n, ap->gain,
+		      ap->dst_samplemax, ap->dst_samplemin, ap->gain > 1.0);
+}
+
+#if USE_PTHREADS && !USE_AUDIOFILE && HAVE_PREAD && HAVE_PWRITE
+/*
+ * For a long file, the gain can be applied by several threads, each
+ * reading its own slice of the frames and writing them to the same
+ * place in the output, which is made the right length beforehand.
+ * Only the first slice updates the progress meter.
+ */
+#define MIN_SLICE_BYTES (8L << 20)  /* don't bother with slices < 8M */
+
+struct slice {
+  const struct apply *ap;
+  AFframecount start, end;  /* frames [start, end) of the file */
+  AFframecount done;        /* frames written so far */
+  int frames_in_buf;
+  unsigned int nclippings;
+  char *prefix;             /* progress meter prefix, or NULL */
+  int status;               /* 0 if ok, -1 on a write error */
+  pthread_t thread;
+  int started;
+};
+
+static void
+apply_slice(struct slice *sl)
+{
+  const struct apply *ap = sl->ap;
+  unsigned char *src_buf, *dst_buf;
+  const void *frames;
+  AFframecount pos;
+  int want, got;
+  float last_progress = 0, progress;
+
+  src_buf = (unsigned char *)xmalloc(sl->frames_in_buf * ap->src_framesz);
+  dst_buf = (unsigned char *)xmalloc(sl->frames_in_buf * ap->dst_framesz);
+
+  for (pos = sl->start; pos < sl->end; pos += got) {
+    want = sl->frames_in_buf;
+    if (sl->end - pos < want)
+      want = sl->end - pos;
+    got = afReadFramesAtDirect(ap->fhin, AF_DEFAULT_TRACK, pos, src_buf,
+			       want, &frames);
+    if (got <= 0)
+      break;
+
+    sl->nclippings += apply_block(ap, frames, dst_buf, got);
+
+    if (afWriteFramesAt(ap->fhout, AF_DEFAULT_TRACK, pos, dst_buf,
+			got) == -1) {
+      sl->status = -1;
+      break;
+    }
+    sl->done += got;
+
+    /* update progress meter */
+    if (sl->prefix) {
+      progress = sl->done / (float)(sl->end - sl->start);
+      if (progress >= last_progress + 0.01) {
+	progress_callback(sl->prefix, progress);
+	last_progress = progress;
+      }
+    }
+
+    /* the data chunk may claim more than the file really holds */
+    if (got < want)
+      break;
+  }
+
+  free(src_buf);
+  free(dst_buf);
+}
+
+static void *
+slice_thread(void *arg)
+{
+  apply_slice((struct slice *)arg);
+  return NULL;
+}
+
+/*
+ * Apply the gain to the framecount frames of a file in nslices slices
+ * at once.  The number of clipped samples is added to *pnclippings.
+ * Returns the number of frames written, which is less than framecount
+ * if the file ended early, or -1 on a write error.
+ */
+static AFframecount
+apply_slices(const struct apply *ap, AFframecount framecount, int nslices,
+	     int frames_in_buf, char *prefix, unsigned int *pnclippings)
+{
+  struct slice *slices;
+  AFframecount frames_done;
+  int s;
+
+  slices = (struct slice *)xmalloc(nslices * sizeof(struct slice));
+  for (s = 0; s < nslices; s++) {
+    slices[s].ap = ap;
+    slices[s].start = framecount * s / nslices;
+    slices[s].end = framecount * (s + 1) / nslices;
+    slices[s].done = 0;
+    slices[s].frames_in_buf = frames_in_buf;
+    slices[s].nclippings = 0;
+    slices[s].prefix = s == 0 ? prefix : NULL;
+    slices[s].status = 0;
+  }
+
+  for (s = 1; s < nslices; s++)
+    slices[s].started = pthread_create(&slices[s].thread, NULL,
+				       slice_thread, &slices[s]) == 0;
+  apply_slice(&slices[0]);
+  for (s = 1; s < nslices; s++) {
+    if (slices[s].started) {
+      pthread_join(slices[s].thread, NULL);
+      continue;
+    }
+    /* no thread for this one, so do it ourselves */
+    apply_slice(&slices[s]);
+  }
+
+  /* the frames that made it are those up to the first short slice */
+  frames_done = 0;
+  for (s = 0; s < nslices; s++) {
+    if (slices[s].status != 0) {
+      frames_done = -1;
+      break;
+    }
+    *pnclippings += slices[s].nclippings;
+    frames_done += slices[s].done;
+    if (slices[s].start + slices[s].done < slices[s].end)
+      break;
+  }
+
+  free(slices);
+  return frames_done;
+}
+#endif
+
 /*
  * input is read from read_fd and output is written to write_fd:
  * filename is used only for messages.
@@ -204,24 +588,30 @@ _do_apply_gain(int read_fd, int write_fd, char *filename, double gain,
   AFfilehandle fhin, fhout;
   AFframecount framecount;
   AFfilesetup setup;
-  int i, c, af_fmt;
+  struct apply ap;
+  int af_fmt;
   int src_bytes_per_samp, dst_bytes_per_samp, src_framesz, dst_framesz;
+  int src_format, dst_format;
   int channels, samp_fmt, src_samp_width, dst_samp_width, fmt_vers;
-  unsigned int samp_rate, frames_done, nclippings;
-  long sample, src_samplemax, src_samplemin, dst_samplemax, dst_samplemin;
-  double sample_d;
+  unsigned int frames_done, nclippings;
+  long src_samplemax, src_samplemin, dst_samplemax, dst_samplemin;
   float clip_loss;
 
   float last_progress = 0, progress;
   char prefix_buf[18];
 
-  unsigned char *src_buf = NULL, *dst_buf = NULL, *src_pos, *dst_pos;
+  unsigned char *src_buf = NULL, *dst_buf = NULL;
+  const unsigned char *src_data;
+#if !USE_AUDIOFILE
+  const void *frames;
+#endif
   int frames_in_buf, frames_recvd;
-  int use_limiter_this_file;
+  int use_limiter_this_file, nslices;
+#if USE_PTHREADS && !USE_AUDIOFILE && HAVE_PREAD && HAVE_PWRITE
+  AFframecount frames_written;
+#endif
 #if USE_LOOKUPTABLE
-  int min_pos_clipped = 0; /* the minimum positive sample that gets clipped */
-  int max_neg_clipped = 0; /* the maximum negative sample that gets clipped */
-  int32_t *lut = NULL;
+  struct gain_lut *gl = NULL;
 #endif
 
   /* FIXME: abort on any and all errors (in case using temp file) */
@@ -253,7 +643,6 @@ _do_apply_gain(int read_fd, int write_fd, char *filename, double gain,
   }
   afInitSampleFormat(setup, AF_DEFAULT_TRACK, samp_fmt, dst_samp_width);
   afInitRate(setup, AF_DEFAULT_TRACK, afGetRate(fhin, AF_DEFAULT_TRACK));
-  samp_rate = (unsigned int)afGetRate(fhin, AF_DEFAULT_TRACK);
 
   fhout = afOpenFD(write_fd, "w", setup);
   if (fhout == AF_NULL_FILEHANDLE) {
@@ -272,13 +661,30 @@ _do_apply_gain(int read_fd, int write_fd, char *filename, double gain,
   dst_samplemax = (1 << (dst_bytes_per_samp * 8 - 1)) - 1;
   dst_samplemin = -dst_samplemax - 1;
 
-  /* ignore different channels, apply gain to all samples */
+  /*
+   * The kernels can take the samples as they are in the files, so
+   * they don't need converting on the way in and out.
+   */
+  src_format = src_bytes_per_samp;
+  dst_format = dst_bytes_per_samp;
+#if !USE_AUDIOFILE
+  src_format = afKeepFileSamples(fhin, AF_DEFAULT_TRACK);
+  dst_format = afKeepFileSamples(fhout, AF_DEFAULT_TRACK);
+#endif
+
+  /*
+   * ignore different channels, apply gain to all samples; a stream
+   * may not say how many frames it has
+   */
   framecount = afGetFrameCount(fhin, AF_DEFAULT_TRACK);
 
-  /* set up buffer to hold 1/100 of a second worth of frames */
-  frames_in_buf = samp_rate / 100;
+  /* set up buffers to hold a block's worth of frames */
   src_framesz = afGetFrameSize(fhin, AF_DEFAULT_TRACK, 1);
   dst_framesz = afGetFrameSize(fhout, AF_DEFAULT_TRACK, 1);
+  frames_in_buf = io_block_size / (src_framesz > dst_framesz
+				   ? src_framesz : dst_framesz);
+  if (frames_in_buf < 1)
+    frames_in_buf = 1;
   src_buf = (unsigned char *)xmalloc(frames_in_buf * src_framesz);
   dst_buf = (unsigned char *)xmalloc(frames_in_buf * dst_framesz);
 
@@ -288,10 +694,14 @@ _do_apply_gain(int read_fd, int write_fd, char *filename, double gain,
    * we don't if gain <= 1 or if the peaks wouldn't clip anyway.
    */
   use_limiter_this_file = use_limiter && gain > 1.0;
-  if (use_limiter_this_file && si) {
+  /* with --fast, we haven't seen all the peaks */
+  if (use_limiter_this_file && si && si->level_hi == 0) {
     if (si->max_sample * gain <= src_samplemax
 	&& si->min_sample * gain >= src_samplemin)
       use_limiter_this_file = FALSE;
+    /* the waveform between the samples may still go over */
+    if (si->true_peak * gain > 1.0)
+      use_limiter_this_file = TRUE;
   }
 
   /*
@@ -303,51 +713,40 @@ _do_apply_gain(int read_fd, int write_fd, char *filename, double gain,
 
 #if USE_LOOKUPTABLE
   /*
-   * If input samples are 16 bits or less, build a lookup table for
+   * If input samples are 16 bits or less, use a lookup table for
    * fast adjustment.  This table is 256k, look out!
    */
-  if (src_bytes_per_samp <= 2) {
-    lut = (int32_t *)xmalloc((src_samplemax - src_samplemin + 1) * sizeof(int32_t));
-    lut -= src_samplemin; /* so indices don't have to be offset */
-    min_pos_clipped = src_samplemax + 1;
-    max_neg_clipped = src_samplemin - 1;
-    if (gain > 1.0) {
-      if (use_limiter_this_file) {
-	/* apply gain, and apply limiter to avoid clipping */
-	for (i = src_samplemin; i < 0; i++)
-	  lut[i] = ROUND(-dst_samplemin * limiter(i * gain / (double)-dst_samplemin));
-	for (; i <= src_samplemax; i++)
-	  lut[i] = ROUND(dst_samplemax * limiter(i * gain / (double)dst_samplemax));
-      } else {
-	/* apply gain, and do clipping */
-	for (i = src_samplemin; i <= src_samplemax; i++) {
-	  sample = ROUND(i * gain);
-	  if (sample > dst_samplemax) {
-	    sample = dst_samplemax;
-	    if (i < min_pos_clipped)
-	      min_pos_clipped = i;
-	  } else if (sample < dst_samplemin) {
-	    sample = dst_samplemin;
-	    if (i > max_neg_clipped)
-	      max_neg_clipped = i;
-	  }
-	  lut[i] = sample; /* negative indices are okay, see above */
-	}
-      }
-    } else {
-      /* just apply gain if it's less than 1 */
-      for (i = src_samplemin; i <= src_samplemax; i++)
-	lut[i] = ROUND(i * gain);
-    }
-#if 0
-    {
-      /* write the lookup table function for display in gnuplot */
-      FILE *tblout = fopen("lut.dat", "w");
-      for (i = src_samplemin; i <= src_samplemax; i++)
-	fprintf(tblout, "%d %d\n", i, lut[i]);
-      fclose(tblout);
-    }
+  if (src_bytes_per_samp <= 2)
+    gl = get_gain_lut(gain, src_bytes_per_samp, dst_bytes_per_samp,
+		      use_limiter_this_file);
+#endif
+
+  ap.fhin = fhin;
+  ap.fhout = fhout;
+  ap.channels = channels;
+  ap.src_format = src_format;
+  ap.dst_format = dst_format;
+  ap.src_framesz = src_framesz;
+  ap.dst_framesz = dst_framesz;
+  ap.gain = gain;
+  ap.dst_samplemax = dst_samplemax;
+  ap.dst_samplemin = dst_samplemin;
+  ap.limit = use_limiter_this_file;
+#if USE_LOOKUPTABLE
+  ap.gl = gl;
 #endif
+
+  /* split the file up if we've been given threads to spare */
+  nslices = 1;
+#if USE_PTHREADS && !USE_AUDIOFILE && HAVE_PREAD && HAVE_PWRITE
+  if (file_jobs > 1 && framecount > 0 && lseek(read_fd, 0, SEEK_CUR) != -1) {
+    nslices = file_jobs;
+    if (framecount * src_framesz / MIN_SLICE_BYTES < nslices)
+      nslices = framecount * src_framesz / MIN_SLICE_BYTES;
+    /* the output must be the right length before the slices go in */
+    if (nslices > 1
+	&& afSetFrameCount(fhout, AF_DEFAULT_TRACK, framecount) == -1)
+      nslices = 1;
   }
 #endif
 
@@ -359,96 +758,56 @@ _do_apply_gain(int read_fd, int write_fd, char *filename, double gain,
     last_progress = 0.0;
   }
 
-  /* read, apply gain, and write, one chunk at time */
   nclippings = frames_done = 0;
-  while ((frames_recvd = afReadFrames(fhin, AF_DEFAULT_TRACK, src_buf, frames_in_buf)) > 0) {
-#if USE_LOOKUPTABLE
-    if (lut) {
-      /* use the lookup table if we built one */
-
-      /* FIXME: is the loop order here causing bad cache behavior? */
-      for (c = 0; c < channels; c++) {
-	src_pos = src_buf + c * (src_framesz / channels);
-	dst_pos = dst_buf + c * (dst_framesz / channels);
-	for (i = 0; i < frames_recvd; i++) {
 
-	  sample = get_sample(src_pos, src_bytes_per_samp);
-
-	  if (!use_limiter
-	      && (sample >= min_pos_clipped || sample <= max_neg_clipped))
-	    nclippings++;
-
-	  sample = lut[sample];
+  if (nslices > 1) {
+#if USE_PTHREADS && !USE_AUDIOFILE && HAVE_PREAD && HAVE_PWRITE
+    frames_written = apply_slices(&ap, framecount, nslices, frames_in_buf,
+				  verbose >= VERBOSE_PROGRESS
+				  ? prefix_buf : NULL, &nclippings);
+    if (frames_written == -1
+	|| (frames_written < framecount
+	    && afSetFrameCount(fhout, AF_DEFAULT_TRACK, frames_written) == -1)) {
+      fprintf(stderr, _("%s: afWriteFrames failed\n"), progname);
+      goto error4;
+    }
+    frames_done = frames_written;
+#endif
+  } else {
+    /* read, apply gain, and write, one chunk at time */
+    src_data = src_buf;
+    for (;;) {
+#if !USE_AUDIOFILE
+      /* straight out of the file's memory mapping, if possible */
+      frames_recvd = afReadFramesDirect(fhin, AF_DEFAULT_TRACK, src_buf,
+					frames_in_buf, &frames);
+      src_data = (const unsigned char *)frames;
+#else
+      frames_recvd = afReadFrames(fhin, AF_DEFAULT_TRACK, src_buf,
+				  frames_in_buf);
+#endif
+      if (frames_recvd <= 0)
+	break;
 
-	  put_sample(sample, dst_pos, dst_bytes_per_samp);
+      nclippings += apply_block(&ap, src_data, dst_buf, frames_recvd);
 
-	  src_pos += src_framesz;
-	  dst_pos += dst_framesz;
-	}
+      if (afWriteFrames(fhout, AF_DEFAULT_TRACK, dst_buf,
+			frames_recvd) == -1) {
+	fprintf(stderr, _("%s: afWriteFrames failed\n"), progname);
+	goto error4;
       }
 
-    } else {
-#endif
-      /* no lookup table, do it by hand */
+      frames_done += frames_recvd;
 
-      if (use_limiter_this_file && verbose >= VERBOSE_INFO)
-	fprintf(stderr,
-	_("%s: Warning: no lookup table available; this may be slow...\n"),
-		progname);
-
-      for (c = 0; c < channels; c++) {
-	src_pos = src_buf + c * (src_framesz / channels);
-	dst_pos = dst_buf + c * (dst_framesz / channels);
-	for (i = 0; i < frames_recvd; i++) {
-
-	  sample = get_sample(src_pos, src_bytes_per_samp);
-
-	  /* apply the gain to the sample */
-	  sample_d = sample * gain;
-
-	  if (gain > 1.0) {
-	    if (use_limiter_this_file) {
-	      /* use limiter function instead of clipping */
-	      sample = ROUND(dst_samplemax * limiter(sample_d/(double)dst_samplemax));
-	    } else {
-	      sample = ROUND(sample_d);
-	      /* perform clipping */
-	      if (sample_d > dst_samplemax) {
-		sample = dst_samplemax;
-		nclippings++;
-	      } else if (sample_d < dst_samplemin) {
-		sample = dst_samplemin;
-		nclippings++;
-	      }
-	    }
-	  } else { /* gain <= 1.0 */
-	    sample = ROUND(sample_d);
-	  }
-
-	  put_sample(sample, dst_pos, dst_bytes_per_samp);
-
-	  src_pos += src_framesz;
-	  dst_pos += dst_framesz;
+      /* update progress meter */
+      if (verbose >= VERBOSE_PROGRESS && framecount > 0) {
+	progress = frames_done / (float)framecount;
+	if (progress >= last_progress + 0.01) {
+	  progress_callback(prefix_buf, progress);
+	  /* a block may be several percent of the file */
+	  last_progress = progress;
 	}
       }
-#if USE_LOOKUPTABLE
-    }
-#endif
-
-    if (afWriteFrames(fhout, AF_DEFAULT_TRACK, dst_buf, frames_recvd) == -1) {
-      fprintf(stderr, _("%s: afWriteFrames failed\n"), progname);
-      goto error4;
-    }
-
-    frames_done += frames_recvd;
-
-    /* update progress meter */
-    if (verbose >= VERBOSE_PROGRESS) {
-      progress = frames_done / (float)framecount;
-      if (progress >= last_progress + 0.01) {
-	progress_callback(prefix_buf, progress);
-	last_progress += 0.01;
-      }
     }
   }
 
@@ -456,8 +815,8 @@ _do_apply_gain(int read_fd, int write_fd, char *filename, double gain,
   if (verbose >= VERBOSE_PROGRESS)
     progress_callback(prefix_buf, 1.0);
 
-  if (!use_limiter_this_file) {
-    clip_loss = (float)nclippings / (framecount * (float)channels);
+  if (!use_limiter_this_file && frames_done > 0) {
+    clip_loss = (float)nclippings / (frames_done * (float)channels);
 
     if (verbose >= VERBOSE_INFO) {
       if (nclippings) {
@@ -474,11 +833,8 @@ _do_apply_gain(int read_fd, int write_fd, char *filename, double gain,
   }
 
 #if USE_LOOKUPTABLE
-  if (lut) {
-    /* readjust the pointer to the beginning of the array */
-    lut += src_samplemin;
-    free(lut);
-  }
+  if (gl)
+    put_gain_lut(gl);
 #endif
   if (afSyncFile(fhout) < 0)
     fprintf(stderr, _("%s: afSyncFile failed\n"), progname);
@@ -493,6 +849,10 @@ _do_apply_gain(int read_fd, int write_fd, char *filename, double gain,
 
   /* error handling stuff */
  error4:
+#if USE_LOOKUPTABLE
+  if (gl)
+    put_gain_lut(gl);
+#endif
   free(src_buf);
   free(dst_buf);
   afCloseFile(fhout);
@@ -527,6 +887,16 @@ apply_gain(char *filename, double gain, struct signal_info *si)
   char *tmpfile, *p;
 #endif
 
+  /*
+   * Adjust the standard input onto the standard output, as a filter.
+   * Nothing here needs to seek, so pipes are fine.
+   */
+  if (strcmp(filename, "-") == 0) {
+    if (_do_apply_gain(STDIN_FILENO, STDOUT_FILENO, "STDIN", gain, si) == -1)
+      return -1;
+    return 1;
+  }
+
   /* defer to specialized function for mp3 files */
   i = strlen(filename);
   if (i >= 4) {
@@ -546,9 +916,17 @@ apply_gain(char *filename, double gain, struct signal_info *si)
     }
   }
 
-  if (!batch_mode && verbose >= VERBOSE_PROGRESS)
+  if (!batch_mode && verbose >= VERBOSE_PROGRESS) {
+    /* other files may be in progress, so clear the progress meter */
+    jobs_lock();
+    if (jobs_parallel() && show_progress)
+      fprintf(stderr,
+	      "\r                                     "
+	      "                                     \r");
     fprintf(stderr, _("Applying adjustment of %0.2fdB to %s...\n"),
 	    dBdiff, filename);
+    jobs_unlock();
+  }
 
   /* open a descriptor for reading */
   read_fd = open(filename, O_RDONLY | O_BINARY);
@@ -618,12 +996,14 @@ apply_gain(char *filename, double gain, struct signal_info *si)
 #if USE_TEMPFILE
 /*
  * This works like the BSD mkstemp, except that we don't unlink the
- * file, since we end up renaming it to something else.
+ * file, since we end up renaming it to something else.  Each call
+ * counts through the suffixes afresh, so with -j the jobs don't share
+ * any state; O_EXCL settles which of them gets a name.
  */
 int
 xmkstemp(char *template)
 {
-  static char sfx[7] = "AAAAAA";
+  char sfx[7] = "AAAAAA";
   char *p;
   int fd, i, done;
 
@@ -668,10 +1048,6 @@ xmkstemp(char *template)
 int
 xrename(const char *oldpath, const char *newpath)
 {
-  FILE *in, *out;
-  char buf[4096];
-  size_t sz;
-
   if (strcmp(oldpath, newpath) == 0)
     return 0;
 
@@ -685,31 +1061,8 @@ xrename(const char *oldpath, const char *newpath)
       /* files are on different filesystems, so we have to copy */
       if (unlink(newpath) == -1 && errno != ENOENT)
 	return -1;
-
-      in = fopen(oldpath, "rb");
-      if (in == NULL)
-	return -1;
-      out = fopen(newpath, "wb");
-      if (out == NULL) {
-	fclose(in);
-	return -1;
-      }
-
-      while ((sz = fread(buf, 1, 4096, in)) > 0)
-	fwrite(buf, 1, sz, out);
-
-      if (ferror(in) || ferror(out)) {
-	fclose(in);
-	fclose(out);
-	return -1;
-      }
-      if (fclose(in) == EOF) {
-	fclose(out);
-	return -1;
-      }
-      if (fclose(out) == EOF)
+      if (fcopy_file(oldpath, newpath) == -1)
 	return -1;
-
       if (unlink(oldpath) == -1)
 	return -1;
     } else {
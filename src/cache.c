@@ -0,0 +1,472 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * The analysis cache lives in a single text file,
+ * $XDG_CACHE_HOME/normalize/levels.  After a header line, each line
+ * holds one file's key and the results of analyzing it.  New results
+ * are appended, so a file analyzed several times has several lines;
+ * the last one wins, and when the stale lines start to outnumber the
+ * live ones, the file is rewritten.  Doubles are written in hex so
+ * they come back bit for bit.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <stdio.h>
+#if STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#else
+# if HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+# if HAVE_STRING_H
+#  include <string.h>
+# endif
+#endif
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_ERRNO_H
+# include <errno.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#if ENABLE_NLS
+# define _(msgid) gettext (msgid)
+# include <libintl.h>
+#else
+# define _(msgid) (msgid)
+#endif
+
+#include "common.h"
+#include "cache.h"
+#include "jobs.h"
+
+extern char *progname;
+extern int verbose;
+extern long io_block_size;
+extern void *xmalloc(size_t size);
+extern const char *analysis_method(void);
+
+#define CACHE_HEADER "normalize-cache 1"
+#define CACHE_FILE "normalize/levels"
+
+struct cache_entry {
+  struct cache_key key;
+  char method[16];
+  double power;
+  double level;
+  double peak;
+  double true_peak;         /* 0 in entries from before we kept it */
+  long max_sample;
+  long min_sample;
+  int channels;
+  int bits_per_sample;
+  unsigned int samples_per_sec;
+  int line;                 /* where in the file we found it */
+};
+
+/* entries loaded at startup, sorted by device and inode */
+static struct cache_entry *entries = NULL;
+static int nentries = 0;
+static FILE *cache_fp = NULL;
+static char *cache_path = NULL;
+
+static char *
+cache_file_name(void)
+{
+  const char *dir;
+  char *path;
+
+  dir = getenv("XDG_CACHE_HOME");
+  if (dir && dir[0] == '/') {
+    path = (char *)xmalloc(strlen(dir) + strlen(CACHE_FILE) + 2);
+    sprintf(path, "%s/%s", dir, CACHE_FILE);
+    return path;
+  }
+  dir = getenv("HOME");
+  if (dir == NULL || dir[0] == '\0')
+    return NULL;
+  path = (char *)xmalloc(strlen(dir) + strlen(CACHE_FILE) + 9);
+  sprintf(path, "%s/.cache/%s", dir, CACHE_FILE);
+  return path;
+}
+
+/* create the directories leading up to path, like mkdir -p */
+static int
+make_parent_dirs(char *path)
+{
+  char *p;
+
+  for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+    *p = '\0';
+    if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+      *p = '/';
+      return -1;
+    }
+    *p = '/';
+  }
+  return 0;
+}
+
+/* order entries by file */
+static int
+compare_files(const void *a, const void *b)
+{
+  const struct cache_entry *x = (const struct cache_entry *)a;
+  const struct cache_entry *y = (const struct cache_entry *)b;
+
+  if (x->key.dev != y->key.dev)
+    return x->key.dev < y->key.dev ? -1 : 1;
+  if (x->key.ino != y->key.ino)
+    return x->key.ino < y->key.ino ? -1 : 1;
+  return 0;
+}
+
+/* order entries by file, then by where they appear in the cache file */
+static int
+compare_entries(const void *a, const void *b)
+{
+  int c = compare_files(a, b);
+
+  if (c)
+    return c;
+  return ((const struct cache_entry *)a)->line
+    - ((const struct cache_entry *)b)->line;
+}
+
+static int
+parse_entry(const char *line, struct cache_entry *e)
+{
+  char hash[20];
+  char *end;
+  int n;
+
+  e->true_peak = 0.0;
+  n = sscanf(line, "%llu %llu %lld %lld %ld %19s %15s %lf %lf %lf %ld %ld %d %d %u %lf",
+	     &e->key.dev, &e->key.ino, &e->key.size,
+	     &e->key.mtime_sec, &e->key.mtime_nsec, hash, e->method,
+	     &e->power, &e->level, &e->peak, &e->max_sample, &e->min_sample,
+	     &e->channels, &e->bits_per_sample, &e->samples_per_sec,
+	     &e->true_peak);
+  if (n != 15 && n != 16)
+    return -1;
+  e->key.valid = TRUE;
+  e->key.has_hash = strcmp(hash, "-") != 0;
+  e->key.hash = 0;
+  if (e->key.has_hash) {
+    e->key.hash = strtoull(hash, &end, 16);
+    if (*end != '\0')
+      return -1;
+  }
+  return 0;
+}
+
+static void
+write_entry(FILE *fp, const struct cache_entry *e)
+{
+  char hash[20];
+
+  if (e->key.has_hash)
+    sprintf(hash, "%016llx", (unsigned long long)e->key.hash);
+  else
+    strcpy(hash, "-");
+  fprintf(fp, "%llu %llu %lld %lld %ld %s %s %a %a %a %ld %ld %d %d %u %a\n",
+	  e->key.dev, e->key.ino, e->key.size,
+	  e->key.mtime_sec, e->key.mtime_nsec, hash, e->method,
+	  e->power, e->level, e->peak, e->max_sample, e->min_sample,
+	  e->channels, e->bits_per_sample, e->samples_per_sec, e->true_peak);
+}
+
+/*
+ * Read the cache file into entries.  Returns the number of entry
+ * lines in the file, or -1 if the file isn't ours.
+ */
+static int
+load_cache(FILE *fp)
+{
+  char line[512];
+  int nlines = 0, size = 0, i, j;
+
+  if (fgets(line, sizeof(line), fp) == NULL)
+    return 0;
+  if (strcmp(line, CACHE_HEADER "\n") != 0)
+    return -1;
+
+  while (fgets(line, sizeof(line), fp)) {
+    if (nentries == size) {
+      size = size ? 2 * size : 256;
+      entries = (struct cache_entry *)realloc(entries, size * sizeof(struct cache_entry));
+      if (entries == NULL) {
+	fprintf(stderr, _("%s: unable to malloc\n"), progname);
+	exit(1);
+      }
+    }
+    if (parse_entry(line, &entries[nentries]) == -1)
+      continue;
+    entries[nentries].line = nlines++;
+    nentries++;
+  }
+
+  /* sort, then keep only the last entry for each file, so keys are unique */
+  if (nentries > 0)
+    qsort(entries, nentries, sizeof(struct cache_entry), compare_entries);
+  for (i = j = 0; i < nentries; i++) {
+    if (i + 1 < nentries
+	&& entries[i + 1].key.dev == entries[i].key.dev
+	&& entries[i + 1].key.ino == entries[i].key.ino)
+      continue;
+    entries[j++] = entries[i];
+  }
+  nentries = j;
+
+  return nlines;
+}
+
+/* write out just the live entries, and replace the cache file */
+static void
+rewrite_cache(void)
+{
+  char *tmpfile;
+  FILE *fp;
+  int fd, i;
+
+  tmpfile = (char *)xmalloc(strlen(cache_path) + 8);
+  sprintf(tmpfile, "%s.XXXXXX", cache_path);
+  fd = mkstemp(tmpfile);
+  if (fd == -1)
+    goto error;
+  fp = fdopen(fd, "w");
+  if (fp == NULL) {
+    close(fd);
+    unlink(tmpfile);
+    goto error;
+  }
+  fprintf(fp, "%s\n", CACHE_HEADER);
+  for (i = 0; i < nentries; i++)
+    write_entry(fp, &entries[i]);
+  if (fclose(fp) == EOF || rename(tmpfile, cache_path) == -1) {
+    unlink(tmpfile);
+    goto error;
+  }
+  free(tmpfile);
+  return;
+
+ error:
+  if (verbose >= VERBOSE_PROGRESS)
+    fprintf(stderr, _("%s: Warning: unable to rewrite cache %s: %s\n"),
+	    progname, cache_path, strerror(errno));
+  free(tmpfile);
+}
+
+int
+cache_open(int rebuild)
+{
+  FILE *fp;
+  int nlines = 0;
+
+  cache_path = cache_file_name();
+  if (cache_path == NULL) {
+    fprintf(stderr, _("%s: Warning: neither XDG_CACHE_HOME nor HOME is set, not using the cache\n"),
+	    progname);
+    return -1;
+  }
+  if (make_parent_dirs(cache_path) == -1)
+    goto error;
+
+  if (!rebuild) {
+    fp = fopen(cache_path, "r");
+    if (fp) {
+      nlines = load_cache(fp);
+      fclose(fp);
+    }
+    /* an old or foreign cache file, or too many stale entries */
+    if (nlines == -1 || nlines > 2 * nentries + 64)
+      rewrite_cache();
+  }
+
+  cache_fp = fopen(cache_path, "a");
+  if (cache_fp == NULL)
+    goto error;
+  if (ftell(cache_fp) == 0)
+    fprintf(cache_fp, "%s\n", CACHE_HEADER);
+  return 0;
+
+ error:
+  fprintf(stderr, _("%s: Warning: unable to open cache %s: %s\n"),
+	  progname, cache_path, strerror(errno));
+  free(cache_path);
+  cache_path = NULL;
+  free(entries);
+  entries = NULL;
+  nentries = 0;
+  return -1;
+}
+
+/*
+ * Read the whole file, in io_block_size chunks, and hash it with
+ * FNV-1a, a word at a time.
+ */
+static int
+hash_file(const char *filename, uint64_t *phash)
+{
+  unsigned char *buf;
+  uint64_t h = 0xcbf29ce484222325ULL, w;
+  ssize_t n, got;
+  int fd, i;
+
+  fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    return -1;
+  buf = (unsigned char *)xmalloc(io_block_size);
+  for (;;) {
+    /* fill the whole buffer, so the hash doesn't depend on how reads split */
+    for (got = 0; got < io_block_size; got += n) {
+      n = read(fd, buf + got, io_block_size - got);
+      if (n == -1) {
+	if (errno == EINTR) {
+	  n = 0;
+	  continue;
+	}
+	free(buf);
+	close(fd);
+	return -1;
+      }
+      if (n == 0)
+	break;
+    }
+    for (i = 0; i + 8 <= got; i += 8) {
+      memcpy(&w, buf + i, 8);
+      h = (h ^ w) * 0x100000001b3ULL;
+    }
+    for (; i < got; i++)
+      h = (h ^ buf[i]) * 0x100000001b3ULL;
+    if (got < io_block_size)
+      break;
+  }
+  free(buf);
+  close(fd);
+  *phash = h;
+  return 0;
+}
+
+int
+cache_make_key(const char *filename, int with_hash, struct cache_key *key)
+{
+  struct stat st;
+
+  memset(key, 0, sizeof(struct cache_key));
+  if (stat(filename, &st) == -1 || !S_ISREG(st.st_mode))
+    return -1;
+  key->dev = st.st_dev;
+  key->ino = st.st_ino;
+  key->size = st.st_size;
+  key->mtime_sec = st.st_mtime;
+#if _POSIX_VERSION >= 200809L
+  key->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+  if (with_hash) {
+    if (hash_file(filename, &key->hash) == -1)
+      return -1;
+    key->has_hash = TRUE;
+  }
+  key->valid = TRUE;
+  return 0;
+}
+
+int
+cache_lookup(const char *filename, int with_hash, struct cache_key *key,
+	     struct signal_info *si, double *power)
+{
+  struct cache_entry probe, *e;
+
+  if (cache_make_key(filename, with_hash, key) == -1)
+    return FALSE;
+
+  if (nentries == 0)
+    return FALSE;
+  probe.key = *key;
+  e = (struct cache_entry *)bsearch(&probe, entries, nentries,
+				    sizeof(struct cache_entry), compare_files);
+  if (e == NULL)
+    return FALSE;
+  if (e->key.size != key->size
+      || e->key.mtime_sec != key->mtime_sec
+      || e->key.mtime_nsec != key->mtime_nsec
+      || strcmp(e->method, analysis_method()) != 0)
+    return FALSE;
+  if (with_hash && (!e->key.has_hash || e->key.hash != key->hash))
+    return FALSE;
+
+  *power = e->power;
+  si->level = e->level;
+  si->peak = e->peak;
+  si->true_peak = e->true_peak;
+  si->max_sample = e->max_sample;
+  si->min_sample = e->min_sample;
+  si->channels = e->channels;
+  si->bits_per_sample = e->bits_per_sample;
+  si->samples_per_sec = e->samples_per_sec;
+  return TRUE;
+}
+
+void
+cache_store(const struct cache_key *key, const struct signal_info *si,
+	    double power)
+{
+  struct cache_entry e;
+
+  if (cache_fp == NULL || !key->valid)
+    return;
+  e.key = *key;
+  strcpy(e.method, analysis_method());
+  e.power = power;
+  e.level = si->level;
+  e.peak = si->peak;
+  e.true_peak = si->true_peak;
+  e.max_sample = si->max_sample;
+  e.min_sample = si->min_sample;
+  e.channels = si->channels;
+  e.bits_per_sample = si->bits_per_sample;
+  e.samples_per_sec = si->samples_per_sec;
+
+  jobs_lock();
+  write_entry(cache_fp, &e);
+  fflush(cache_fp);
+  jobs_unlock();
+}
+
+void
+cache_close(void)
+{
+  if (cache_fp)
+    fclose(cache_fp);
+  cache_fp = NULL;
+  free(entries);
+  entries = NULL;
+  nentries = 0;
+  free(cache_path);
+  cache_path = NULL;
+}
@@ -0,0 +1,79 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * A cache of analysis results, kept on disk between runs, so files
+ * we've seen before don't have to be read again.
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * What identifies a file in the cache: where it lives, and enough
+ * about its contents to tell if it's changed.
+ */
+struct cache_key {
+  int valid;                /* FALSE if we couldn't stat the file */
+  unsigned long long dev;
+  unsigned long long ino;
+  long long size;
+  long long mtime_sec;
+  long mtime_nsec;
+  int has_hash;
+  uint64_t hash;            /* of the whole file, if has_hash is set */
+};
+
+/*
+ * Load the cache.  If rebuild is set, existing entries are not used,
+ * but new results are still saved.  Returns -1, after printing a
+ * warning, if the cache can't be used.
+ */
+int cache_open(int rebuild);
+
+/*
+ * Fill in *key for filename, hashing its contents if with_hash is
+ * set.  Returns -1 if the file can't be cached.
+ */
+int cache_make_key(const char *filename, int with_hash,
+		   struct cache_key *key);
+
+/*
+ * Look up filename in the cache.  On a hit, returns TRUE and fills in
+ * the levels and format info of *si, and the value signal_max_power()
+ * returned for the file in *power.  Either way, fills in *key for a
+ * later cache_store().  If with_hash is set, the key includes a hash
+ * of the file's contents, and only entries with a matching hash hit.
+ */
+int cache_lookup(const char *filename, int with_hash, struct cache_key *key,
+		 struct signal_info *si, double *power);
+
+/* save the result of analyzing the file identified by key */
+void cache_store(const struct cache_key *key, const struct signal_info *si,
+		 double power);
+
+void cache_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CACHE_H_ */
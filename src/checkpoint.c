@@ -0,0 +1,184 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * A checkpoint for FILE lives in FILE.normalize, a text file holding
+ * a header line, a line identifying the file and the analysis, and a
+ * line of window powers for each channel.  Doubles are written in hex
+ * so they come back bit for bit.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <stdio.h>
+#if STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#else
+# if HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+# if HAVE_STRING_H
+#  include <string.h>
+# endif
+#endif
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_ERRNO_H
+# include <errno.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "checkpoint.h"
+
+extern void *xmalloc(size_t size);
+extern const char *analysis_method(void);
+
+#define CHECKPOINT_HEADER "normalize-checkpoint 1"
+#define CHECKPOINT_SUFFIX ".normalize"
+
+/* no file has more window powers than this in its checkpoint */
+#define CHECKPOINT_MAX_VALUES (1 << 16)
+
+static char *
+checkpoint_file_name(const char *filename)
+{
+  char *path;
+
+  path = (char *)xmalloc(strlen(filename) + strlen(CHECKPOINT_SUFFIX) + 1);
+  sprintf(path, "%s%s", filename, CHECKPOINT_SUFFIX);
+  return path;
+}
+
+int
+checkpoint_load(const char *filename, struct checkpoint *ck)
+{
+  struct stat st;
+  unsigned long long dev, ino;
+  char line[512], method[16], hash[20];
+  char *path, *end;
+  FILE *fp;
+  int i;
+
+  ck->values = NULL;
+  if (stat(filename, &st) == -1)
+    return -1;
+  path = checkpoint_file_name(filename);
+  fp = fopen(path, "r");
+  free(path);
+  if (fp == NULL)
+    return -1;
+
+  if (fgets(line, sizeof(line), fp) == NULL
+      || strcmp(line, CHECKPOINT_HEADER "\n") != 0
+      || fgets(line, sizeof(line), fp) == NULL)
+    goto error;
+  if (sscanf(line, "%llu %llu %15s %d %d %u %lld %19s %lf %ld %ld %lf %d",
+	     &dev, &ino, method, &ck->channels, &ck->bits_per_sample,
+	     &ck->samples_per_sec, &ck->frames, hash, &ck->maxpow,
+	     &ck->max_sample, &ck->min_sample, &ck->true_peak,
+	     &ck->nvalues) != 13)
+    goto error;
+  ck->hash = strtoull(hash, &end, 16);
+  if (*end != '\0')
+    goto error;
+
+  /* it must be for this very file, analyzed the same way */
+  if (dev != (unsigned long long)st.st_dev
+      || ino != (unsigned long long)st.st_ino
+      || strcmp(method, analysis_method()) != 0)
+    goto error;
+  if (ck->channels < 1 || ck->nvalues < 1 || ck->frames < 0
+      || ck->nvalues > CHECKPOINT_MAX_VALUES / ck->channels)
+    goto error;
+
+  ck->values = (double *)xmalloc(ck->channels * ck->nvalues * sizeof(double));
+  for (i = 0; i < ck->channels * ck->nvalues; i++)
+    if (fscanf(fp, "%lf", &ck->values[i]) != 1)
+      goto error;
+
+  fclose(fp);
+  return 0;
+
+ error:
+  fclose(fp);
+  checkpoint_free(ck);
+  return -1;
+}
+
+int
+checkpoint_save(const char *filename, const struct checkpoint *ck)
+{
+  struct stat st;
+  char *path, *tmpfile;
+  FILE *fp;
+  int fd, c, i;
+
+  if (stat(filename, &st) == -1)
+    return -1;
+
+  /* write it beside the old one, and swap it in */
+  path = checkpoint_file_name(filename);
+  tmpfile = (char *)xmalloc(strlen(path) + 8);
+  sprintf(tmpfile, "%s.XXXXXX", path);
+  fd = mkstemp(tmpfile);
+  if (fd == -1)
+    goto error1;
+  fp = fdopen(fd, "w");
+  if (fp == NULL) {
+    close(fd);
+    goto error2;
+  }
+
+  fprintf(fp, "%s\n", CHECKPOINT_HEADER);
+  fprintf(fp, "%llu %llu %s %d %d %u %lld %016llx %a %ld %ld %a %d\n",
+	  (unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+	  analysis_method(), ck->channels, ck->bits_per_sample,
+	  ck->samples_per_sec, ck->frames, (unsigned long long)ck->hash,
+	  ck->maxpow, ck->max_sample, ck->min_sample, ck->true_peak,
+	  ck->nvalues);
+  for (c = 0; c < ck->channels; c++) {
+    for (i = 0; i < ck->nvalues; i++)
+      fprintf(fp, i ? " %a" : "%a", ck->values[c * ck->nvalues + i]);
+    fprintf(fp, "\n");
+  }
+
+  if (fclose(fp) == EOF || rename(tmpfile, path) == -1)
+    goto error2;
+  free(tmpfile);
+  free(path);
+  return 0;
+
+ error2:
+  unlink(tmpfile);
+ error1:
+  free(tmpfile);
+  free(path);
+  return -1;
+}
+
+void
+checkpoint_free(struct checkpoint *ck)
+{
+  free(ck->values);
+  ck->values = NULL;
+}
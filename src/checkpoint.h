@@ -0,0 +1,66 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * Checkpoints of the analysis of a WAV file, kept in a file next to
+ * it, so when more audio is appended to the file, a later run only
+ * has to analyze what's new.
+ */
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Where the analysis of a file stood after some number of frames:
+ * everything a scan of the file carries from one window to the next.
+ */
+struct checkpoint {
+  int channels;
+  int bits_per_sample;
+  unsigned int samples_per_sec;
+  long long frames;         /* frames analyzed, a whole number of windows */
+  uint64_t hash;            /* of the last second of those frames */
+  double maxpow;            /* the largest smoothed power so far */
+  long max_sample;
+  long min_sample;
+  double true_peak;         /* or -1 if it wasn't metered */
+  int nvalues;              /* window powers in each channel's smoother */
+  double *values;           /* values[c * nvalues + i], oldest first */
+};
+
+/*
+ * Load the checkpoint for filename into *ck.  Returns -1 if there is
+ * none, or if it's for another file, or was made with other analysis
+ * options.  The caller must still check that the frames it covers
+ * haven't changed.
+ */
+int checkpoint_load(const char *filename, struct checkpoint *ck);
+
+/* save *ck as the checkpoint for filename; returns -1 on failure */
+int checkpoint_save(const char *filename, const struct checkpoint *ck);
+
+void checkpoint_free(struct checkpoint *ck);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CHECKPOINT_H_ */
@@ -18,7 +18,9 @@
 #ifndef _COMMON_H_
 #define _COMMON_H_
 
-#define _POSIX_C_SOURCE 2
+#ifndef _POSIX_C_SOURCE
+# define _POSIX_C_SOURCE 2
+#endif
 
 #if HAVE_STDINT_H
 # include <stdint.h>
@@ -49,6 +51,7 @@ enum verbose_t {
 struct signal_info {
   double level;      /* maximum sustained RMS amplitude */
   double peak;       /* peak amplitude */
+  double true_peak;  /* peak amplitude between samples, or 0 if unknown */
   long max_sample;   /* maximum sample value */
   long min_sample;   /* minimum sample value */
 
@@ -59,6 +62,28 @@ struct signal_info {
 
   off_t file_size;
 
+  /*
+   * How many samples had each value, if we were asked to count them:
+   * hist[b] is the number of samples v with (v >> hist_shift) equal to
+   * b - hist_bins / 2.  NULL if we didn't count.
+   */
+  uint64_t *hist;
+  int hist_bins;
+  int hist_shift;
+
+  /* the largest gain that stays within the clip budget, or 0 if none */
+  double max_gain;
+
+  /*
+   * With --fast, the level is estimated from part of the file: the
+   * file's true level is at least level_lo, which is the level we
+   * report, and likely no more than level_hi.  The peaks are then only
+   * those of the part we read.  Both are 0 for a level measured in
+   * full.
+   */
+  double level_lo;
+  double level_hi;
+
   /* info for frontend mode */
   int orig_index;
 };
@@ -70,6 +95,19 @@ struct progress_struct {
   off_t batch_size;    /* sum of all file sizes, in kb */
   off_t finished_size; /* sum of sizes of all completed files, in kb */
   int on_file;         /* the index of the file we're working on */
+
+  /* when several files are processed at once (see jobs.h) */
+  float *file_fractions; /* fraction completed of each file */
+  float active_size;     /* kb completed in files still in progress */
+};
+
+/* the format of headerless input, for --raw */
+struct raw_format {
+  int bits_per_sample;
+  int is_signed;
+  int big_endian;
+  int channels;
+  unsigned int samples_per_sec;
 };
 
 #ifndef MIN
@@ -97,6 +135,9 @@ struct progress_struct {
 # define O_BINARY 0
 #endif
 
+/* warn about clipping if we clip more than this fraction of the samples */
+#define CLIPPING_WARN_THRESH 0.001
+
 /* anything less than EPSILON is considered zero */
 #ifndef EPSILON
 # define EPSILON 0.00000000001
@@ -0,0 +1,292 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "config.h"
+
+#include <stdio.h>
+#if STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#else
+# if HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+# if HAVE_STRING_H
+#  include <string.h>
+# endif
+#endif
+#if HAVE_ERRNO_H
+# include <errno.h>
+#endif
+
+#include "common.h"
+#include "embed.h"
+#include "riff.h"
+#include "nid3.h"
+
+extern const char *analysis_method(void);
+extern int id3_compat;
+extern int strncaseeq(const char *s1, const char *s2, size_t n);
+
+/*
+ * The results are stored as one line of text:
+ *
+ *   normalize-1 METHOD LENGTH POWER LEVEL PEAK MAX MIN CHANNELS BITS RATE
+ *
+ * where LENGTH is the size of the WAV data chunk ("-" for MP3 files,
+ * where we only ever touch the tag), and the doubles are in hex so
+ * they come back bit for bit.
+ */
+#define EMBED_MAGIC "normalize-1"
+
+/* WAV files get a chunk of this size, so it can be rewritten in place */
+#define EMBED_CHUNK_ID "nrml"
+#define EMBED_CHUNK_SIZE 192
+
+/* description of the TXXX frame in MP3 files */
+#define EMBED_ID3_DESC "normalize"
+
+static void
+format_results(char *buf, const char *length,
+	       const struct signal_info *si, double power)
+{
+  sprintf(buf, "%s %s %s %a %a %a %ld %ld %d %d %u %a", EMBED_MAGIC,
+	  analysis_method(), length, power, si->level, si->peak,
+	  si->max_sample, si->min_sample,
+	  si->channels, si->bits_per_sample, si->samples_per_sec,
+	  si->true_peak);
+}
+
+static int
+parse_results(const char *buf, const char *length,
+	      struct signal_info *si, double *power)
+{
+  char magic[16], method[16], len[16];
+  struct signal_info tmp;
+  double pow;
+  int n;
+
+  /* the true peak was added later, so it may not be there */
+  tmp.true_peak = 0.0;
+  n = sscanf(buf, "%15s %15s %15s %lf %lf %lf %ld %ld %d %d %u %lf",
+	     magic, method, len, &pow, &tmp.level, &tmp.peak,
+	     &tmp.max_sample, &tmp.min_sample,
+	     &tmp.channels, &tmp.bits_per_sample, &tmp.samples_per_sec,
+	     &tmp.true_peak);
+  if (n != 11 && n != 12)
+    return FALSE;
+  if (strcmp(magic, EMBED_MAGIC) != 0
+      || strcmp(method, analysis_method()) != 0
+      || strcmp(len, length) != 0)
+    return FALSE;
+
+  *power = pow;
+  si->level = tmp.level;
+  si->peak = tmp.peak;
+  si->true_peak = tmp.true_peak;
+  si->max_sample = tmp.max_sample;
+  si->min_sample = tmp.min_sample;
+  si->channels = tmp.channels;
+  si->bits_per_sample = tmp.bits_per_sample;
+  si->samples_per_sec = tmp.samples_per_sec;
+  return TRUE;
+}
+
+static int
+is_mp3(const char *filename)
+{
+  int i = strlen(filename);
+
+  return i >= 4 && (strncaseeq(filename + i - 4, ".mp3", 4)
+		    || strncaseeq(filename + i - 4, ".mp2", 4));
+}
+
+/*
+ * Walk the chunks of a WAV file.  On return, *top is the RIFF chunk,
+ * *data_size is the size of the data chunk, and *ours is our chunk,
+ * with ours->size set to 0 if there isn't one.  Returns -1 if this
+ * isn't a WAV file.
+ */
+static int
+wav_find_chunks(riff_t riff, riff_chunk_t *top, riff_chunk_t *ours,
+		uint32_t *data_size)
+{
+  riff_chunk_t chnk;
+  int have_data = FALSE;
+
+  if (riff_descend(riff, top, NULL, RIFF_SRCH_OFF) != 1
+      || top->id != RIFFID_RIFF
+      || top->type != riff_string_to_fourcc("WAVE"))
+    return -1;
+
+  ours->size = 0;
+  while (riff_descend(riff, &chnk, top, RIFF_SRCH_OFF) == 1) {
+    if (chnk.id == riff_string_to_fourcc("data")) {
+      *data_size = chnk.size;
+      have_data = TRUE;
+    } else if (chnk.id == riff_string_to_fourcc(EMBED_CHUNK_ID)) {
+      *ours = chnk;
+    }
+    if (riff_ascend(riff, &chnk) == -1)
+      return -1;
+  }
+
+  return have_data ? 0 : -1;
+}
+
+static int
+wav_lookup(const char *filename, struct signal_info *si, double *power)
+{
+  riff_t riff;
+  riff_chunk_t top, ours;
+  uint32_t data_size;
+  char buf[EMBED_CHUNK_SIZE + 1], length[16];
+  int ret = FALSE;
+
+  riff = riff_open(filename, RIFF_RDONLY);
+  if (riff == NULL)
+    return FALSE;
+  if (wav_find_chunks(riff, &top, &ours, &data_size) == 0
+      && ours.size == EMBED_CHUNK_SIZE
+      && fread(buf, EMBED_CHUNK_SIZE, 1, riff_chunk_stream(riff, &ours)) == 1) {
+    buf[EMBED_CHUNK_SIZE] = '\0';
+    sprintf(length, "%lu", (unsigned long)data_size);
+    ret = parse_results(buf, length, si, power);
+  }
+  riff_close(riff);
+
+  return ret;
+}
+
+static int
+wav_store(const char *filename, const struct signal_info *si, double power)
+{
+  riff_t riff;
+  riff_chunk_t top, ours;
+  uint32_t data_size;
+  char buf[EMBED_CHUNK_SIZE], length[16];
+  FILE *fp;
+  long end, file_end;
+  int ret = -1;
+
+  riff = riff_open(filename, RIFF_RDWR);
+  if (riff == NULL)
+    return -1;
+  fp = riff_stream(riff);
+  if (wav_find_chunks(riff, &top, &ours, &data_size) == -1)
+    goto out;
+
+  memset(buf, 0, EMBED_CHUNK_SIZE);
+  sprintf(length, "%lu", (unsigned long)data_size);
+  format_results(buf, length, si, power);
+
+  if (ours.size == EMBED_CHUNK_SIZE) {
+    /* rewrite the old results in place */
+    if (fwrite(buf, EMBED_CHUNK_SIZE, 1, riff_chunk_stream(riff, &ours)) == 1)
+      ret = 0;
+    goto out;
+  }
+
+  /*
+   * Add our chunk to the end of the RIFF chunk.  Anything after it in
+   * the file would be overwritten, so only do this if there isn't.
+   */
+  end = top.offset + top.size;
+  if (fseek(fp, 0, SEEK_END) == -1)
+    goto out;
+  file_end = ftell(fp);
+  if (file_end != end && file_end != end + (end & 1))
+    goto out;
+  if (end & 1) {
+    /* the last chunk is missing its pad byte */
+    if (fseek(fp, end, SEEK_SET) == -1 || fputc(0, fp) == EOF)
+      goto out;
+  }
+  ours.id = riff_string_to_fourcc(EMBED_CHUNK_ID);
+  ours.size = EMBED_CHUNK_SIZE;
+  if (riff_create_chunk(riff, &ours) == -1
+      || fwrite(buf, EMBED_CHUNK_SIZE, 1, fp) < 1
+      || riff_ascend(riff, &ours) == -1)
+    goto out;
+  /* have riff_ascend() fix up the size of the RIFF chunk */
+  top.write = 1;
+  if (riff_ascend(riff, &top) == -1)
+    goto out;
+  ret = 0;
+
+ out:
+  if (riff_close(riff) == EOF)
+    ret = -1;
+  return ret;
+}
+
+static int
+mp3_lookup(const char *filename, struct signal_info *si, double *power)
+{
+  id3_t tag;
+  char *s;
+  int ret = FALSE;
+
+  tag = id3_open(filename, ID3_RDONLY);
+  if (tag == NULL)
+    return FALSE;
+  s = id3_user_text_get(tag, EMBED_ID3_DESC);
+  if (s)
+    ret = parse_results(s, "-", si, power);
+  id3_close(tag);
+
+  return ret;
+}
+
+static int
+mp3_store(const char *filename, const struct signal_info *si, double power)
+{
+  id3_t tag;
+  char buf[EMBED_CHUNK_SIZE];
+  int ret = 0;
+
+  tag = id3_open(filename, ID3_RDWR);
+  if (tag == NULL)
+    return -1;
+  format_results(buf, "-", si, power);
+  if (id3_user_text_set(tag, EMBED_ID3_DESC, buf) == -1)
+    ret = -1;
+  else if (id3_set_version(tag, id3_compat ? ID3_VERSION_2_3 : ID3_VERSION_2_4) == -1
+	   || id3_write(tag) == -1)
+    ret = -1;
+  id3_close(tag);
+
+  return ret;
+}
+
+int
+embed_lookup(const char *filename, struct signal_info *si, double *power)
+{
+  if (is_mp3(filename))
+    return mp3_lookup(filename, si, power);
+  return wav_lookup(filename, si, power);
+}
+
+int
+embed_store(const char *filename, const struct signal_info *si, double power)
+{
+  if (is_mp3(filename))
+    return mp3_store(filename, si, power);
+  return wav_store(filename, si, power);
+}
@@ -0,0 +1,51 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * Analysis results stored in the audio files themselves: a private
+ * chunk in WAV files, and a TXXX frame in the ID3 tag of MP3 files.
+ */
+
+#ifndef _EMBED_H_
+#define _EMBED_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Read the results stored in filename, if any.  On success, returns
+ * TRUE and fills in the levels and format info of *si and the value
+ * signal_max_power() returned in *power.  Results for a different
+ * analysis method, or for audio data of a different length, are
+ * ignored.
+ */
+int embed_lookup(const char *filename, struct signal_info *si,
+		 double *power);
+
+/*
+ * Store the results of analyzing filename in the file.  Returns -1
+ * if the file isn't a WAV or MP3 file, or can't be written.
+ */
+int embed_store(const char *filename, const struct signal_info *si,
+		double power);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _EMBED_H_ */
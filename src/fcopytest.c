@@ -0,0 +1,340 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * Check the copies nid3lib's fcopy layer makes, and the tag writes
+ * that go through it.  Files are copied between regular files, where
+ * the kernel can copy them itself, into a pipe, where only sendfile()
+ * can, and out of a pipe, where neither can and they go through our
+ * own buffer.  Copies between stdio streams must pick up and leave
+ * both streams where they should be.  Then a tag is added to a file,
+ * rewritten in its padding, and grown past it, and the data after the
+ * tag must come through each time.  The files are made in the current
+ * directory.  Build with "make fcopytest"; it isn't installed.  The
+ * exit status is nonzero if anything came out wrong.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#if STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#else
+# if HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+# if HAVE_STRING_H
+#  include <string.h>
+# endif
+#endif
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#include "fcopy.h"
+#include "nid3.h"
+
+#define DATA_SIZE (3L << 20)   /* more than one buffer's worth */
+#define DATA_FILE "fcopy.in"
+#define COPY_FILE "fcopy.out"
+#define TAG_FILE "fcopy.mp3"
+
+static unsigned char *data;
+static int bad = 0;
+
+static void
+check(int ok, const char *what)
+{
+  printf("%-52s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+    bad = 1;
+}
+
+static int
+write_file(const char *fname, const unsigned char *buf, long len)
+{
+  FILE *fp;
+  int ok;
+
+  fp = fopen(fname, "wb");
+  if (fp == NULL)
+    return 0;
+  ok = fwrite(buf, 1, len, fp) == (size_t)len;
+  return fclose(fp) == 0 && ok;
+}
+
+/* read all of fname; returns its length, or -1 */
+static long
+read_file(const char *fname, unsigned char **pbuf)
+{
+  FILE *fp;
+  long len;
+
+  fp = fopen(fname, "rb");
+  if (fp == NULL)
+    return -1;
+  fseek(fp, 0, SEEK_END);
+  len = ftell(fp);
+  rewind(fp);
+  *pbuf = (unsigned char *)malloc(len + 1);
+  if (fread(*pbuf, 1, len, fp) != (size_t)len)
+    len = -1;
+  fclose(fp);
+  return len;
+}
+
+/* whether fname holds just len bytes of data from offset */
+static int
+file_is(const char *fname, long offset, long len)
+{
+  unsigned char *buf;
+  long got;
+  int ok;
+
+  got = read_file(fname, &buf);
+  if (got == -1)
+    return 0;
+  ok = got == len && memcmp(buf, data + offset, len) == 0;
+  free(buf);
+  return ok;
+}
+
+static void
+check_fds(void)
+{
+  int in, out;
+  off_t n1, n2;
+  FILE *pipe_fp;
+  char cmd[64];
+
+  /* between regular files, part way and then to the end */
+  in = open(DATA_FILE, O_RDONLY);
+  out = open(COPY_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  lseek(in, 1000, SEEK_SET);
+  n1 = fcopy_fd(in, out, 100000);
+  check(n1 == 100000 && lseek(in, 0, SEEK_CUR) == 101000
+	&& lseek(out, 0, SEEK_CUR) == 100000,
+	"part of a file: length and offsets");
+  n2 = fcopy_fd(in, out, -1);
+  close(in);
+  close(out);
+  check(n2 == DATA_SIZE - 101000 && file_is(COPY_FILE, 1000, DATA_SIZE - 1000),
+	"the rest of the file");
+
+  /* into a pipe */
+  sprintf(cmd, "cat > %s", COPY_FILE);
+  in = open(DATA_FILE, O_RDONLY);
+  pipe_fp = popen(cmd, "w");
+  n1 = fcopy_fd(in, fileno(pipe_fp), -1);
+  close(in);
+  check(pclose(pipe_fp) == 0 && n1 == DATA_SIZE
+	&& file_is(COPY_FILE, 0, DATA_SIZE), "file into a pipe");
+
+  /* out of a pipe, stopping short of the end */
+  sprintf(cmd, "cat %s", DATA_FILE);
+  pipe_fp = popen(cmd, "r");
+  out = open(COPY_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  n1 = fcopy_fd(fileno(pipe_fp), out, DATA_SIZE - 5);
+  close(out);
+  /* make sure cat isn't left blocked on the pipe */
+  while (getc(pipe_fp) != EOF)
+    ;
+  pclose(pipe_fp);
+  check(n1 == DATA_SIZE - 5 && file_is(COPY_FILE, 0, DATA_SIZE - 5),
+	"pipe into a file");
+
+  /* to a file opened for appending, which copy_file_range() won't do */
+  write_file(COPY_FILE, data, 10);
+  in = open(DATA_FILE, O_RDONLY);
+  out = open(COPY_FILE, O_WRONLY | O_APPEND);
+  lseek(in, 10, SEEK_SET);
+  n1 = fcopy_fd(in, out, -1);
+  close(in);
+  close(out);
+  check(n1 == DATA_SIZE - 10 && file_is(COPY_FILE, 0, DATA_SIZE),
+	"file onto the end of a file");
+
+  unlink(COPY_FILE);
+  check(fcopy_file(DATA_FILE, COPY_FILE) == 0
+	&& file_is(COPY_FILE, 0, DATA_SIZE), "whole file by name");
+}
+
+/*
+ * Streams may have read ahead of where they say they are, and have
+ * writes waiting; the copy has to come from and go to where they say.
+ */
+static void
+check_streams(void)
+{
+  FILE *in, *out;
+  unsigned char buf[10];
+  unsigned char *expect, *got;
+  off_t n;
+  long len;
+  int c;
+
+  in = fopen(DATA_FILE, "rb");
+  out = fopen(COPY_FILE, "wb+");
+  fread(buf, 1, 10, in);
+  fwrite(data + 20000, 1, 7, out);
+  n = fcopy_stream(in, out, 100000);
+  c = getc(in);
+  fwrite(data + 30000, 1, 5, out);
+  check(n == 100000 && ftell(in) == 100011 && c == data[100010]
+	&& ftell(out) == 100012, "streams: length and positions");
+  fclose(in);
+  fclose(out);
+
+  expect = (unsigned char *)malloc(100012);
+  memcpy(expect, data + 20000, 7);
+  memcpy(expect + 7, data + 10, 100000);
+  memcpy(expect + 100007, data + 30000, 5);
+  len = read_file(COPY_FILE, &got);
+  check(len == 100012 && memcmp(got, expect, len) == 0,
+	"streams: what was written around the copy");
+  if (len != -1)
+    free(got);
+  free(expect);
+}
+
+/* the size of the tag at the start of fname, or -1 if there isn't one */
+static long
+tag_size(const unsigned char *buf, long len)
+{
+  if (len < 10 || memcmp(buf, "ID3", 3) != 0)
+    return -1;
+  return 10 + ((long)(buf[6] & 0x7f) << 21) + ((buf[7] & 0x7f) << 14)
+    + ((buf[8] & 0x7f) << 7) + (buf[9] & 0x7f);
+}
+
+/* whether the tagged file holds the data after its tag, and how big
+   the tag is; the title also goes in an ID3v1 tag at the end */
+static int
+data_after_tag(long *ptagsz)
+{
+  unsigned char *buf;
+  long len;
+  int ok;
+
+  len = read_file(TAG_FILE, &buf);
+  if (len == -1)
+    return 0;
+  if (len >= 128 && memcmp(buf + len - 128, "TAG", 3) == 0)
+    len -= 128;
+  *ptagsz = tag_size(buf, len);
+  ok = *ptagsz > 0 && len - *ptagsz == DATA_SIZE
+    && memcmp(buf + *ptagsz, data, DATA_SIZE) == 0;
+  free(buf);
+  return ok;
+}
+
+static int
+set_tag(const char *title, const char *comment)
+{
+  id3_t tag;
+  int ret;
+
+  tag = id3_open(TAG_FILE, ID3_RDWR);
+  if (tag == NULL)
+    return -1;
+  ret = id3_title_set(tag, title, ID3_TEXT_ISO);
+  if (ret != -1 && comment)
+    ret = id3_comment_set(tag, comment, "", "eng", ID3_TEXT_ISO);
+  if (ret != -1)
+    ret = id3_write(tag);
+  if (id3_close(tag) == -1)
+    ret = -1;
+  return ret;
+}
+
+static int
+title_is(const char *title)
+{
+  id3_t tag;
+  char *s;
+  int ok;
+
+  tag = id3_open(TAG_FILE, ID3_RDONLY);
+  if (tag == NULL)
+    return 0;
+  s = id3_title_get(tag);   /* belongs to the tag */
+  ok = s && strcmp(s, title) == 0;
+  id3_close(tag);
+  return ok;
+}
+
+static void
+check_tags(void)
+{
+  long first, second, third;
+  char *comment;
+
+  write_file(TAG_FILE, data, DATA_SIZE);
+
+  /* a new tag means copying the whole file after it */
+  check(set_tag("short", NULL) == 0 && data_after_tag(&first)
+	&& title_is("short"), "tag added in front of the data");
+
+  /* a longer title still fits in the padding, so goes in place */
+  check(set_tag("a rather longer title", NULL) == 0
+	&& data_after_tag(&second) && second == first
+	&& title_is("a rather longer title"), "tag rewritten in its padding");
+
+  /* but a big comment doesn't, so the whole file is copied again */
+  comment = (char *)malloc(first * 4 + 1);
+  memset(comment, 'x', first * 4);
+  comment[first * 4] = '\0';
+  check(set_tag("title", comment) == 0 && data_after_tag(&third)
+	&& third > first * 4 && title_is("title"),
+	"tag grown past its padding");
+  free(comment);
+}
+
+int
+main(void)
+{
+  long i;
+
+  data = (unsigned char *)malloc(DATA_SIZE);
+  srand(1);
+  for (i = 0; i < DATA_SIZE; i++)
+    data[i] = rand() >> 7;
+  /* nothing that looks like a tag, in front or behind */
+  memset(data, 0, 10);
+  memset(data + DATA_SIZE - 256, 0, 256);
+  if (!write_file(DATA_FILE, data, DATA_SIZE)) {
+    perror(DATA_FILE);
+    return 1;
+  }
+
+  check_fds();
+  check_streams();
+  check_tags();
+
+  unlink(DATA_FILE);
+  unlink(COPY_FILE);
+  unlink(TAG_FILE);
+  free(data);
+  return bad;
+}
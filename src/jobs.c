@@ -0,0 +1,284 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+#define _POSIX_C_SOURCE 199506L
+
+#include "config.h"
+
+#include <stdio.h>
+#if STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#else
+# if HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+# if HAVE_STRING_H
+#  include <string.h>
+# endif
+#endif
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if USE_PTHREADS
+# include <pthread.h>
+#endif
+
+#include "common.h"
+#include "jobs.h"
+
+extern void *xmalloc(size_t size);
+
+#if USE_PTHREADS
+
+static pthread_mutex_t jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t current_key;
+static pthread_once_t current_key_once = PTHREAD_ONCE_INIT;
+
+struct pool {
+  int nitems;
+  int next;       /* next item to be handed out */
+  int reported;   /* items [0, reported) have been reported */
+  char *done;     /* done[i] is set when item i has finished */
+  job_func_t work;
+  job_func_t report;
+  void *arg;
+};
+
+/* the pool currently running, if any; protected by jobs_mutex */
+static struct pool *cur_pool = NULL;
+
+/* the job started by job_start(), if any */
+struct background {
+  job_func_t work;
+  int item;
+  void *arg;
+  pthread_t thread;
+  int running;
+};
+
+static struct background bg;
+static pthread_key_t background_key;
+static pthread_once_t background_key_once = PTHREAD_ONCE_INIT;
+
+static void
+make_current_key(void)
+{
+  pthread_key_create(&current_key, NULL);
+}
+
+static void
+make_background_key(void)
+{
+  pthread_key_create(&background_key, NULL);
+}
+
+static void *
+background_worker(void *data)
+{
+  pthread_setspecific(background_key, &bg);
+  bg.work(bg.item, bg.arg);
+  return NULL;
+}
+
+static void *
+worker(void *data)
+{
+  struct pool *pl = (struct pool *)data;
+  int i;
+
+  for (;;) {
+    pthread_mutex_lock(&jobs_mutex);
+    i = pl->next++;
+    pthread_mutex_unlock(&jobs_mutex);
+    if (i >= pl->nitems)
+      break;
+
+    /* we find our item again by its slot in the done array */
+    pthread_setspecific(current_key, &pl->done[i]);
+    pl->work(i, pl->arg);
+    pthread_setspecific(current_key, NULL);
+
+    /* report every item that is now finished in sequence */
+    pthread_mutex_lock(&jobs_mutex);
+    pl->done[i] = TRUE;
+    while (pl->reported < pl->nitems && pl->done[pl->reported]) {
+      if (pl->report)
+	pl->report(pl->reported, pl->arg);
+      pl->reported++;
+    }
+    pthread_mutex_unlock(&jobs_mutex);
+  }
+
+  return NULL;
+}
+
+#endif /* USE_PTHREADS */
+
+
+void
+run_jobs(int nthreads, int nitems, job_func_t work, job_func_t report,
+	 void *arg)
+{
+#if USE_PTHREADS
+  struct pool pl;
+  pthread_t *threads;
+  int i, nstarted;
+#endif
+  int item;
+
+  if (nthreads > nitems)
+    nthreads = nitems;
+
+#if USE_PTHREADS
+  if (nthreads > 1) {
+    pthread_once(&current_key_once, make_current_key);
+
+    pl.nitems = nitems;
+    pl.next = pl.reported = 0;
+    pl.done = (char *)xmalloc(nitems);
+    memset(pl.done, 0, nitems);
+    pl.work = work;
+    pl.report = report;
+    pl.arg = arg;
+
+    pthread_mutex_lock(&jobs_mutex);
+    cur_pool = &pl;
+    pthread_mutex_unlock(&jobs_mutex);
+
+    /*
+     * The calling thread is one of the workers, so we only start
+     * nthreads - 1 new ones.  If we can't start as many as we'd
+     * like, we just get by with fewer.
+     */
+    threads = (pthread_t *)xmalloc((nthreads - 1) * sizeof(pthread_t));
+    for (nstarted = 0; nstarted < nthreads - 1; nstarted++)
+      if (pthread_create(&threads[nstarted], NULL, worker, &pl) != 0)
+	break;
+    worker(&pl);
+    for (i = 0; i < nstarted; i++)
+      pthread_join(threads[i], NULL);
+
+    pthread_mutex_lock(&jobs_mutex);
+    cur_pool = NULL;
+    pthread_mutex_unlock(&jobs_mutex);
+
+    free(threads);
+    free(pl.done);
+    return;
+  }
+#endif
+
+  for (item = 0; item < nitems; item++) {
+    work(item, arg);
+    if (report)
+      report(item, arg);
+  }
+}
+
+void
+job_start(job_func_t work, int item, void *arg)
+{
+#if USE_PTHREADS
+  pthread_once(&background_key_once, make_background_key);
+  bg.work = work;
+  bg.item = item;
+  bg.arg = arg;
+  bg.running = pthread_create(&bg.thread, NULL, background_worker, NULL) == 0;
+  if (bg.running)
+    return;
+#endif
+
+  /* no thread, so just do it now */
+  work(item, arg);
+}
+
+void
+job_wait(void)
+{
+#if USE_PTHREADS
+  if (bg.running)
+    pthread_join(bg.thread, NULL);
+  bg.running = FALSE;
+#endif
+}
+
+int
+job_in_background(void)
+{
+#if USE_PTHREADS
+  pthread_once(&background_key_once, make_background_key);
+  return pthread_getspecific(background_key) != NULL;
+#else
+  return FALSE;
+#endif
+}
+
+int
+job_current(void)
+{
+#if USE_PTHREADS
+  char *p;
+
+  if (!jobs_parallel())
+    return -1;
+  p = (char *)pthread_getspecific(current_key);
+  if (p)
+    return p - cur_pool->done;
+#endif
+  return -1;
+}
+
+int
+jobs_parallel(void)
+{
+#if USE_PTHREADS
+  /* cur_pool only changes while no other threads are running */
+  return cur_pool != NULL;
+#else
+  return FALSE;
+#endif
+}
+
+void
+jobs_lock(void)
+{
+#if USE_PTHREADS
+  pthread_mutex_lock(&jobs_mutex);
+#endif
+}
+
+void
+jobs_unlock(void)
+{
+#if USE_PTHREADS
+  pthread_mutex_unlock(&jobs_mutex);
+#endif
+}
+
+int
+jobs_online_cpus(void)
+{
+  long n = 1;
+
+#if defined(_SC_NPROCESSORS_ONLN)
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (n < 1)
+    n = 1;
+  return (int)n;
+}
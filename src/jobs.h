@@ -0,0 +1,72 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * A small pool of worker threads, used to run independent per-file
+ * jobs concurrently.  Without thread support, everything here
+ * degrades to a plain serial loop.
+ */
+
+#ifndef _JOBS_H_
+#define _JOBS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*job_func_t)(int item, void *arg);
+
+/*
+ * Run work(i, arg) for every i in [0, nitems) on up to nthreads
+ * threads.  As soon as items 0 through i have all finished,
+ * report(i, arg) is called, so reports always come out in item
+ * order.  Reports are made with the jobs lock held, so report() must
+ * not call jobs_lock() itself.  report may be NULL.
+ */
+void run_jobs(int nthreads, int nitems, job_func_t work, job_func_t report,
+	      void *arg);
+
+/*
+ * Start work(item, arg) on a thread of its own, and return without
+ * waiting for it; job_wait() waits for it to finish.  Only one such
+ * background job may run at a time.  Without thread support, the
+ * work is done before job_start() returns.
+ */
+void job_start(job_func_t work, int item, void *arg);
+void job_wait(void);
+
+/* nonzero if the calling thread is running the background job */
+int job_in_background(void);
+
+/* the item the calling thread is working on, or -1 if not in a job */
+int job_current(void);
+
+/* nonzero if run_jobs() is currently running items concurrently */
+int jobs_parallel(void);
+
+/* serialize output (and other shared state) between jobs */
+void jobs_lock(void);
+void jobs_unlock(void);
+
+/* number of online processors, or 1 if we can't tell */
+int jobs_online_cpus(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _JOBS_H_ */
@@ -0,0 +1,460 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * Time the kernels that apply gain against the loop they replaced,
+ * which fetched and stored each sample through a switch on its width,
+ * and check that they give the same samples.  Gain is tried both as
+ * 1.5 times a power of two, which is done in fixed point, and as the
+ * square root of two times one, which isn't.  The approximate limiter
+ * is checked against the exact one, and the largest difference, in
+ * steps of the output, is shown.  Then each kernel is run on samples
+ * as they are in files (unsigned 8-bit, packed 24-bit, and the other
+ * byte order) and checked against the same kernel on the samples
+ * converted by hand to the normal format and back.  Build with "make kernelbench"; it
+ * isn't installed.  With -c, each kernel is run once and only checked,
+ * not timed, as "make check" does; the exit status is nonzero if any
+ * kernel gave the wrong samples.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "config.h"
+
+#include <stdio.h>
+#if STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#else
+# if HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+# if HAVE_STRING_H
+#  include <string.h>
+# endif
+#endif
+#if HAVE_MATH_H
+# include <math.h>
+#endif
+#if HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#if HAVE_INTTYPES_H
+# include <inttypes.h>
+#endif
+#include <time.h>
+
+#include "common.h"
+#include "kernels.h"
+
+#define NSAMPLES (1 << 20)
+#define ROUNDS 20
+
+static const double lmtr_lvl = 0.5;
+
+static double
+limiter(double x)
+{
+  if (x < -lmtr_lvl)
+    return tanh((x + lmtr_lvl) / (1-lmtr_lvl)) * (1-lmtr_lvl) - lmtr_lvl;
+  if (x <= lmtr_lvl)
+    return x;
+  return tanh((x - lmtr_lvl) / (1-lmtr_lvl)) * (1-lmtr_lvl) + lmtr_lvl;
+}
+
+/* the old way of getting at a sample */
+static long
+get_sample(const unsigned char *pdata, int bytes_per_sample)
+{
+  switch (bytes_per_sample) {
+  case 1:
+    return *((const int8_t *)pdata);
+  case 2:
+    return *((const int16_t *)pdata);
+  default:
+    return *((const int32_t *)pdata);
+  }
+}
+
+static void
+put_sample(long sample, unsigned char *pdata, int bytes_per_sample)
+{
+  switch (bytes_per_sample) {
+  case 1:
+    *((int8_t *)pdata) = (int8_t)sample;
+    break;
+  case 2:
+    *((int16_t *)pdata) = (int16_t)sample;
+    break;
+  default:
+    *((int32_t *)pdata) = (int32_t)sample;
+    break;
+  }
+}
+
+enum { LUT, FIXED, GAIN, LIMIT, SOFTLIMIT };
+
+/* what we're replacing, one sample at a time */
+static void
+old_loop(int kind, const unsigned char *src, int sw, unsigned char *dst,
+	 int dw, int n, const int32_t *lut, double gain, long dmax,
+	 long dmin, int clip)
+{
+  double sample_d;
+  long sample;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    sample = get_sample(src, sw);
+    switch (kind) {
+    case LUT:
+      sample = lut[sample];
+      break;
+    case GAIN:
+      sample_d = sample * gain;
+      sample = ROUND(sample_d);
+      if (clip) {
+	if (sample_d > dmax)
+	  sample = dmax;
+	else if (sample_d < dmin)
+	  sample = dmin;
+      }
+      break;
+    default:
+      sample_d = sample * gain;
+      sample = ROUND(dmax * limiter(sample_d / (double)dmax));
+      break;
+    }
+    put_sample(sample, dst, dw);
+    src += sw;
+    dst += dw;
+  }
+}
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* run one of the new kernels; formats may include SAMPLES_* flags */
+static void
+run_kernel(int kind, const void *src, int sfmt, void *dst, int dfmt, int n,
+	   const int32_t *lut, long smax, long smin, double gain,
+	   long dmax, long dmin, int clip)
+{
+  switch (kind) {
+  case LUT:
+    lut_samples(src, sfmt, dst, dfmt, n, lut, smax + 1, smin - 1);
+    break;
+  case FIXED:
+  case GAIN:
+    gain_samples(src, sfmt, dst, dfmt, n, gain, dmax, dmin, clip);
+    break;
+  case LIMIT:
+    limit_samples(src, sfmt, dst, dfmt, n, gain, dmax, limiter);
+    break;
+  default:
+    softlimit_samples(src, sfmt, dst, dfmt, n, gain, dmax, lmtr_lvl);
+    break;
+  }
+}
+
+/*
+ * Samples as they are in files, one byte at a time, for checking the
+ * kernels that take them that way: the bytes of each sample are in
+ * the host's order unless SAMPLES_SWAPPED is set.
+ */
+static int
+file_sample_size(int format)
+{
+  int bytes = format & ~SAMPLES_LAYOUT;
+
+  return bytes == 3 && !(format & SAMPLES_PACKED) ? 4 : bytes;
+}
+
+static int
+host_is_little_endian(void)
+{
+  uint16_t probe = 1;
+
+  return *(unsigned char *)&probe == 1;
+}
+
+static long
+get_file_sample(const unsigned char *p, int format)
+{
+  int size = file_sample_size(format), bits, i;
+  int little = host_is_little_endian() ^ !!(format & SAMPLES_SWAPPED);
+  unsigned long u = 0;
+  long sample;
+
+  for (i = 0; i < size; i++)
+    u |= (unsigned long)p[little ? i : size - 1 - i] << (8 * i);
+  bits = (format & ~SAMPLES_LAYOUT) == 3 ? 24 : 8 * size;
+  u &= (bits == 32 ? 0xFFFFFFFFUL : (1UL << bits) - 1);
+  if (format & SAMPLES_UNSIGNED)
+    return (long)u - 128;
+  if (bits == 32)
+    return (int32_t)u;
+  sample = (long)u;
+  if (sample >= 1L << (bits - 1))
+    sample -= 1L << bits;
+  return sample;
+}
+
+static void
+put_file_sample(long sample, unsigned char *p, int format)
+{
+  int size = file_sample_size(format), i;
+  int little = host_is_little_endian() ^ !!(format & SAMPLES_SWAPPED);
+  unsigned long u;
+
+  if (format & SAMPLES_UNSIGNED)
+    sample += 128;
+  u = (unsigned long)sample;
+  for (i = 0; i < size; i++)
+    p[little ? i : size - 1 - i] = (unsigned char)(u >> (8 * i));
+}
+
+/*
+ * Check the kernels on samples in each file format against the same
+ * kernels on the samples converted to the normal format and back.
+ * Returns TRUE if any of them differ.
+ */
+#define LAYOUT_SAMPLES 100000   /* not a whole number of tiles */
+
+static int
+check_layouts(const char *kinds[])
+{
+  static const struct {
+    int format;
+    const char *name;
+  } layouts[] = {
+    { 1 | SAMPLES_UNSIGNED, "u8" },
+    { 2, "s16" },
+    { 2 | SAMPLES_SWAPPED, "s16x" },
+    { 3 | SAMPLES_PACKED, "s24p" },
+    { 3 | SAMPLES_PACKED | SAMPLES_SWAPPED, "s24px" },
+    { 4, "s32" },
+    { 4 | SAMPLES_SWAPPED, "s32x" },
+  };
+  static const int nlayouts = sizeof(layouts) / sizeof(layouts[0]);
+  unsigned char *src, *dst_ref, *dst_new, *norm_src, *norm_dst;
+  int32_t *lut_mem = NULL, *lut = NULL;
+  long smax, smin, dmax, dmin, sample;
+  int kind, si, di, sfmt, dfmt, sb, db, sw, dw, i, clip, bad = 0;
+  double gain;
+
+  src = (unsigned char *)malloc(LAYOUT_SAMPLES * 4);
+  dst_ref = (unsigned char *)malloc(LAYOUT_SAMPLES * 4);
+  dst_new = (unsigned char *)malloc(LAYOUT_SAMPLES * 4);
+  norm_src = (unsigned char *)malloc(LAYOUT_SAMPLES * 4);
+  norm_dst = (unsigned char *)malloc(LAYOUT_SAMPLES * 4);
+
+  printf("%-6s %5s %5s\n", "kernel", "src", "dst");
+  for (kind = LUT; kind <= SOFTLIMIT; kind++) {
+    for (si = 0; si < nlayouts; si++) {
+      sfmt = layouts[si].format;
+      sb = sfmt & ~SAMPLES_LAYOUT;
+      if (kind == LUT && sb > 2)
+	continue;
+      sw = sb == 3 ? 4 : sb;
+      smax = (1L << (sb * 8 - 1)) - 1;
+      smin = -smax - 1;
+      for (i = 0; i < LAYOUT_SAMPLES; i++)
+	put_file_sample((long)(((double)rand() / RAND_MAX * 2 - 1) * smax),
+			src + i * file_sample_size(sfmt), sfmt);
+
+      for (di = 0; di < nlayouts; di++) {
+	dfmt = layouts[di].format;
+	db = dfmt & ~SAMPLES_LAYOUT;
+	dw = db == 3 ? 4 : db;
+	dmax = (1L << (db * 8 - 1)) - 1;
+	dmin = -dmax - 1;
+	gain = (kind == GAIN ? sqrt(2.0) : 1.5) * pow(256.0, db - sb);
+	clip = gain > 1.0;
+
+	if (kind == LUT) {
+	  lut_mem = (int32_t *)malloc((smax - smin + 1) * sizeof(int32_t));
+	  lut = lut_mem - smin;
+	  for (sample = smin; sample <= smax; sample++) {
+	    lut[sample] = ROUND(sample * gain);
+	    if (lut[sample] > dmax)
+	      lut[sample] = dmax;
+	    else if (lut[sample] < dmin)
+	      lut[sample] = dmin;
+	  }
+	}
+
+	for (i = 0; i < LAYOUT_SAMPLES; i++)
+	  put_sample(get_file_sample(src + i * file_sample_size(sfmt), sfmt),
+		     norm_src + i * sw, sw);
+	run_kernel(kind, norm_src, sb, norm_dst, db, LAYOUT_SAMPLES, lut,
+		   smax, smin, gain, dmax, dmin, clip);
+	for (i = 0; i < LAYOUT_SAMPLES; i++)
+	  put_file_sample(get_sample(norm_dst + i * dw, dw),
+			  dst_ref + i * file_sample_size(dfmt), dfmt);
+
+	run_kernel(kind, src, sfmt, dst_new, dfmt, LAYOUT_SAMPLES, lut,
+		   smax, smin, gain, dmax, dmin, clip);
+
+	printf("%-6s %5s %5s", kinds[kind], layouts[si].name,
+	       layouts[di].name);
+	if (memcmp(dst_ref, dst_new, LAYOUT_SAMPLES * file_sample_size(dfmt))) {
+	  printf("  MISMATCH\n");
+	  bad = 1;
+	} else {
+	  printf("\n");
+	}
+
+	if (kind == LUT)
+	  free(lut_mem);
+      }
+    }
+  }
+
+  free(src);
+  free(dst_ref);
+  free(dst_new);
+  free(norm_src);
+  free(norm_dst);
+  return bad;
+}
+
+int
+main(int argc, char *argv[])
+{
+  static const int widths[] = { 1, 2, 4 };
+  static const char *kinds[] = { "lut", "fixed", "gain", "limit", "soft" };
+  unsigned char *src, *dst_old, *dst_new;
+  int32_t *lut_mem = NULL, *lut = NULL;
+  long smax, smin, dmax, dmin, sample, diff, maxdiff;
+  int kind, si, di, sw, dw, r, i, clip, bad = 0;
+  int rounds = ROUNDS, check_only = FALSE;
+  double gain, t_old, t_new, t;
+
+  if (argc == 2 && strcmp(argv[1], "-c") == 0) {
+    check_only = TRUE;
+    rounds = 1;
+  } else if (argc > 1) {
+    fprintf(stderr, "Usage: %s [-c]\n", argv[0]);
+    return 2;
+  }
+
+  kernels_init();
+  printf("kernels: %s, %d samples x %d rounds\n", kernels_isa(),
+	 NSAMPLES, rounds);
+  if (check_only)
+    printf("%-6s %4s %4s\n", "kernel", "src", "dst");
+  else
+    printf("%-6s %4s %4s %12s %12s %8s\n",
+	   "kernel", "src", "dst", "old MS/s", "new MS/s", "speedup");
+
+  src = (unsigned char *)malloc(NSAMPLES * 4);
+  dst_old = (unsigned char *)malloc(NSAMPLES * 4);
+  dst_new = (unsigned char *)malloc(NSAMPLES * 4);
+  srand(1);
+
+  for (kind = LUT; kind <= SOFTLIMIT; kind++) {
+    for (si = 0; si < 3; si++) {
+      sw = widths[si];
+      /* we only build lookup tables for 8- and 16-bit samples */
+      if (kind == LUT && sw > 2)
+	continue;
+      smax = (1L << (sw * 8 - 1)) - 1;
+      smin = -smax - 1;
+      for (i = 0; i < NSAMPLES; i++)
+	put_sample((long)(((double)rand() / RAND_MAX * 2 - 1) * smax),
+		   src + i * sw, sw);
+
+      for (di = 0; di < 3; di++) {
+	dw = widths[di];
+	dmax = (1L << (dw * 8 - 1)) - 1;
+	dmin = -dmax - 1;
+	/* a little gain, plus the change in width */
+	gain = (kind == GAIN ? sqrt(2.0) : 1.5) * pow(256.0, dw - sw);
+	clip = gain > 1.0;
+
+	if (kind == LUT) {
+	  lut_mem = (int32_t *)malloc((smax - smin + 1) * sizeof(int32_t));
+	  lut = lut_mem - smin;
+	  for (sample = smin; sample <= smax; sample++) {
+	    lut[sample] = ROUND(sample * gain);
+	    if (lut[sample] > dmax)
+	      lut[sample] = dmax;
+	    else if (lut[sample] < dmin)
+	      lut[sample] = dmin;
+	  }
+	}
+
+	t_old = t_new = 1e30;
+	for (r = 0; r < rounds; r++) {
+	  t = now();
+	  old_loop(kind == SOFTLIMIT ? LIMIT : kind == FIXED ? GAIN : kind,
+		   src, sw, dst_old, dw, NSAMPLES, lut, gain, dmax, dmin, clip);
+	  t = now() - t;
+	  if (t < t_old)
+	    t_old = t;
+
+	  t = now();
+	  run_kernel(kind, src, sw, dst_new, dw, NSAMPLES, lut,
+		     smax, smin, gain, dmax, dmin, clip);
+	  t = now() - t;
+	  if (t < t_new)
+	    t_new = t;
+	}
+
+	printf("%-6s %4d %4d", kinds[kind], sw * 8, dw * 8);
+	if (!check_only)
+	  printf(" %12.1f %12.1f %7.2fx", NSAMPLES / t_old * 1e-6,
+		 NSAMPLES / t_new * 1e-6, t_old / t_new);
+	if (kind == SOFTLIMIT) {
+	  maxdiff = 0;
+	  for (i = 0; i < NSAMPLES; i++) {
+	    diff = labs(get_sample(dst_old + i * dw, dw)
+			- get_sample(dst_new + i * dw, dw));
+	    if (diff > maxdiff)
+	      maxdiff = diff;
+	  }
+	  printf("  max diff %ld\n", maxdiff);
+	  if (maxdiff > 1)
+	    bad = 1;
+	} else if (memcmp(dst_old, dst_new, NSAMPLES * dw)) {
+	  printf("  MISMATCH\n");
+	  bad = 1;
+	} else {
+	  printf("\n");
+	}
+
+	if (kind == LUT)
+	  free(lut_mem);
+      }
+    }
+  }
+
+  free(src);
+  free(dst_old);
+  free(dst_new);
+
+  if (check_layouts(kinds))
+    bad = 1;
+  return bad;
+}
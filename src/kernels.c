@@ -0,0 +1,1974 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+#define _POSIX_C_SOURCE 2
+
+#include "config.h"
+
+#include <stdio.h>
+#if STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#else
+# if HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+# if HAVE_STRING_H
+#  include <string.h>
+# else
+#  ifndef HAVE_MEMCPY
+#   define memcpy(d,s,n) bcopy((s),(d),(n))
+#   define memmove(d,s,n) bcopy((s),(d),(n))
+#  endif
+# endif
+#endif
+#if HAVE_MATH_H
+# include <math.h>
+#endif
+
+/*
+ * On x86-64 we build the vector versions of the kernels for each
+ * instruction set level whether or not the compiler was told the
+ * processor has it, and kernels_init() picks one at run time.
+ */
+#if defined(__x86_64__) && defined(__GNUC__) && __GNUC__ >= 5
+# define X86_KERNELS 1
+# include <cpuid.h>
+# include <immintrin.h>
+# define TARGET_SSE2 __attribute__((target("sse2")))
+# define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#include "common.h"
+#include "kernels.h"
+
+double
+sumsq_value(const struct sumsq *s)
+{
+  /* sum of u^2 = sum of (a * 2^16 + b)^2 */
+  return ldexp((double)s->aa, 32) + ldexp((double)s->ab, 17)
+    + (double)s->bb;
+}
+
+/*
+ * Plain C version of the scan, for samples [start, end) of the
+ * buffer.  Adds to sums[] rather than overwriting.  The vector
+ * versions use this to finish off any samples left over at the end.
+ */
+static void
+scan_range_c(const void *buf, int start, int end, int channels,
+	     int width, struct sumsq *sums, long *pmax, long *pmin)
+{
+  const int8_t *p8 = (const int8_t *)buf;
+  const int16_t *p16 = (const int16_t *)buf;
+  const int32_t *p32 = (const int32_t *)buf;
+  long sample, max = *pmax, min = *pmin;
+  uint32_t u, a, b;
+  int i, c;
+
+  c = start % channels;
+  switch (width) {
+  case 1:
+    for (i = start; i < end; i++) {
+      sample = p8[i];
+      sums[c].bb += sample * sample;
+      if (sample > max)
+	max = sample;
+      if (sample < min)
+	min = sample;
+      if (++c == channels)
+	c = 0;
+    }
+    break;
+  case 2:
+    for (i = start; i < end; i++) {
+      sample = p16[i];
+      sums[c].bb += sample * sample;
+      if (sample > max)
+	max = sample;
+      if (sample < min)
+	min = sample;
+      if (++c == channels)
+	c = 0;
+    }
+    break;
+  case 4:
+    for (i = start; i < end; i++) {
+      sample = p32[i];
+      u = sample < 0 ? -(uint32_t)sample : (uint32_t)sample;
+      a = u >> 16;
+      b = u & 0xFFFF;
+      sums[c].aa += a * a;
+      sums[c].ab += a * b;
+      sums[c].bb += (uint64_t)b * b;
+      if (sample > max)
+	max = sample;
+      if (sample < min)
+	min = sample;
+      if (++c == channels)
+	c = 0;
+    }
+    break;
+  default:
+    /* shouldn't happen */
+    abort();
+  }
+
+  *pmax = max;
+  *pmin = min;
+}
+
+
+#if X86_KERNELS
+/*
+ * The vector versions keep separate sums for each sample position
+ * within a block of BLOCK samples.  As long as the channel count
+ * divides BLOCK, position p always holds channel p % channels, and
+ * we fold the positions into channels at the end.
+ */
+struct possums {
+  uint64_t aa[16];
+  uint64_t ab[16];
+  uint64_t bb[16];
+};
+
+static void
+fold_positions(struct possums *ps, int block, int channels,
+	       struct sumsq *sums)
+{
+  int p;
+
+  for (p = 0; p < block; p++) {
+    sums[p % channels].aa += ps->aa[p];
+    sums[p % channels].ab += ps->ab[p];
+    sums[p % channels].bb += ps->bb[p];
+  }
+}
+#endif
+
+
+#if X86_KERNELS
+
+/* add the two 64-bit lanes of v to acc[pos0] and acc[pos1] */
+TARGET_SSE2
+static inline void
+add_lanes_sse2(uint64_t *acc, __m128i v, int pos0, int pos1)
+{
+  uint64_t t[2];
+
+  _mm_storeu_si128((__m128i *)t, v);
+  acc[pos0] += t[0];
+  acc[pos1] += t[1];
+}
+
+/*
+ * Squares of eight 16-bit samples, widened to 64 bits.  acc[k] gets
+ * positions 2k and 2k + 1.
+ */
+TARGET_SSE2
+static inline void
+sumsq16_sse2(__m128i x, __m128i *acc)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i lo, hi, sq;
+
+  lo = _mm_mullo_epi16(x, x);
+  hi = _mm_mulhi_epi16(x, x);
+  sq = _mm_unpacklo_epi16(lo, hi);
+  acc[0] = _mm_add_epi64(acc[0], _mm_unpacklo_epi32(sq, zero));
+  acc[1] = _mm_add_epi64(acc[1], _mm_unpackhi_epi32(sq, zero));
+  sq = _mm_unpackhi_epi16(lo, hi);
+  acc[2] = _mm_add_epi64(acc[2], _mm_unpacklo_epi32(sq, zero));
+  acc[3] = _mm_add_epi64(acc[3], _mm_unpackhi_epi32(sq, zero));
+}
+
+/*
+ * Split sums of squares of four 32-bit samples.  acc[0..2] get the
+ * aa, ab, bb sums for positions 0 and 2; acc[3..5] for 1 and 3.
+ */
+TARGET_SSE2
+static inline void
+sumsq32_sse2(__m128i x, __m128i *acc)
+{
+  const __m128i lo16 = _mm_set1_epi32(0xFFFF);
+  __m128i sign, u, a, b;
+
+  /* |x|, which is right even for -2^31 if we take it as unsigned */
+  sign = _mm_srai_epi32(x, 31);
+  u = _mm_sub_epi32(_mm_xor_si128(x, sign), sign);
+  a = _mm_srli_epi32(u, 16);
+  b = _mm_and_si128(u, lo16);
+
+  /* _mm_mul_epu32 only multiplies the even lanes */
+  acc[0] = _mm_add_epi64(acc[0], _mm_mul_epu32(a, a));
+  acc[1] = _mm_add_epi64(acc[1], _mm_mul_epu32(a, b));
+  acc[2] = _mm_add_epi64(acc[2], _mm_mul_epu32(b, b));
+  a = _mm_srli_epi64(a, 32);
+  b = _mm_srli_epi64(b, 32);
+  acc[3] = _mm_add_epi64(acc[3], _mm_mul_epu32(a, a));
+  acc[4] = _mm_add_epi64(acc[4], _mm_mul_epu32(a, b));
+  acc[5] = _mm_add_epi64(acc[5], _mm_mul_epu32(b, b));
+}
+
+TARGET_SSE2
+static inline __m128i
+max32_sse2(__m128i x, __m128i y)
+{
+  __m128i gt = _mm_cmpgt_epi32(x, y);
+  return _mm_or_si128(_mm_and_si128(gt, x), _mm_andnot_si128(gt, y));
+}
+
+TARGET_SSE2
+static inline __m128i
+min32_sse2(__m128i x, __m128i y)
+{
+  __m128i gt = _mm_cmpgt_epi32(x, y);
+  return _mm_or_si128(_mm_and_si128(gt, y), _mm_andnot_si128(gt, x));
+}
+
+#define BLOCK_SSE2 8
+
+TARGET_SSE2
+static void
+scan_samples_sse2(const void *buf, int n, int channels, int width,
+		  struct sumsq *sums, long *pmax, long *pmin)
+{
+  struct possums ps;
+  __m128i acc[12], vmax, vmin, x;
+  int16_t t16[8];
+  int32_t t32[4];
+  long max = *pmax, min = *pmin;
+  int i, k;
+
+  memset(&ps, 0, sizeof(ps));
+  for (k = 0; k < 12; k++)
+    acc[k] = _mm_setzero_si128();
+  i = 0;
+
+  switch (width) {
+  case 1:
+  case 2:
+    vmax = _mm_set1_epi16(-32768);
+    vmin = _mm_set1_epi16(32767);
+    if (width == 1) {
+      const int8_t *p8 = (const int8_t *)buf;
+      __m128i lo, hi;
+      for (; i + 16 <= n; i += 16) {
+	x = _mm_loadu_si128((const __m128i *)(p8 + i));
+	/* sign-extend to 16 bits */
+	lo = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+	hi = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+	sumsq16_sse2(lo, acc);
+	sumsq16_sse2(hi, acc);
+	vmax = _mm_max_epi16(vmax, _mm_max_epi16(lo, hi));
+	vmin = _mm_min_epi16(vmin, _mm_min_epi16(lo, hi));
+      }
+    } else {
+      const int16_t *p16 = (const int16_t *)buf;
+      for (; i + 8 <= n; i += 8) {
+	x = _mm_loadu_si128((const __m128i *)(p16 + i));
+	sumsq16_sse2(x, acc);
+	vmax = _mm_max_epi16(vmax, x);
+	vmin = _mm_min_epi16(vmin, x);
+      }
+    }
+    for (k = 0; k < 4; k++)
+      add_lanes_sse2(ps.bb, acc[k], 2 * k, 2 * k + 1);
+    if (i > 0) {
+      _mm_storeu_si128((__m128i *)t16, vmax);
+      for (k = 0; k < 8; k++)
+	if (t16[k] > max)
+	  max = t16[k];
+      _mm_storeu_si128((__m128i *)t16, vmin);
+      for (k = 0; k < 8; k++)
+	if (t16[k] < min)
+	  min = t16[k];
+    }
+    break;
+
+  case 4: {
+    const int32_t *p32 = (const int32_t *)buf;
+    __m128i y;
+    vmax = _mm_set1_epi32((int32_t)0x80000000);
+    vmin = _mm_set1_epi32(0x7FFFFFFF);
+    for (; i + 8 <= n; i += 8) {
+      x = _mm_loadu_si128((const __m128i *)(p32 + i));
+      y = _mm_loadu_si128((const __m128i *)(p32 + i + 4));
+      sumsq32_sse2(x, acc);
+      sumsq32_sse2(y, acc + 6);
+      vmax = max32_sse2(vmax, max32_sse2(x, y));
+      vmin = min32_sse2(vmin, min32_sse2(x, y));
+    }
+    /* acc[0..5] hold positions 0-3, acc[6..11] positions 4-7 */
+    for (k = 0; k < 2; k++) {
+      add_lanes_sse2(ps.aa, acc[6 * k + 0], 4 * k + 0, 4 * k + 2);
+      add_lanes_sse2(ps.ab, acc[6 * k + 1], 4 * k + 0, 4 * k + 2);
+      add_lanes_sse2(ps.bb, acc[6 * k + 2], 4 * k + 0, 4 * k + 2);
+      add_lanes_sse2(ps.aa, acc[6 * k + 3], 4 * k + 1, 4 * k + 3);
+      add_lanes_sse2(ps.ab, acc[6 * k + 4], 4 * k + 1, 4 * k + 3);
+      add_lanes_sse2(ps.bb, acc[6 * k + 5], 4 * k + 1, 4 * k + 3);
+    }
+    if (i > 0) {
+      _mm_storeu_si128((__m128i *)t32, vmax);
+      for (k = 0; k < 4; k++)
+	if (t32[k] > max)
+	  max = t32[k];
+      _mm_storeu_si128((__m128i *)t32, vmin);
+      for (k = 0; k < 4; k++)
+	if (t32[k] < min)
+	  min = t32[k];
+    }
+    break;
+  }
+
+  default:
+    /* shouldn't happen */
+    abort();
+  }
+
+  /* we only get here if channels divides the block */
+  fold_positions(&ps, BLOCK_SSE2, channels, sums);
+  *pmax = max;
+  *pmin = min;
+  scan_range_c(buf, i, n, channels, width, sums, pmax, pmin);
+}
+
+#endif /* X86_KERNELS */
+
+
+#if X86_KERNELS
+
+/* add the four 64-bit lanes of v to acc[pos], acc[pos + step], ... */
+TARGET_AVX2
+static inline void
+add_lanes_avx2(uint64_t *acc, __m256i v, int pos, int step)
+{
+  uint64_t t[4];
+  int k;
+
+  _mm256_storeu_si256((__m256i *)t, v);
+  for (k = 0; k < 4; k++)
+    acc[pos + k * step] += t[k];
+}
+
+/*
+ * Squares of eight 16-bit samples, given sign-extended to 32 bits,
+ * widened to 64 bits.  acc[0] gets positions 0-3, acc[1] 4-7.
+ */
+TARGET_AVX2
+static inline void
+sumsq16_avx2(__m256i x, __m256i *acc)
+{
+  __m256i sq;
+
+  /*
+   * With |x| in the low half of each lane and zero in the high half,
+   * _mm256_madd_epi16 gives us x * x.  |-32768| comes out as -32768
+   * again, but squares to the right thing.
+   */
+  sq = _mm256_abs_epi32(x);
+  sq = _mm256_madd_epi16(sq, sq);
+  acc[0] = _mm256_add_epi64(acc[0],
+			    _mm256_cvtepu32_epi64(_mm256_castsi256_si128(sq)));
+  acc[1] = _mm256_add_epi64(acc[1],
+			    _mm256_cvtepu32_epi64(_mm256_extracti128_si256(sq, 1)));
+}
+
+/*
+ * Split sums of squares of eight 32-bit samples.  acc[0..2] get the
+ * aa, ab, bb sums for even positions; acc[3..5] for odd ones.
+ */
+TARGET_AVX2
+static inline void
+sumsq32_avx2(__m256i x, __m256i *acc)
+{
+  const __m256i lo16 = _mm256_set1_epi32(0xFFFF);
+  __m256i u, a, b;
+
+  /* _mm256_abs_epi32(-2^31) is 2^31 if we take it as unsigned */
+  u = _mm256_abs_epi32(x);
+  a = _mm256_srli_epi32(u, 16);
+  b = _mm256_and_si256(u, lo16);
+
+  acc[0] = _mm256_add_epi64(acc[0], _mm256_mul_epu32(a, a));
+  acc[1] = _mm256_add_epi64(acc[1], _mm256_mul_epu32(a, b));
+  acc[2] = _mm256_add_epi64(acc[2], _mm256_mul_epu32(b, b));
+  a = _mm256_srli_epi64(a, 32);
+  b = _mm256_srli_epi64(b, 32);
+  acc[3] = _mm256_add_epi64(acc[3], _mm256_mul_epu32(a, a));
+  acc[4] = _mm256_add_epi64(acc[4], _mm256_mul_epu32(a, b));
+  acc[5] = _mm256_add_epi64(acc[5], _mm256_mul_epu32(b, b));
+}
+
+#define BLOCK_AVX2 16
+
+TARGET_AVX2
+static void
+scan_samples_avx2(const void *buf, int n, int channels, int width,
+		  struct sumsq *sums, long *pmax, long *pmin)
+{
+  struct possums ps;
+  __m256i acc[12], vmax, vmin, x, y;
+  int32_t t32[8];
+  long max = *pmax, min = *pmin;
+  int i, k;
+
+  memset(&ps, 0, sizeof(ps));
+  for (k = 0; k < 12; k++)
+    acc[k] = _mm256_setzero_si256();
+  vmax = _mm256_set1_epi32((int32_t)0x80000000);
+  vmin = _mm256_set1_epi32(0x7FFFFFFF);
+  i = 0;
+
+  switch (width) {
+  case 1:
+  case 2:
+    /* everything is widened to 32 bits here, so min/max is as for 4 */
+    for (; i + 16 <= n; i += 16) {
+      if (width == 1) {
+	__m128i v = _mm_loadu_si128((const __m128i *)((const int8_t *)buf + i));
+	x = _mm256_cvtepi8_epi32(v);
+	y = _mm256_cvtepi8_epi32(_mm_srli_si128(v, 8));
+      } else {
+	const int16_t *p16 = (const int16_t *)buf + i;
+	x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)p16));
+	y = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(p16 + 8)));
+      }
+      sumsq16_avx2(x, acc);
+      sumsq16_avx2(y, acc + 2);
+      vmax = _mm256_max_epi32(vmax, _mm256_max_epi32(x, y));
+      vmin = _mm256_min_epi32(vmin, _mm256_min_epi32(x, y));
+    }
+    for (k = 0; k < 4; k++)
+      add_lanes_avx2(ps.bb, acc[k], 4 * k, 1);
+    break;
+
+  case 4: {
+    const int32_t *p32 = (const int32_t *)buf;
+    for (; i + 16 <= n; i += 16) {
+      x = _mm256_loadu_si256((const __m256i *)(p32 + i));
+      y = _mm256_loadu_si256((const __m256i *)(p32 + i + 8));
+      sumsq32_avx2(x, acc);
+      sumsq32_avx2(y, acc + 6);
+      vmax = _mm256_max_epi32(vmax, _mm256_max_epi32(x, y));
+      vmin = _mm256_min_epi32(vmin, _mm256_min_epi32(x, y));
+    }
+    for (k = 0; k < 2; k++) {
+      add_lanes_avx2(ps.aa, acc[6 * k + 0], 8 * k + 0, 2);
+      add_lanes_avx2(ps.ab, acc[6 * k + 1], 8 * k + 0, 2);
+      add_lanes_avx2(ps.bb, acc[6 * k + 2], 8 * k + 0, 2);
+      add_lanes_avx2(ps.aa, acc[6 * k + 3], 8 * k + 1, 2);
+      add_lanes_avx2(ps.ab, acc[6 * k + 4], 8 * k + 1, 2);
+      add_lanes_avx2(ps.bb, acc[6 * k + 5], 8 * k + 1, 2);
+    }
+    break;
+  }
+
+  default:
+    /* shouldn't happen */
+    abort();
+  }
+
+  if (i > 0) {
+    _mm256_storeu_si256((__m256i *)t32, vmax);
+    for (k = 0; k < 8; k++)
+      if (t32[k] > max)
+	max = t32[k];
+    _mm256_storeu_si256((__m256i *)t32, vmin);
+    for (k = 0; k < 8; k++)
+      if (t32[k] < min)
+	min = t32[k];
+  }
+
+  /* we only get here if channels divides the block */
+  fold_positions(&ps, BLOCK_AVX2, channels, sums);
+  *pmax = max;
+  *pmin = min;
+  scan_range_c(buf, i, n, channels, width, sums, pmax, pmin);
+}
+
+#endif /* X86_KERNELS */
+
+
+
+
+/*
+ * Plain C versions of the kernels used when applying gain.  Samples
+ * are in the format the file reader gives us, as for scan_samples(),
+ * so 24-bit samples take four bytes.  Each loop is written out for
+ * every pair of source and destination widths, so the width isn't
+ * looked at for every sample.
+ */
+
+static inline long
+get_sample_k(const void *buf, int i, int width)
+{
+  switch (width) {
+  case 1:
+    return ((const int8_t *)buf)[i];
+  case 2:
+    return ((const int16_t *)buf)[i];
+  default:
+    return ((const int32_t *)buf)[i];
+  }
+}
+
+#define WIDTHS(src_width, dst_width) ((src_width) << 4 | (dst_width))
+
+/* expand LOOP(src_type, dst_type) for the widths we're given */
+#define FOR_WIDTHS(src_width, dst_width, LOOP)			\
+  switch (WIDTHS(src_width, dst_width)) {			\
+  case WIDTHS(1, 1): LOOP(int8_t, int8_t); break;		\
+  case WIDTHS(1, 2): LOOP(int8_t, int16_t); break;		\
+  case WIDTHS(1, 4): LOOP(int8_t, int32_t); break;		\
+  case WIDTHS(2, 1): LOOP(int16_t, int8_t); break;		\
+  case WIDTHS(2, 2): LOOP(int16_t, int16_t); break;		\
+  case WIDTHS(2, 4): LOOP(int16_t, int32_t); break;		\
+  case WIDTHS(4, 1): LOOP(int32_t, int8_t); break;		\
+  case WIDTHS(4, 2): LOOP(int32_t, int16_t); break;		\
+  default:           LOOP(int32_t, int32_t); break;		\
+  }
+
+#define LUT_LOOP(stype, dtype)						\
+  do {									\
+    const stype *s = (const stype *)src;				\
+    dtype *d = (dtype *)dst;						\
+    for (i = start; i < end; i++) {					\
+      sample = s[i];							\
+      nclipped += (sample >= min_pos_clipped) | (sample <= max_neg_clipped); \
+      d[i] = (dtype)lut[sample];					\
+    }									\
+  } while (0)
+
+static unsigned int
+lut_range_c(const void *src, int src_width, void *dst, int dst_width,
+	    int start, int end, const int32_t *lut,
+	    long min_pos_clipped, long max_neg_clipped)
+{
+  unsigned int nclipped = 0;
+  long sample;
+  int i;
+
+  FOR_WIDTHS(src_width, dst_width, LUT_LOOP);
+
+  return nclipped;
+}
+
+/*
+ * ROUND(x), without the call to floor() most compilers make for it
+ * unless they can assume SSE4.1.  Exact for any x that fits in a long.
+ */
+static inline long
+round_k(double x)
+{
+  long r;
+
+  x += 0.5;
+  r = (long)x;
+  return r - (r > x);
+}
+
+#define GAIN_LOOP(stype, dtype)						\
+  do {									\
+    const stype *s = (const stype *)src;				\
+    dtype *d = (dtype *)dst;						\
+    if (!clip) {							\
+      for (i = start; i < end; i++)					\
+	d[i] = (dtype)round_k(s[i] * gain);				\
+      break;								\
+    }									\
+    for (i = start; i < end; i++) {					\
+      sample_d = s[i] * gain;						\
+      if (sample_d > dst_max) {						\
+	sample = dst_max;						\
+	nclipped++;							\
+      } else if (sample_d < dst_min) {					\
+	sample = dst_min;						\
+	nclipped++;							\
+      } else {								\
+	sample = round_k(sample_d);					\
+      }									\
+      d[i] = (dtype)sample;						\
+    }									\
+  } while (0)
+
+static unsigned int
+gain_range_c(const void *src, int src_width, void *dst, int dst_width,
+	     int start, int end, double gain, long dst_max, long dst_min,
+	     int clip)
+{
+  unsigned int nclipped = 0;
+  double sample_d;
+  long sample;
+  int i;
+
+  FOR_WIDTHS(src_width, dst_width, GAIN_LOOP);
+
+  return nclipped;
+}
+
+/*
+ * Gain in fixed point.  When the gain is m / 2^shift for a small
+ * enough integer m, every product sample * gain is exact in a double,
+ * so the double arithmetic above comes down to integer arithmetic:
+ * sample * m, rounded by adding half of 2^shift and shifting, and
+ * clipped by comparing with dst_max and dst_min shifted up the same
+ * way.  That's what we do here, with the same results.  Gains that
+ * are exact powers of two, such as those for converting between
+ * sample widths, and simple fractions of them, are common enough to
+ * be worth it.
+ */
+struct fixed_gain {
+  int64_t m;                /* the gain is m / 2^shift */
+  int shift;
+  int64_t half;             /* 2^(shift-1), or 0 */
+  int64_t max, min;         /* dst_max and dst_min, times 2^shift */
+};
+
+/*
+ * Fill in fg for the given gain, if it can be done in fixed point for
+ * samples of the given width; returns FALSE if it can't.  m must fit
+ * in 31 bits, for the AVX2 multiply, and sample * m must fit in the
+ * 53 bits of a double, so that the double arithmetic is exact.
+ */
+static int
+fixed_gain_init(struct fixed_gain *fg, double gain, int src_bits,
+		long dst_max, long dst_min)
+{
+  double mant;
+  int exp;
+
+  if (!(gain > 0))
+    return FALSE;
+  /* gain = mant * 2^exp, with 0.5 <= mant < 1 */
+  mant = frexp(gain, &exp);
+  fg->m = (int64_t)ldexp(mant, 53);
+  fg->shift = 53 - exp;
+  while (fg->shift > 0 && !(fg->m & 1)) {
+    fg->m >>= 1;
+    fg->shift--;
+  }
+  if (fg->shift < 0 || fg->shift > 32
+      || fg->m >= ((int64_t)1 << (54 - src_bits))
+      || fg->m >= ((int64_t)1 << 31))
+    return FALSE;
+  fg->half = fg->shift ? (int64_t)1 << (fg->shift - 1) : 0;
+  fg->max = (int64_t)dst_max * ((int64_t)1 << fg->shift);
+  fg->min = (int64_t)dst_min * ((int64_t)1 << fg->shift);
+  return TRUE;
+}
+
+#define FIXED_LOOP(stype, dtype)					\
+  do {									\
+    const stype *s = (const stype *)src;				\
+    dtype *d = (dtype *)dst;						\
+    if (!clip) {							\
+      for (i = start; i < end; i++)					\
+	d[i] = (dtype)((s[i] * fg->m + fg->half) >> fg->shift);		\
+      break;								\
+    }									\
+    for (i = start; i < end; i++) {					\
+      product = s[i] * fg->m;						\
+      if (product > fg->max) {						\
+	sample = dst_max;						\
+	nclipped++;							\
+      } else if (product < fg->min) {					\
+	sample = dst_min;						\
+	nclipped++;							\
+      } else {								\
+	sample = (product + fg->half) >> fg->shift;			\
+      }									\
+      d[i] = (dtype)sample;						\
+    }									\
+  } while (0)
+
+static unsigned int
+fixed_range_c(const void *src, int src_width, void *dst, int dst_width,
+	      int start, int end, const struct fixed_gain *fg,
+	      long dst_max, long dst_min, int clip)
+{
+  unsigned int nclipped = 0;
+  int64_t product;
+  long sample;
+  int i;
+
+  FOR_WIDTHS(src_width, dst_width, FIXED_LOOP);
+
+  return nclipped;
+}
+
+#define LIMIT_LOOP(stype, dtype)					\
+  do {									\
+    const stype *s = (const stype *)src;				\
+    dtype *d = (dtype *)dst;						\
+    for (i = 0; i < n; i++)						\
+      d[i] = (dtype)(long)ROUND(dst_max * shape(s[i] * gain / dst_max)); \
+  } while (0)
+
+static void
+limit_range_c(const void *src, int src_width, void *dst, int dst_width,
+	      int n, double gain, double dst_max, double (*shape)(double))
+{
+  int i;
+
+  FOR_WIDTHS(src_width, dst_width, LIMIT_LOOP);
+}
+
+/*
+ * tanh() on [0, TANH_MAX], sampled TANH_STEPS times per unit, for the
+ * approximate limiter.  Between the samples we interpolate with a
+ * cubic Hermite spline, using tanh'(t) = 1 - tanh(t)^2 for the slopes;
+ * the result is within 4e-11 of tanh(t) everywhere, and past
+ * TANH_MAX, tanh(t) is 1 to double precision.
+ */
+#define TANH_STEPS 128
+#define TANH_MAX 20
+#define TANH_SIZE (TANH_MAX * TANH_STEPS + 1)
+
+static double tanh_table[TANH_SIZE];
+
+static void
+tanh_table_init(void)
+{
+  int k;
+
+  for (k = 0; k < TANH_SIZE; k++)
+    tanh_table[k] = tanh((double)k / TANH_STEPS);
+}
+
+/*
+ * The limiter curve of adjust.c, with the tanh() approximated as
+ * above.  The vector versions do the same arithmetic in the same
+ * order, so they give the same results.
+ */
+static inline double
+softlimit(double x, double level)
+{
+  const double h = 1.0 / TANH_STEPS;
+  double a, u, f, y0, y1, m0, m1, c2, c3, y;
+  int k;
+
+  a = fabs(x);
+  if (a <= level)
+    return x;
+  u = (a - level) / (1 - level) * TANH_STEPS;
+  if (u > TANH_SIZE - 1)
+    u = TANH_SIZE - 1;
+  k = (int)u;
+  if (k > TANH_SIZE - 2)
+    k = TANH_SIZE - 2;
+  f = u - k;
+  y0 = tanh_table[k];
+  y1 = tanh_table[k + 1];
+  m0 = (1 - y0 * y0) * h;
+  m1 = (1 - y1 * y1) * h;
+  c2 = 3 * (y1 - y0) - 2 * m0 - m1;
+  c3 = 2 * (y0 - y1) + m0 + m1;
+  y = (y0 + f * (m0 + f * (c2 + f * c3))) * (1 - level) + level;
+  return x < 0 ? -y : y;
+}
+
+#define SOFTLIMIT_LOOP(stype, dtype)					\
+  do {									\
+    const stype *s = (const stype *)src;				\
+    dtype *d = (dtype *)dst;						\
+    for (i = start; i < end; i++)					\
+      d[i] = (dtype)(long)ROUND(dst_max * softlimit(s[i] * gain / dst_max, \
+						    level));		\
+  } while (0)
+
+static void
+softlimit_range_c(const void *src, int src_width, void *dst, int dst_width,
+		  int start, int end, double gain, double dst_max,
+		  double level)
+{
+  int i;
+
+  FOR_WIDTHS(src_width, dst_width, SOFTLIMIT_LOOP);
+}
+
+static void
+flip_sign8_c(void *buf, int n)
+{
+  uint8_t *p = (uint8_t *)buf;
+  int i;
+
+  for (i = 0; i < n; i++)
+    p[i] ^= 0x80;
+}
+
+/* reverse the bytes of samples [start, n), of size bytes each */
+static void
+swap_bytes_c(void *buf, int start, int n, int size)
+{
+  uint8_t *p, t;
+  int i, j;
+
+  p = (uint8_t *)buf + size * start;
+  for (i = start; i < n; i++, p += size) {
+    for (j = 0; j < size / 2; j++) {
+      t = p[j];
+      p[j] = p[size - 1 - j];
+      p[size - 1 - j] = t;
+    }
+  }
+}
+
+/* expand samples [start, n) from 3 bytes to 4, working backwards */
+static void
+expand24_c(void *buf, int start, int n)
+{
+  uint8_t *psrc, *pdest;
+
+  psrc = (uint8_t *)buf + 3 * n;
+  pdest = (uint8_t *)buf + 4 * n;
+  while (n-- > start) {
+    psrc -= 3;
+    pdest -= 4;
+    pdest[3] = (psrc[2] & 0x80) ? 0xFF : 0;
+    pdest[2] = psrc[2];
+    pdest[1] = psrc[1];
+    pdest[0] = psrc[0];
+  }
+}
+
+/* pack samples [start, n) from 4 bytes to 3 */
+static void
+pack24_c(void *buf, int start, int n)
+{
+  uint8_t *psrc, *pdest;
+  int i;
+
+  psrc = (uint8_t *)buf + 4 * start;
+  pdest = (uint8_t *)buf + 3 * start;
+  for (i = start; i < n; i++) {
+    pdest[0] = psrc[0];
+    pdest[1] = psrc[1];
+    pdest[2] = psrc[2];
+    psrc += 4;
+    pdest += 3;
+  }
+}
+
+/*
+ * Run channels [c0, channels) of the samples through the filters.
+ * Each channel goes through the whole buffer in turn, so its state
+ * stays in registers.
+ */
+static void
+biquad_range_c(const void *buf, int nframes, int channels, int width,
+	       double scale, struct biquad2 *f, double *sums, int c0)
+{
+  const double b00 = f->b[0][0], b01 = f->b[0][1], b02 = f->b[0][2];
+  const double a01 = f->a[0][1], a02 = f->a[0][2];
+  const double b10 = f->b[1][0], b11 = f->b[1][1], b12 = f->b[1][2];
+  const double a11 = f->a[1][1], a12 = f->a[1][2];
+  double x, y, z00, z01, z10, z11, sum;
+  int i, c;
+
+  for (c = c0; c < channels; c++) {
+    z00 = f->z[0][0][c];
+    z01 = f->z[0][1][c];
+    z10 = f->z[1][0][c];
+    z11 = f->z[1][1][c];
+    sum = 0;
+    for (i = 0; i < nframes; i++) {
+      x = get_sample_k(buf, i * channels + c, width) * scale;
+      y = b00 * x + z00;
+      z00 = b01 * x - a01 * y + z01;
+      z01 = b02 * x - a02 * y;
+      x = y;
+      y = b10 * x + z10;
+      z10 = b11 * x - a11 * y + z11;
+      z11 = b12 * x - a12 * y;
+      sum += y * y;
+    }
+    f->z[0][0][c] = z00;
+    f->z[0][1][c] = z01;
+    f->z[1][0][c] = z10;
+    f->z[1][1][c] = z11;
+    sums[c] += sum;
+  }
+}
+
+/*
+ * The filter of ITU-R BS.1770-4 annex 2, phase by phase.  The taps
+ * are all multiples of 2^-13, so floats hold them exactly.
+ */
+static const float truepeak_coefs[TRUEPEAK_PHASES][TRUEPEAK_TAPS] = {
+  {  0.0017089843750f,  0.0109863281250f, -0.0196533203125f,
+     0.0332031250000f, -0.0594482421875f,  0.1373291015625f,
+     0.9721679687500f, -0.1022949218750f,  0.0476074218750f,
+    -0.0266113281250f,  0.0148925781250f, -0.0083007812500f },
+  { -0.0291748046875f,  0.0292968750000f, -0.0517578125000f,
+     0.0891113281250f, -0.1665039062500f,  0.4650878906250f,
+     0.7797851562500f, -0.2003173828125f,  0.1015625000000f,
+    -0.0582275390625f,  0.0330810546875f, -0.0189208984375f },
+  { -0.0189208984375f,  0.0330810546875f, -0.0582275390625f,
+     0.1015625000000f, -0.2003173828125f,  0.7797851562500f,
+     0.4650878906250f, -0.1665039062500f,  0.0891113281250f,
+    -0.0517578125000f,  0.0292968750000f, -0.0291748046875f },
+  { -0.0083007812500f,  0.0148925781250f, -0.0266113281250f,
+     0.0476074218750f, -0.1022949218750f,  0.9721679687500f,
+     0.1373291015625f, -0.0594482421875f,  0.0332031250000f,
+    -0.0196533203125f,  0.0109863281250f,  0.0017089843750f },
+};
+
+/*
+ * More than the sum of the magnitudes of any phase's taps, so no
+ * output can be larger than this times the largest input it sees.
+ */
+#define TRUEPEAK_GAIN 2.03f
+
+/* frames of one channel the true-peak meter works on at a time */
+#define TRUEPEAK_CHUNK 256
+
+/*
+ * Filter samples [start, n) of x, where x[-(TRUEPEAK_TAPS - 1)] to
+ * x[-1] are the ones before them, and return the largest magnitude
+ * of the output, or max if that's larger.
+ */
+typedef float truepeak_block_fn(const float *x, int start, int n, float max);
+
+static float
+truepeak_block_c(const float *x, int start, int n, float max)
+{
+  float acc;
+  int i, k, p;
+
+  for (i = start; i < n; i++) {
+    for (p = 0; p < TRUEPEAK_PHASES; p++) {
+      acc = 0.0f;
+      for (k = 0; k < TRUEPEAK_TAPS; k++)
+	acc += truepeak_coefs[p][k] * x[i - k];
+      if (fabsf(acc) > max)
+	max = fabsf(acc);
+    }
+  }
+  return max;
+}
+
+/*
+ * Copy channel c of the samples into x, scaled, and return the
+ * largest magnitude among them.
+ */
+static float
+truepeak_load(const void *buf, int n, int channels, int c, int width,
+	      float scale, float *x)
+{
+  const int8_t *p8 = (const int8_t *)buf + c;
+  const int16_t *p16 = (const int16_t *)buf + c;
+  const int32_t *p32 = (const int32_t *)buf + c;
+  long v, hi = 0, lo = 0;
+  int i;
+
+  switch (width) {
+  case 1:
+    for (i = 0; i < n; i++) {
+      v = p8[i * channels];
+      x[i] = v * scale;
+      hi = v > hi ? v : hi;
+      lo = v < lo ? v : lo;
+    }
+    break;
+  case 2:
+    for (i = 0; i < n; i++) {
+      v = p16[i * channels];
+      x[i] = v * scale;
+      hi = v > hi ? v : hi;
+      lo = v < lo ? v : lo;
+    }
+    break;
+  default:
+    for (i = 0; i < n; i++) {
+      v = p32[i * channels];
+      x[i] = v * scale;
+      hi = v > hi ? v : hi;
+      lo = v < lo ? v : lo;
+    }
+    break;
+  }
+  return (hi > -lo ? hi : -lo) * scale;
+}
+
+/*
+ * Meter each channel in turn, a chunk at a time.  Most of the time
+ * the meter has already seen a bigger peak than a chunk could
+ * produce, and then we only have to keep its history up to date.
+ */
+static void
+truepeak_run(const void *buf, int nframes, int channels, int width,
+	     float scale, struct truepeak *tp, truepeak_block_fn *block)
+{
+  float x[TRUEPEAK_TAPS - 1 + TRUEPEAK_CHUNK], *cur, peak;
+  int c, i, done, n;
+
+  cur = x + TRUEPEAK_TAPS - 1;
+  for (c = 0; c < channels; c++) {
+    memcpy(x, tp->hist[c], sizeof(tp->hist[c]));
+    for (done = 0; done < nframes; done += n) {
+      n = nframes - done;
+      if (n > TRUEPEAK_CHUNK)
+	n = TRUEPEAK_CHUNK;
+      peak = truepeak_load((const char *)buf + done * channels * width, n,
+			   channels, c, width, scale, cur);
+      for (i = 0; i < TRUEPEAK_TAPS - 1; i++)
+	if (fabsf(x[i]) > peak)
+	  peak = fabsf(x[i]);
+      if (peak * TRUEPEAK_GAIN > tp->max)
+	tp->max = block(cur, 0, n, tp->max);
+      memmove(x, x + n, sizeof(tp->hist[c]));
+    }
+    memcpy(tp->hist[c], x, sizeof(tp->hist[c]));
+  }
+}
+
+
+#if X86_KERNELS
+
+/* load eight samples of the given width, sign-extended to 32 bits */
+TARGET_AVX2
+static inline __m256i
+load8_avx2(const void *buf, int i, int width)
+{
+  switch (width) {
+  case 1:
+    return _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)((const int8_t *)buf + i)));
+  case 2:
+    return _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)((const int16_t *)buf + i)));
+  default:
+    return _mm256_loadu_si256((const __m256i *)((const int32_t *)buf + i));
+  }
+}
+
+/* store eight 32-bit samples, truncated to the given width */
+TARGET_AVX2
+static inline void
+store8_avx2(void *buf, int i, int width, __m256i v)
+{
+  switch (width) {
+  case 1:
+    /* low byte of each sample to the bottom of each half... */
+    v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+						 -1, -1, -1, -1, -1, -1, -1, -1,
+						 0, 4, 8, 12, -1, -1, -1, -1,
+						 -1, -1, -1, -1, -1, -1, -1, -1));
+    /* ...then the two halves together */
+    v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+    _mm_storel_epi64((__m128i *)((int8_t *)buf + i), _mm256_castsi256_si128(v));
+    break;
+  case 2:
+    v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13,
+						 -1, -1, -1, -1, -1, -1, -1, -1,
+						 0, 1, 4, 5, 8, 9, 12, 13,
+						 -1, -1, -1, -1, -1, -1, -1, -1));
+    v = _mm256_permute4x64_epi64(v, 0x08);
+    _mm_storeu_si128((__m128i *)((int16_t *)buf + i), _mm256_castsi256_si128(v));
+    break;
+  default:
+    _mm256_storeu_si256((__m256i *)((int32_t *)buf + i), v);
+    break;
+  }
+}
+
+/* the number of 32-bit lanes set in a comparison mask */
+TARGET_AVX2
+static inline int
+count_mask_avx2(__m256i m)
+{
+  return __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+}
+
+TARGET_AVX2
+static unsigned int
+lut_samples_avx2(const void *src, int src_width, void *dst, int dst_width,
+		 int n, const int32_t *lut,
+		 long min_pos_clipped, long max_neg_clipped)
+{
+  const __m256i above = _mm256_set1_epi32(min_pos_clipped - 1);
+  const __m256i below = _mm256_set1_epi32(max_neg_clipped + 1);
+  unsigned int nclipped = 0;
+  __m256i x;
+  int i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    x = load8_avx2(src, i, src_width);
+    nclipped += count_mask_avx2(_mm256_or_si256(_mm256_cmpgt_epi32(x, above),
+						_mm256_cmpgt_epi32(below, x)));
+    store8_avx2(dst, i, dst_width,
+		_mm256_i32gather_epi32((const int *)lut, x, 4));
+  }
+
+  return nclipped + lut_range_c(src, src_width, dst, dst_width, i, n, lut,
+				min_pos_clipped, max_neg_clipped);
+}
+
+/*
+ * Gain on four samples.  This is the same arithmetic, in the same
+ * order, as gain_range_c(), so the results are identical.
+ */
+TARGET_AVX2
+static inline __m128i
+gain4_avx2(__m128i x, __m256d g, __m256d dmax, __m256d dmin, int clip,
+	   unsigned int *nclipped)
+{
+  __m256d d, r;
+
+  d = _mm256_mul_pd(_mm256_cvtepi32_pd(x), g);
+  r = _mm256_floor_pd(_mm256_add_pd(d, _mm256_set1_pd(0.5)));
+  if (clip) {
+    *nclipped += __builtin_popcount(_mm256_movemask_pd(_mm256_or_pd(
+			_mm256_cmp_pd(d, dmax, _CMP_GT_OQ),
+			_mm256_cmp_pd(d, dmin, _CMP_LT_OQ))));
+    r = _mm256_min_pd(_mm256_max_pd(r, dmin), dmax);
+  }
+  return _mm256_cvtpd_epi32(r);
+}
+
+TARGET_AVX2
+static unsigned int
+gain_samples_avx2(const void *src, int src_width, void *dst, int dst_width,
+		  int n, double gain, long dst_max, long dst_min, int clip)
+{
+  const __m256d g = _mm256_set1_pd(gain);
+  const __m256d dmax = _mm256_set1_pd(dst_max);
+  const __m256d dmin = _mm256_set1_pd(dst_min);
+  unsigned int nclipped = 0;
+  __m256i x;
+  __m128i lo, hi;
+  int i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    x = load8_avx2(src, i, src_width);
+    lo = gain4_avx2(_mm256_castsi256_si128(x), g, dmax, dmin, clip, &nclipped);
+    hi = gain4_avx2(_mm256_extracti128_si256(x, 1), g, dmax, dmin, clip,
+		    &nclipped);
+    store8_avx2(dst, i, dst_width,
+		_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1));
+  }
+
+  return nclipped + gain_range_c(src, src_width, dst, dst_width, i, n,
+				 gain, dst_max, dst_min, clip);
+}
+
+/*
+ * fixed_range_c() on four samples, in 64-bit lanes.  There's no
+ * 64-bit arithmetic shift, so we add 2^62 first, to make everything
+ * positive, and take 2^62 >> shift off after.
+ */
+TARGET_AVX2
+static inline __m128i
+fixed4_avx2(__m128i x, __m256i m, __m256i bias, __m256i unbias, __m128i shift,
+	    __m256i max, __m256i min, __m256i dmax, __m256i dmin, int clip,
+	    unsigned int *nclipped)
+{
+  __m256i p, r, above, below;
+
+  p = _mm256_mul_epi32(_mm256_cvtepi32_epi64(x), m);
+  r = _mm256_sub_epi64(_mm256_srl_epi64(_mm256_add_epi64(p, bias), shift),
+		       unbias);
+  if (clip) {
+    above = _mm256_cmpgt_epi64(p, max);
+    below = _mm256_cmpgt_epi64(min, p);
+    *nclipped += __builtin_popcount(_mm256_movemask_pd(
+			_mm256_castsi256_pd(_mm256_or_si256(above, below))));
+    r = _mm256_blendv_epi8(_mm256_blendv_epi8(r, dmax, above), dmin, below);
+  }
+  /* the low half of each lane */
+  r = _mm256_permutevar8x32_epi32(r, _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0));
+  return _mm256_castsi256_si128(r);
+}
+
+TARGET_AVX2
+static unsigned int
+fixed_samples_avx2(const void *src, int src_width, void *dst, int dst_width,
+		   int n, const struct fixed_gain *fg, long dst_max,
+		   long dst_min, int clip)
+{
+  const int64_t bias = (int64_t)1 << 62;
+  const __m256i m = _mm256_set1_epi64x(fg->m);
+  const __m256i add = _mm256_set1_epi64x(bias + fg->half);
+  const __m256i unbias = _mm256_set1_epi64x(bias >> fg->shift);
+  const __m128i shift = _mm_cvtsi32_si128(fg->shift);
+  const __m256i max = _mm256_set1_epi64x(fg->max);
+  const __m256i min = _mm256_set1_epi64x(fg->min);
+  const __m256i dmax = _mm256_set1_epi64x(dst_max);
+  const __m256i dmin = _mm256_set1_epi64x(dst_min);
+  unsigned int nclipped = 0;
+  __m256i x;
+  __m128i lo, hi;
+  int i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    x = load8_avx2(src, i, src_width);
+    lo = fixed4_avx2(_mm256_castsi256_si128(x), m, add, unbias, shift,
+		     max, min, dmax, dmin, clip, &nclipped);
+    hi = fixed4_avx2(_mm256_extracti128_si256(x, 1), m, add, unbias, shift,
+		     max, min, dmax, dmin, clip, &nclipped);
+    store8_avx2(dst, i, dst_width,
+		_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1));
+  }
+
+  return nclipped + fixed_range_c(src, src_width, dst, dst_width, i, n,
+				  fg, dst_max, dst_min, clip);
+}
+
+/* softlimit() on four samples */
+TARGET_AVX2
+static inline __m256d
+softlimit4_avx2(__m256d x, __m256d level)
+{
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d h = _mm256_set1_pd(1.0 / TANH_STEPS);
+  __m256d a, u, f, y0, y1, m0, m1, c2, c3, y;
+  __m128i k;
+
+  a = _mm256_andnot_pd(sign, x);
+  u = _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(a, level),
+				  _mm256_sub_pd(one, level)),
+		    _mm256_set1_pd(TANH_STEPS));
+  /* below the level, u is negative; those lanes are thrown away below */
+  u = _mm256_max_pd(u, _mm256_setzero_pd());
+  u = _mm256_min_pd(u, _mm256_set1_pd(TANH_SIZE - 1));
+  k = _mm256_cvttpd_epi32(u);
+  k = _mm_min_epi32(k, _mm_set1_epi32(TANH_SIZE - 2));
+  f = _mm256_sub_pd(u, _mm256_cvtepi32_pd(k));
+  y0 = _mm256_i32gather_pd(tanh_table, k, 8);
+  y1 = _mm256_i32gather_pd(tanh_table + 1, k, 8);
+  m0 = _mm256_mul_pd(_mm256_sub_pd(one, _mm256_mul_pd(y0, y0)), h);
+  m1 = _mm256_mul_pd(_mm256_sub_pd(one, _mm256_mul_pd(y1, y1)), h);
+  c2 = _mm256_sub_pd(_mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(3.0),
+						 _mm256_sub_pd(y1, y0)),
+				   _mm256_mul_pd(_mm256_set1_pd(2.0), m0)),
+		     m1);
+  c3 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(2.0),
+						 _mm256_sub_pd(y0, y1)),
+				   m0),
+		     m1);
+  y = _mm256_add_pd(c2, _mm256_mul_pd(f, c3));
+  y = _mm256_add_pd(m0, _mm256_mul_pd(f, y));
+  y = _mm256_add_pd(y0, _mm256_mul_pd(f, y));
+  y = _mm256_add_pd(_mm256_mul_pd(y, _mm256_sub_pd(one, level)), level);
+  y = _mm256_or_pd(y, _mm256_and_pd(sign, x));
+  return _mm256_blendv_pd(y, x, _mm256_cmp_pd(a, level, _CMP_LE_OQ));
+}
+
+TARGET_AVX2
+static void
+softlimit_samples_avx2(const void *src, int src_width, void *dst,
+		       int dst_width, int n, double gain, double dst_max,
+		       double level)
+{
+  const __m256d g = _mm256_set1_pd(gain);
+  const __m256d dmax = _mm256_set1_pd(dst_max);
+  const __m256d lev = _mm256_set1_pd(level);
+  const __m256d half = _mm256_set1_pd(0.5);
+  __m256d d[2];
+  __m128i r[2];
+  __m256i x;
+  int i, j;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    x = load8_avx2(src, i, src_width);
+    d[0] = _mm256_cvtepi32_pd(_mm256_castsi256_si128(x));
+    d[1] = _mm256_cvtepi32_pd(_mm256_extracti128_si256(x, 1));
+    for (j = 0; j < 2; j++) {
+      d[j] = _mm256_div_pd(_mm256_mul_pd(d[j], g), dmax);
+      d[j] = _mm256_mul_pd(dmax, softlimit4_avx2(d[j], lev));
+      r[j] = _mm256_cvtpd_epi32(_mm256_floor_pd(_mm256_add_pd(d[j], half)));
+    }
+    store8_avx2(dst, i, dst_width,
+		_mm256_inserti128_si256(_mm256_castsi128_si256(r[0]), r[1], 1));
+  }
+
+  softlimit_range_c(src, src_width, dst, dst_width, i, n, gain, dst_max,
+		    level);
+}
+
+TARGET_SSE2
+static void
+flip_sign8_sse2(void *buf, int n)
+{
+  const __m128i bias = _mm_set1_epi8((char)0x80);
+  uint8_t *p = (uint8_t *)buf;
+  int i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+    _mm_storeu_si128((__m128i *)(p + i),
+		     _mm_xor_si128(_mm_loadu_si128((__m128i *)(p + i)), bias));
+  flip_sign8_c(p + i, n - i);
+}
+
+TARGET_AVX2
+static void
+flip_sign8_avx2(void *buf, int n)
+{
+  const __m256i bias = _mm256_set1_epi8((char)0x80);
+  uint8_t *p = (uint8_t *)buf;
+  int i;
+
+  for (i = 0; i + 32 <= n; i += 32)
+    _mm256_storeu_si256((__m256i *)(p + i),
+			_mm256_xor_si256(_mm256_loadu_si256((__m256i *)(p + i)),
+					 bias));
+  flip_sign8_c(p + i, n - i);
+}
+
+/* swap_bytes() for 16- and 32-bit samples, 32 bytes at a time */
+TARGET_AVX2
+static void
+swap_bytes_avx2(void *buf, int n, int size)
+{
+  const __m256i swap16 = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+					  9, 8, 11, 10, 13, 12, 15, 14,
+					  1, 0, 3, 2, 5, 4, 7, 6,
+					  9, 8, 11, 10, 13, 12, 15, 14);
+  const __m256i swap32 = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+					  11, 10, 9, 8, 15, 14, 13, 12,
+					  3, 2, 1, 0, 7, 6, 5, 4,
+					  11, 10, 9, 8, 15, 14, 13, 12);
+  const __m256i swap = size == 2 ? swap16 : swap32;
+  uint8_t *p = (uint8_t *)buf;
+  __m256i v;
+  int i, step;
+
+  step = 32 / size;
+  for (i = 0; i + step <= n; i += step) {
+    v = _mm256_loadu_si256((__m256i *)(p + size * i));
+    _mm256_storeu_si256((__m256i *)(p + size * i),
+			_mm256_shuffle_epi8(v, swap));
+  }
+  swap_bytes_c(buf, i, n, size);
+}
+
+/*
+ * Since we expand in place, we have to go backwards, eight samples
+ * (24 bytes in, 32 out) at a time.  The odd samples at the end go
+ * first.
+ */
+TARGET_AVX2
+static void
+expand24_avx2(void *buf, int n)
+{
+  /* put each sample in the top three bytes of a lane, then shift down */
+  const __m256i spread = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5,
+					  -1, 6, 7, 8, -1, 9, 10, 11,
+					  -1, 0, 1, 2, -1, 3, 4, 5,
+					  -1, 6, 7, 8, -1, 9, 10, 11);
+  uint8_t *p = (uint8_t *)buf;
+  __m256i v;
+  int i, nvec;
+
+  nvec = n & ~7;
+  expand24_c(buf, nvec, n);
+
+  /*
+   * The high half of each load takes four bytes more than it needs,
+   * but the buffer is big enough for the expanded samples, and the
+   * extra bytes are thrown away.
+   */
+  for (i = nvec - 8; i >= 0; i -= 8) {
+    v = _mm256_inserti128_si256(
+	  _mm256_castsi128_si256(_mm_loadu_si128((__m128i *)(p + 3 * i))),
+	  _mm_loadu_si128((__m128i *)(p + 3 * i + 12)), 1);
+    v = _mm256_srai_epi32(_mm256_shuffle_epi8(v, spread), 8);
+    _mm256_storeu_si256((__m256i *)(p + 4 * i), v);
+  }
+}
+
+/*
+ * Packing in place goes forwards.  Each eight samples become 24
+ * bytes, written as two overlapping 16-byte stores.  The second
+ * store spills four bytes into the next packed sample's place, which
+ * is fine: the input is well past there, and that sample will be
+ * written over it later.
+ */
+TARGET_AVX2
+static void
+pack24_avx2(void *buf, int n)
+{
+  const __m256i gather = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+					  10, 12, 13, 14, -1, -1, -1, -1,
+					  0, 1, 2, 4, 5, 6, 8, 9,
+					  10, 12, 13, 14, -1, -1, -1, -1);
+  uint8_t *p = (uint8_t *)buf;
+  __m256i v;
+  int i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    v = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *)(p + 4 * i)),
+			    gather);
+    _mm_storeu_si128((__m128i *)(p + 3 * i), _mm256_castsi256_si128(v));
+    _mm_storeu_si128((__m128i *)(p + 3 * i + 12),
+		     _mm256_extracti128_si256(v, 1));
+  }
+  pack24_c(buf, i, n);
+}
+
+/*
+ * The filters can't be vectorized along the samples, since each
+ * output depends on the last, but the channels are independent, so
+ * we run them two at a time.  The arithmetic is done in the same
+ * order as in biquad_range_c(), so the results are the same.
+ */
+TARGET_SSE2
+static void
+biquad_sumsq_sse2(const void *buf, int nframes, int channels, int width,
+		  double scale, struct biquad2 *f, double *sums)
+{
+  const __m128d b00 = _mm_set1_pd(f->b[0][0]), b01 = _mm_set1_pd(f->b[0][1]);
+  const __m128d b02 = _mm_set1_pd(f->b[0][2]), a01 = _mm_set1_pd(f->a[0][1]);
+  const __m128d a02 = _mm_set1_pd(f->a[0][2]), b10 = _mm_set1_pd(f->b[1][0]);
+  const __m128d b11 = _mm_set1_pd(f->b[1][1]), b12 = _mm_set1_pd(f->b[1][2]);
+  const __m128d a11 = _mm_set1_pd(f->a[1][1]), a12 = _mm_set1_pd(f->a[1][2]);
+  const __m128d vscale = _mm_set1_pd(scale);
+  __m128d x, y, z00, z01, z10, z11, sum;
+  double t[2];
+  int i, c, k;
+
+  for (c = 0; c + 2 <= channels; c += 2) {
+    z00 = _mm_loadu_pd(&f->z[0][0][c]);
+    z01 = _mm_loadu_pd(&f->z[0][1][c]);
+    z10 = _mm_loadu_pd(&f->z[1][0][c]);
+    z11 = _mm_loadu_pd(&f->z[1][1][c]);
+    sum = _mm_setzero_pd();
+    for (i = 0, k = c; i < nframes; i++, k += channels) {
+      x = _mm_set_pd((double)get_sample_k(buf, k + 1, width),
+		     (double)get_sample_k(buf, k, width));
+      x = _mm_mul_pd(x, vscale);
+      y = _mm_add_pd(_mm_mul_pd(b00, x), z00);
+      z00 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b01, x), _mm_mul_pd(a01, y)),
+		       z01);
+      z01 = _mm_sub_pd(_mm_mul_pd(b02, x), _mm_mul_pd(a02, y));
+      x = y;
+      y = _mm_add_pd(_mm_mul_pd(b10, x), z10);
+      z10 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b11, x), _mm_mul_pd(a11, y)),
+		       z11);
+      z11 = _mm_sub_pd(_mm_mul_pd(b12, x), _mm_mul_pd(a12, y));
+      sum = _mm_add_pd(sum, _mm_mul_pd(y, y));
+    }
+    _mm_storeu_pd(&f->z[0][0][c], z00);
+    _mm_storeu_pd(&f->z[0][1][c], z01);
+    _mm_storeu_pd(&f->z[1][0][c], z10);
+    _mm_storeu_pd(&f->z[1][1][c], z11);
+    _mm_storeu_pd(t, sum);
+    sums[c] += t[0];
+    sums[c + 1] += t[1];
+  }
+
+  /* an odd channel out */
+  biquad_range_c(buf, nframes, channels, width, scale, f, sums, c);
+}
+
+/*
+ * The true-peak filter, four outputs of each phase at a time.  The
+ * sums are formed in the same order as in truepeak_block_c(), so the
+ * results are the same.
+ */
+TARGET_SSE2
+static float
+truepeak_block_sse2(const float *x, int start, int n, float max)
+{
+  __m128 coef[TRUEPEAK_PHASES][TRUEPEAK_TAPS];
+  __m128 acc0, acc1, acc2, acc3, xk, vmax, sign;
+  float t[4];
+  int i, k, p;
+
+  for (p = 0; p < TRUEPEAK_PHASES; p++)
+    for (k = 0; k < TRUEPEAK_TAPS; k++)
+      coef[p][k] = _mm_set1_ps(truepeak_coefs[p][k]);
+  /* the phases get a register each, so the sums stay out of memory */
+  sign = _mm_set1_ps(-0.0f);
+  vmax = _mm_set1_ps(max);
+  for (i = start; i + 4 <= n; i += 4) {
+    acc0 = acc1 = acc2 = acc3 = _mm_setzero_ps();
+    for (k = 0; k < TRUEPEAK_TAPS; k++) {
+      xk = _mm_loadu_ps(x + i - k);
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(coef[0][k], xk));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(coef[1][k], xk));
+      acc2 = _mm_add_ps(acc2, _mm_mul_ps(coef[2][k], xk));
+      acc3 = _mm_add_ps(acc3, _mm_mul_ps(coef[3][k], xk));
+    }
+    vmax = _mm_max_ps(vmax, _mm_andnot_ps(sign, acc0));
+    vmax = _mm_max_ps(vmax, _mm_andnot_ps(sign, acc1));
+    vmax = _mm_max_ps(vmax, _mm_andnot_ps(sign, acc2));
+    vmax = _mm_max_ps(vmax, _mm_andnot_ps(sign, acc3));
+  }
+  _mm_storeu_ps(t, vmax);
+  for (k = 0; k < 4; k++)
+    if (t[k] > max)
+      max = t[k];
+  return truepeak_block_c(x, i, n, max);
+}
+
+/* the same, eight outputs at a time */
+TARGET_AVX2
+static float
+truepeak_block_avx2(const float *x, int start, int n, float max)
+{
+  __m256 coef[TRUEPEAK_PHASES][TRUEPEAK_TAPS];
+  __m256 acc0, acc1, acc2, acc3, xk, vmax, sign;
+  float t[8];
+  int i, k, p;
+
+  for (p = 0; p < TRUEPEAK_PHASES; p++)
+    for (k = 0; k < TRUEPEAK_TAPS; k++)
+      coef[p][k] = _mm256_set1_ps(truepeak_coefs[p][k]);
+  /* the phases get a register each, so the sums stay out of memory */
+  sign = _mm256_set1_ps(-0.0f);
+  vmax = _mm256_set1_ps(max);
+  for (i = start; i + 8 <= n; i += 8) {
+    acc0 = acc1 = acc2 = acc3 = _mm256_setzero_ps();
+    for (k = 0; k < TRUEPEAK_TAPS; k++) {
+      xk = _mm256_loadu_ps(x + i - k);
+      acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(coef[0][k], xk));
+      acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(coef[1][k], xk));
+      acc2 = _mm256_add_ps(acc2, _mm256_mul_ps(coef[2][k], xk));
+      acc3 = _mm256_add_ps(acc3, _mm256_mul_ps(coef[3][k], xk));
+    }
+    vmax = _mm256_max_ps(vmax, _mm256_andnot_ps(sign, acc0));
+    vmax = _mm256_max_ps(vmax, _mm256_andnot_ps(sign, acc1));
+    vmax = _mm256_max_ps(vmax, _mm256_andnot_ps(sign, acc2));
+    vmax = _mm256_max_ps(vmax, _mm256_andnot_ps(sign, acc3));
+  }
+  _mm256_storeu_ps(t, vmax);
+  for (k = 0; k < 8; k++)
+    if (t[k] > max)
+      max = t[k];
+  return truepeak_block_c(x, i, n, max);
+}
+
+#endif /* X86_KERNELS */
+
+
+/*
+ * Dispatch.  kernels_init() looks at the processor once, at startup,
+ * and the entry points below call the best version it found.
+ */
+
+enum { ISA_GENERIC, ISA_SSE2, ISA_AVX2 };
+
+static int isa = ISA_GENERIC;
+static const char *isa_names[] = { "generic", "SSE2", "AVX2" };
+
+void
+kernels_init(void)
+{
+#if X86_KERNELS
+  unsigned int eax, ebx, ecx, edx, xcr0, xcr0_hi;
+#endif
+
+  tanh_table_init();
+
+#if X86_KERNELS
+  isa = ISA_GENERIC;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return;
+  if (edx & bit_SSE2)
+    isa = ISA_SSE2;
+
+  /* AVX2 is only any use if the OS saves the ymm registers for us */
+  if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)
+      && __get_cpuid_max(0, NULL) >= 7) {
+    __asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0_hi) : "c" (0));
+    if ((xcr0 & 6) == 6) {
+      __cpuid_count(7, 0, eax, ebx, ecx, edx);
+      if (ebx & bit_AVX2)
+	isa = ISA_AVX2;
+    }
+  }
+#endif
+}
+
+const char *
+kernels_isa(void)
+{
+  return isa_names[isa];
+}
+
+void
+scan_samples(const void *buf, int nframes, int channels,
+	     int bytes_per_sample, struct sumsq *sums, long *pmax, long *pmin)
+{
+  int width;
+
+  /* 24-bit samples come to us in 32 bits */
+  width = bytes_per_sample == 3 ? 4 : bytes_per_sample;
+  memset(sums, 0, channels * sizeof(struct sumsq));
+
+#if X86_KERNELS
+  if (isa >= ISA_AVX2 && BLOCK_AVX2 % channels == 0) {
+    scan_samples_avx2(buf, nframes * channels, channels, width,
+		      sums, pmax, pmin);
+    return;
+  }
+  if (isa >= ISA_SSE2 && BLOCK_SSE2 % channels == 0) {
+    scan_samples_sse2(buf, nframes * channels, channels, width,
+		      sums, pmax, pmin);
+    return;
+  }
+#endif
+  scan_range_c(buf, 0, nframes * channels, channels, width,
+	       sums, pmax, pmin);
+}
+
+void
+histogram_samples(const void *buf, int n, int bytes_per_sample,
+		  int shift, uint64_t *hist)
+{
+  const int8_t *p8;
+  const int16_t *p16;
+  const int32_t *p32;
+  int i;
+
+  switch (bytes_per_sample) {
+  case 1:
+    p8 = (const int8_t *)buf;
+    for (i = 0; i < n; i++)
+      hist[p8[i]]++;
+    break;
+  case 2:
+    p16 = (const int16_t *)buf;
+    for (i = 0; i < n; i++)
+      hist[p16[i]]++;
+    break;
+  default:
+    /* 24-bit samples come to us in 32 bits */
+    p32 = (const int32_t *)buf;
+    for (i = 0; i < n; i++)
+      hist[p32[i] >> shift]++;
+    break;
+  }
+}
+
+/*
+ * Samples in a file's own format go through the kernels that apply
+ * gain a tile at a time: each tile is unpacked into a buffer small
+ * enough to stay in the cache, the kernel is run on that, and what it
+ * gives is packed straight into dst.  Either side that's already in
+ * the normal format is used where it is.
+ */
+#define TILE_SAMPLES 2048
+
+/* the number of bytes each sample of the given format takes */
+static int
+sample_size(int format)
+{
+  int bytes = format & ~SAMPLES_LAYOUT;
+
+  if (bytes == 3 && !(format & SAMPLES_PACKED))
+    return 4;
+  return bytes;
+}
+
+struct tiles {
+  const uint8_t *src;
+  uint8_t *dst;
+  int src_format, dst_format;
+  int src_bytes, dst_bytes; /* the normal formats, for the kernel */
+  int n, done, count;       /* count is the size of the current tile */
+  const void *in;           /* the current tile, and where it goes */
+  void *out;
+  int32_t in_buf[TILE_SAMPLES];
+  int32_t out_buf[TILE_SAMPLES];
+};
+
+static void
+tiles_init(struct tiles *t, const void *src, int src_format,
+	   void *dst, int dst_format, int n)
+{
+  t->src = (const uint8_t *)src;
+  t->dst = (uint8_t *)dst;
+  t->src_format = src_format;
+  t->dst_format = dst_format;
+  t->src_bytes = src_format & ~SAMPLES_LAYOUT;
+  t->dst_bytes = dst_format & ~SAMPLES_LAYOUT;
+  t->n = n;
+  t->done = t->count = 0;
+  t->out = NULL;
+}
+
+/*
+ * Copy n samples of the given format into dst, converting them to the
+ * normal one.  pack_samples() does the reverse, changing src as it
+ * goes.
+ */
+static void
+unpack_samples(const void *src, int format, void *dst, int n)
+{
+  int bytes = format & ~SAMPLES_LAYOUT;
+
+  memcpy(dst, src, (size_t)n * sample_size(format));
+  if (format & SAMPLES_SWAPPED)
+    swap_bytes(dst, n, sample_size(format));
+  if (format & SAMPLES_UNSIGNED)
+    flip_sign8(dst, n);
+  if (bytes == 3 && (format & SAMPLES_PACKED))
+    expand24(dst, n);
+}
+
+static void
+pack_samples(void *src, void *dst, int format, int n)
+{
+  int bytes = format & ~SAMPLES_LAYOUT;
+
+  if (bytes == 3 && (format & SAMPLES_PACKED))
+    pack24(src, n);
+  if (format & SAMPLES_UNSIGNED)
+    flip_sign8(src, n);
+  if (format & SAMPLES_SWAPPED)
+    swap_bytes(src, n, sample_size(format));
+  memcpy(dst, src, (size_t)n * sample_size(format));
+}
+
+/* finish the current tile and set up the next; FALSE if there's none */
+static int
+next_tile(struct tiles *t)
+{
+  const uint8_t *src;
+  uint8_t *dst;
+
+  if (t->out == t->out_buf)
+    pack_samples(t->out_buf, t->dst + (size_t)t->done
+		 * sample_size(t->dst_format), t->dst_format, t->count);
+  t->done += t->count;
+  if (t->done >= t->n)
+    return FALSE;
+
+  t->count = t->n - t->done;
+  if (t->count > TILE_SAMPLES)
+    t->count = TILE_SAMPLES;
+  src = t->src + (size_t)t->done * sample_size(t->src_format);
+  dst = t->dst + (size_t)t->done * sample_size(t->dst_format);
+  if (t->src_format & SAMPLES_LAYOUT) {
+    unpack_samples(src, t->src_format, t->in_buf, t->count);
+    t->in = t->in_buf;
+  } else {
+    t->in = src;
+  }
+  t->out = (t->dst_format & SAMPLES_LAYOUT) ? (void *)t->out_buf : dst;
+  return TRUE;
+}
+
+unsigned int
+lut_samples(const void *src, int src_bytes_per_sample,
+	    void *dst, int dst_bytes_per_sample, int n, const int32_t *lut,
+	    long min_pos_clipped, long max_neg_clipped)
+{
+  struct tiles t;
+  unsigned int nclipped = 0;
+  int src_width, dst_width;
+
+  if ((src_bytes_per_sample | dst_bytes_per_sample) & SAMPLES_LAYOUT) {
+    tiles_init(&t, src, src_bytes_per_sample, dst, dst_bytes_per_sample, n);
+    while (next_tile(&t))
+      nclipped += lut_samples(t.in, t.src_bytes, t.out, t.dst_bytes,
+			      t.count, lut, min_pos_clipped, max_neg_clipped);
+    return nclipped;
+  }
+
+  src_width = src_bytes_per_sample == 3 ? 4 : src_bytes_per_sample;
+  dst_width = dst_bytes_per_sample == 3 ? 4 : dst_bytes_per_sample;
+#if X86_KERNELS
+  if (isa >= ISA_AVX2)
+    return lut_samples_avx2(src, src_width, dst, dst_width, n, lut,
+			    min_pos_clipped, max_neg_clipped);
+#endif
+  return lut_range_c(src, src_width, dst, dst_width, 0, n, lut,
+		     min_pos_clipped, max_neg_clipped);
+}
+
+unsigned int
+gain_samples(const void *src, int src_bytes_per_sample,
+	     void *dst, int dst_bytes_per_sample, int n, double gain,
+	     long dst_max, long dst_min, int clip)
+{
+  struct fixed_gain fg;
+  struct tiles t;
+  unsigned int nclipped = 0;
+  int src_width, dst_width;
+
+  if ((src_bytes_per_sample | dst_bytes_per_sample) & SAMPLES_LAYOUT) {
+    tiles_init(&t, src, src_bytes_per_sample, dst, dst_bytes_per_sample, n);
+    while (next_tile(&t))
+      nclipped += gain_samples(t.in, t.src_bytes, t.out, t.dst_bytes,
+			       t.count, gain, dst_max, dst_min, clip);
+    return nclipped;
+  }
+
+  src_width = src_bytes_per_sample == 3 ? 4 : src_bytes_per_sample;
+  dst_width = dst_bytes_per_sample == 3 ? 4 : dst_bytes_per_sample;
+  if (fixed_gain_init(&fg, gain, src_bytes_per_sample * 8,
+		      dst_max, dst_min)) {
+#if X86_KERNELS
+    if (isa >= ISA_AVX2)
+      return fixed_samples_avx2(src, src_width, dst, dst_width, n, &fg,
+				dst_max, dst_min, clip);
+#endif
+    return fixed_range_c(src, src_width, dst, dst_width, 0, n, &fg,
+			 dst_max, dst_min, clip);
+  }
+#if X86_KERNELS
+  if (isa >= ISA_AVX2)
+    return gain_samples_avx2(src, src_width, dst, dst_width, n, gain,
+			     dst_max, dst_min, clip);
+#endif
+  return gain_range_c(src, src_width, dst, dst_width, 0, n, gain,
+		      dst_max, dst_min, clip);
+}
+
+void
+limit_samples(const void *src, int src_bytes_per_sample,
+	      void *dst, int dst_bytes_per_sample, int n, double gain,
+	      long dst_max, double (*shape)(double))
+{
+  struct tiles t;
+  int src_width, dst_width;
+
+  if ((src_bytes_per_sample | dst_bytes_per_sample) & SAMPLES_LAYOUT) {
+    tiles_init(&t, src, src_bytes_per_sample, dst, dst_bytes_per_sample, n);
+    while (next_tile(&t))
+      limit_samples(t.in, t.src_bytes, t.out, t.dst_bytes, t.count, gain,
+		    dst_max, shape);
+    return;
+  }
+
+  src_width = src_bytes_per_sample == 3 ? 4 : src_bytes_per_sample;
+  dst_width = dst_bytes_per_sample == 3 ? 4 : dst_bytes_per_sample;
+  limit_range_c(src, src_width, dst, dst_width, n, gain, dst_max, shape);
+}
+
+void
+softlimit_samples(const void *src, int src_bytes_per_sample,
+		  void *dst, int dst_bytes_per_sample, int n, double gain,
+		  long dst_max, double level)
+{
+  struct tiles t;
+  int src_width, dst_width;
+
+  if ((src_bytes_per_sample | dst_bytes_per_sample) & SAMPLES_LAYOUT) {
+    tiles_init(&t, src, src_bytes_per_sample, dst, dst_bytes_per_sample, n);
+    while (next_tile(&t))
+      softlimit_samples(t.in, t.src_bytes, t.out, t.dst_bytes, t.count,
+			gain, dst_max, level);
+    return;
+  }
+
+  src_width = src_bytes_per_sample == 3 ? 4 : src_bytes_per_sample;
+  dst_width = dst_bytes_per_sample == 3 ? 4 : dst_bytes_per_sample;
+#if X86_KERNELS
+  if (isa >= ISA_AVX2) {
+    softlimit_samples_avx2(src, src_width, dst, dst_width, n, gain,
+			   dst_max, level);
+    return;
+  }
+#endif
+  softlimit_range_c(src, src_width, dst, dst_width, 0, n, gain, dst_max,
+		    level);
+}
+
+void
+flip_sign8(void *buf, int n)
+{
+#if X86_KERNELS
+  if (isa >= ISA_AVX2) {
+    flip_sign8_avx2(buf, n);
+    return;
+  }
+  if (isa >= ISA_SSE2) {
+    flip_sign8_sse2(buf, n);
+    return;
+  }
+#endif
+  flip_sign8_c(buf, n);
+}
+
+void
+swap_bytes(void *buf, int n, int size)
+{
+#if X86_KERNELS
+  if (isa >= ISA_AVX2 && (size == 2 || size == 4)) {
+    swap_bytes_avx2(buf, n, size);
+    return;
+  }
+#endif
+  swap_bytes_c(buf, 0, n, size);
+}
+
+void
+expand24(void *buf, int n)
+{
+#if X86_KERNELS
+  if (isa >= ISA_AVX2) {
+    expand24_avx2(buf, n);
+    return;
+  }
+#endif
+  expand24_c(buf, 0, n);
+}
+
+void
+pack24(void *buf, int n)
+{
+#if X86_KERNELS
+  if (isa >= ISA_AVX2) {
+    pack24_avx2(buf, n);
+    return;
+  }
+#endif
+  pack24_c(buf, 0, n);
+}
+
+void
+biquad_sumsq(const void *buf, int nframes, int channels,
+	     int bytes_per_sample, double scale, struct biquad2 *f,
+	     double *sums)
+{
+  int width;
+
+  width = bytes_per_sample == 3 ? 4 : bytes_per_sample;
+#if X86_KERNELS
+  if (isa >= ISA_SSE2) {
+    biquad_sumsq_sse2(buf, nframes, channels, width, scale, f, sums);
+    return;
+  }
+#endif
+  biquad_range_c(buf, nframes, channels, width, scale, f, sums, 0);
+}
+
+void
+truepeak_samples(const void *buf, int nframes, int channels,
+		 int bytes_per_sample, float scale, struct truepeak *tp)
+{
+  int width;
+
+  width = bytes_per_sample == 3 ? 4 : bytes_per_sample;
+#if X86_KERNELS
+  if (isa >= ISA_AVX2) {
+    truepeak_run(buf, nframes, channels, width, scale, tp,
+		 truepeak_block_avx2);
+    return;
+  }
+  if (isa >= ISA_SSE2) {
+    truepeak_run(buf, nframes, channels, width, scale, tp,
+		 truepeak_block_sse2);
+    return;
+  }
+#endif
+  truepeak_run(buf, nframes, channels, width, scale, tp, truepeak_block_c);
+}
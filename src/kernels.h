@@ -0,0 +1,194 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * The inner loops that touch every sample, with vectorized versions
+ * where the processor supports them.
+ */
+
+#ifndef _KERNELS_H_
+#define _KERNELS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Samples are normally passed to the kernels as twos complement, in
+ * host byte order, with 24-bit samples in 32 bits, and described by
+ * their number of bytes.  The kernels that apply gain also take
+ * samples just as they are in a file, described by the number of
+ * bytes or-ed with these, so they needn't be converted on the way in
+ * and out.
+ */
+#define SAMPLES_UNSIGNED 0x100  /* 8-bit samples offset by 128, as in WAV */
+#define SAMPLES_PACKED   0x200  /* 24-bit samples in three bytes */
+#define SAMPLES_SWAPPED  0x400  /* the other byte order from the host's */
+#define SAMPLES_LAYOUT   (SAMPLES_UNSIGNED | SAMPLES_PACKED | SAMPLES_SWAPPED)
+
+/*
+ * The sum of the squares of a run of samples, kept exactly.  Each
+ * sample's magnitude u is split as u = a * 2^16 + b, and we keep the
+ * sums of a*a, a*b, and b*b separately, so nothing can overflow and
+ * the result doesn't depend on the order the samples were added in.
+ * For 8- and 16-bit samples, a is always zero.
+ */
+struct sumsq {
+  uint64_t aa;
+  uint64_t ab;
+  uint64_t bb;
+};
+
+/* the value of a sum of squares, as a double */
+double sumsq_value(const struct sumsq *s);
+
+/*
+ * Scan nframes frames of interleaved samples, in the format the file
+ * reader gives us: one or two bytes per sample for 8- and 16-bit
+ * files, four bytes for 24- and 32-bit files.  The sum of squares of
+ * each channel's samples is stored in sums[channel], and *pmax and
+ * *pmin are updated with the largest and smallest samples seen.
+ */
+void scan_samples(const void *buf, int nframes, int channels,
+		  int bytes_per_sample, struct sumsq *sums,
+		  long *pmax, long *pmin);
+
+/*
+ * Count n samples by value: hist[v >> shift] is incremented for each
+ * sample v.  hist must point to the middle of the histogram, so it
+ * can be indexed by negative values.
+ */
+void histogram_samples(const void *buf, int n, int bytes_per_sample,
+		       int shift, uint64_t *hist);
+
+/*
+ * Apply gain to n samples from src, storing them in dst, via the
+ * lookup table lut (indexed by sample value; src must be 8 or 16
+ * bits).  Returns the number of samples at or above min_pos_clipped
+ * or at or below max_neg_clipped.
+ */
+unsigned int lut_samples(const void *src, int src_bytes_per_sample,
+			 void *dst, int dst_bytes_per_sample, int n,
+			 const int32_t *lut,
+			 long min_pos_clipped, long max_neg_clipped);
+
+/*
+ * Multiply n samples from src by gain and round, storing them in dst.
+ * If clip is set, results outside [dst_min, dst_max] are clipped, and
+ * the number clipped is returned.  Gains that are a small integer over
+ * a power of two are done in fixed point, with the same results.
+ */
+unsigned int gain_samples(const void *src, int src_bytes_per_sample,
+			  void *dst, int dst_bytes_per_sample, int n,
+			  double gain, long dst_max, long dst_min, int clip);
+
+/*
+ * Multiply n samples from src by gain, and instead of clipping, run
+ * them through shape, a function that squeezes [-inf, inf] into
+ * [-1, 1]: each sample x becomes dst_max * shape(x * gain / dst_max),
+ * rounded.
+ */
+void limit_samples(const void *src, int src_bytes_per_sample,
+		   void *dst, int dst_bytes_per_sample, int n, double gain,
+		   long dst_max, double (*shape)(double));
+
+/*
+ * limit_samples() with the limiter curve of adjust.c, which leaves
+ * magnitudes up to level alone and squeezes the rest with tanh(), and
+ * with tanh() replaced by an interpolated table.  The curve is within
+ * 4e-11 of full scale of the exact one, so the samples are within one
+ * step of those the exact curve gives, even at 32 bits, and are
+ * almost always the same.
+ */
+void softlimit_samples(const void *src, int src_bytes_per_sample,
+		       void *dst, int dst_bytes_per_sample, int n, double gain,
+		       long dst_max, double level);
+
+/* convert n 8-bit samples between unsigned and two's complement */
+void flip_sign8(void *buf, int n);
+
+/* reverse the bytes of each of n samples of size bytes each */
+void swap_bytes(void *buf, int n, int size);
+
+/*
+ * Convert n packed 24-bit samples to sign-extended 32-bit ones, in
+ * place; the buffer must have room for 4 * n bytes.  pack24() does
+ * the reverse.
+ */
+void expand24(void *buf, int n);
+void pack24(void *buf, int n);
+
+/*
+ * Two biquad filters in series, in transposed direct form II, with
+ * a[0] taken to be 1.  The filter state of each channel is kept in z
+ * between calls.
+ */
+#define BIQUAD_CHANNELS 8       /* the most channels we can filter */
+
+struct biquad2 {
+  double b[2][3];
+  double a[2][3];
+  double z[2][2][BIQUAD_CHANNELS];  /* z[stage][delay][channel] */
+};
+
+/*
+ * Run nframes frames of interleaved samples, in the format
+ * scan_samples() takes, through f, multiplying each by scale first,
+ * and add the sum of the squares of each channel's output to
+ * sums[channel].  There must be no more than BIQUAD_CHANNELS channels.
+ */
+void biquad_sumsq(const void *buf, int nframes, int channels,
+		  int bytes_per_sample, double scale, struct biquad2 *f,
+		  double *sums);
+
+/*
+ * A true-peak meter, as in ITU-R BS.1770 annex 2: the samples are
+ * oversampled 4 times with a 48-tap polyphase FIR filter, and the
+ * largest magnitude of the result is kept.  The last few samples of
+ * each channel are kept in hist between calls.
+ */
+#define TRUEPEAK_PHASES 4
+#define TRUEPEAK_TAPS 12        /* taps per phase */
+#define TRUEPEAK_CHANNELS 8     /* the most channels we can meter */
+
+struct truepeak {
+  float hist[TRUEPEAK_CHANNELS][TRUEPEAK_TAPS - 1];  /* oldest first */
+  float max;                /* the largest magnitude so far */
+};
+
+/*
+ * Run nframes frames of interleaved samples, in the format
+ * scan_samples() takes, through tp, multiplying each by scale first.
+ * There must be no more than TRUEPEAK_CHANNELS channels.
+ */
+void truepeak_samples(const void *buf, int nframes, int channels,
+		      int bytes_per_sample, float scale, struct truepeak *tp);
+
+/*
+ * Pick the best versions of the kernels for this processor.  Call
+ * once, before using any of them.
+ */
+void kernels_init(void);
+
+/* the name of the instruction set kernels_init() picked */
+const char *kernels_isa(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _KERNELS_H_ */
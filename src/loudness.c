@@ -0,0 +1,289 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+#include "config.h"
+
+#include <stdio.h>
+#if STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#else
+# if HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+# if HAVE_STRING_H
+#  include <string.h>
+# endif
+#endif
+#if HAVE_MATH_H
+# include <math.h>
+#endif
+
+#include "common.h"
+#include "kernels.h"
+#include "loudness.h"
+
+extern void *xmalloc(size_t size);
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * Block loudnesses are counted in bins of HIST_STEP LU, from the
+ * absolute gate at -70 LUFS up to HIST_TOP.  Each bin also keeps the
+ * sum of the powers of its blocks, so the gated mean is exact except
+ * for the blocks in the one bin the relative gate falls in.
+ */
+#define ABSOLUTE_GATE -70.0
+#define RELATIVE_GATE -10.0
+#define HIST_STEP 0.01
+#define HIST_TOP 30.0
+#define HIST_BINS ((int)((HIST_TOP - ABSOLUTE_GATE) / HIST_STEP))
+
+struct loudness {
+  int channels;
+  double scale;                 /* to get samples in [-1, 1) */
+  double weight[BIQUAD_CHANNELS];
+  struct biquad2 filter;
+
+  /*
+   * Blocks are 400 ms long and start every 100 ms, so we keep the
+   * weighted power of each 100 ms quarter, and add up the last four.
+   */
+  unsigned int quarter_len;     /* frames in a quarter */
+  unsigned int quarter_left;    /* frames still to go in this one */
+  double sums[BIQUAD_CHANNELS]; /* this quarter's sums of squares */
+  double quarters[4];
+  int nquarters;                /* quarters done, up to four */
+
+  uint64_t *hist_count;
+  double *hist_power;
+};
+
+static double
+power_to_lufs(double power)
+{
+  return -0.691 + 10.0 * log10(power);
+}
+
+static double
+lufs_to_power(double lufs)
+{
+  return pow(10.0, (lufs + 0.691) / 10.0);
+}
+
+/*
+ * Set up the K-weighting filter for the sample rate: a high shelf
+ * modelling the head, then a high-pass.  These are the BS.1770
+ * filters, recomputed for rates other than 48 kHz.
+ */
+static void
+init_k_filter(struct biquad2 *f, unsigned int rate)
+{
+  double f0, gain, q, k, vh, vb, a0;
+
+  memset(f, 0, sizeof(*f));
+
+  f0 = 1681.974450955533;
+  gain = 3.999843853973347;
+  q = 0.7071752369554196;
+  k = tan(M_PI * f0 / rate);
+  vh = pow(10.0, gain / 20.0);
+  vb = pow(vh, 0.4996667741545416);
+  a0 = 1.0 + k / q + k * k;
+  f->b[0][0] = (vh + vb * k / q + k * k) / a0;
+  f->b[0][1] = 2.0 * (k * k - vh) / a0;
+  f->b[0][2] = (vh - vb * k / q + k * k) / a0;
+  f->a[0][0] = 1.0;
+  f->a[0][1] = 2.0 * (k * k - 1.0) / a0;
+  f->a[0][2] = (1.0 - k / q + k * k) / a0;
+
+  f0 = 38.13547087602444;
+  q = 0.5003270373238773;
+  k = tan(M_PI * f0 / rate);
+  a0 = 1.0 + k / q + k * k;
+  f->b[1][0] = 1.0;
+  f->b[1][1] = -2.0;
+  f->b[1][2] = 1.0;
+  f->a[1][0] = 1.0;
+  f->a[1][1] = 2.0 * (k * k - 1.0) / a0;
+  f->a[1][2] = (1.0 - k / q + k * k) / a0;
+}
+
+struct loudness *
+loudness_new(int channels, unsigned int rate, int bits_per_sample)
+{
+  struct loudness *l;
+  int c, bytes;
+
+  if (channels < 1 || channels > BIQUAD_CHANNELS || rate < 10)
+    return NULL;
+
+  l = (struct loudness *)xmalloc(sizeof(struct loudness));
+  memset(l, 0, sizeof(struct loudness));
+  l->channels = channels;
+  bytes = (bits_per_sample - 1) / 8 + 1;
+  l->scale = 1.0 / ldexp(1.0, bytes * 8 - 1);
+
+  /*
+   * The surround channels of a 5.1 file count for more, and the LFE
+   * channel doesn't count at all.  Any other layout is weighted
+   * evenly.
+   */
+  for (c = 0; c < channels; c++)
+    l->weight[c] = 1.0;
+  if (channels == 6) {
+    l->weight[3] = 0.0;
+    l->weight[4] = l->weight[5] = 1.41;
+  }
+
+  init_k_filter(&l->filter, rate);
+
+  l->quarter_len = rate / 10;
+  l->quarter_left = l->quarter_len;
+
+  l->hist_count = (uint64_t *)xmalloc(HIST_BINS * sizeof(uint64_t));
+  l->hist_power = (double *)xmalloc(HIST_BINS * sizeof(double));
+  memset(l->hist_count, 0, HIST_BINS * sizeof(uint64_t));
+  memset(l->hist_power, 0, HIST_BINS * sizeof(double));
+
+  return l;
+}
+
+/* finish off a 100 ms quarter, and count the block it completes */
+static void
+end_quarter(struct loudness *l)
+{
+  double power, lufs;
+  int c, b;
+
+  power = 0;
+  for (c = 0; c < l->channels; c++) {
+    power += l->weight[c] * l->sums[c];
+    l->sums[c] = 0;
+  }
+  memmove(l->quarters, l->quarters + 1, 3 * sizeof(double));
+  l->quarters[3] = power / l->quarter_len;
+  if (l->nquarters < 4)
+    l->nquarters++;
+  if (l->nquarters < 4)
+    return;
+
+  power = (l->quarters[0] + l->quarters[1]
+	   + l->quarters[2] + l->quarters[3]) / 4.0;
+  if (power <= 0)
+    return;
+  lufs = power_to_lufs(power);
+  if (lufs <= ABSOLUTE_GATE)
+    return;
+  b = (int)((lufs - ABSOLUTE_GATE) / HIST_STEP);
+  if (b >= HIST_BINS)
+    b = HIST_BINS - 1;
+  l->hist_count[b]++;
+  l->hist_power[b] += power;
+}
+
+void
+loudness_add(struct loudness *l, const void *buf, int nframes,
+	     int bytes_per_sample)
+{
+  const unsigned char *p = (const unsigned char *)buf;
+  int framesz, n;
+
+  framesz = l->channels * (bytes_per_sample == 3 ? 4 : bytes_per_sample);
+  while (nframes > 0) {
+    n = nframes;
+    if ((unsigned int)n > l->quarter_left)
+      n = l->quarter_left;
+    biquad_sumsq(p, n, l->channels, bytes_per_sample, l->scale,
+		 &l->filter, l->sums);
+    p += n * framesz;
+    nframes -= n;
+    l->quarter_left -= n;
+    if (l->quarter_left == 0) {
+      end_quarter(l);
+      l->quarter_left = l->quarter_len;
+    }
+  }
+}
+
+double
+loudness_integrated(const struct loudness *l)
+{
+  double power, gate;
+  uint64_t count;
+  int b, first;
+
+  /* the mean of the blocks above the absolute gate... */
+  power = 0;
+  count = 0;
+  for (b = 0; b < HIST_BINS; b++) {
+    power += l->hist_power[b];
+    count += l->hist_count[b];
+  }
+  if (count == 0)
+    return -HUGE_VAL;
+
+  /* ...sets the relative gate */
+  gate = power_to_lufs(power / count) + RELATIVE_GATE;
+  first = 0;
+  if (gate > ABSOLUTE_GATE)
+    first = (int)((gate - ABSOLUTE_GATE) / HIST_STEP);
+  if (first >= HIST_BINS)
+    first = HIST_BINS - 1;
+
+  /*
+   * The bin the gate falls in may hold blocks either side of it; we
+   * go by the mean of the bin.
+   */
+  if (l->hist_count[first] > 0
+      && l->hist_power[first] / l->hist_count[first] < lufs_to_power(gate))
+    first++;
+
+  power = 0;
+  count = 0;
+  for (b = first; b < HIST_BINS; b++) {
+    power += l->hist_power[b];
+    count += l->hist_count[b];
+  }
+  if (count == 0)
+    return -HUGE_VAL;
+
+  return power_to_lufs(power / count);
+}
+
+double
+loudness_level(const struct loudness *l)
+{
+  double lufs;
+
+  lufs = loudness_integrated(l);
+  if (lufs == -HUGE_VAL)
+    return 0.0;
+  return pow(10.0, lufs / 20.0);
+}
+
+void
+loudness_free(struct loudness *l)
+{
+  if (l == NULL)
+    return;
+  free(l->hist_count);
+  free(l->hist_power);
+  free(l);
+}
@@ -0,0 +1,67 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * Integrated loudness, as ITU-R BS.1770 (and EBU R128) define it:
+ * K-weighted power over 400 ms blocks, gated to leave out silence and
+ * quiet passages.  The gating only needs a histogram of the block
+ * loudnesses, so memory use doesn't grow with the length of the audio.
+ */
+
+#ifndef _LOUDNESS_H_
+#define _LOUDNESS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct loudness;
+
+/*
+ * Start measuring audio with the given number of channels, sample
+ * rate, and bits per sample.  Returns NULL if the format can't be
+ * measured.
+ */
+struct loudness *loudness_new(int channels, unsigned int rate,
+			      int bits_per_sample);
+
+/*
+ * Measure nframes more frames of interleaved samples, in the format
+ * scan_samples() takes.
+ */
+void loudness_add(struct loudness *l, const void *buf, int nframes,
+		  int bytes_per_sample);
+
+/*
+ * The integrated loudness of everything measured, in LUFS, or
+ * -HUGE_VAL if no block was loud enough to count.
+ */
+double loudness_integrated(const struct loudness *l);
+
+/*
+ * The integrated loudness as a level, the way we keep levels
+ * elsewhere: 10^(LUFS/20), or 0 if no block was loud enough to count.
+ */
+double loudness_level(const struct loudness *l);
+
+void loudness_free(struct loudness *l);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LOUDNESS_H_ */
@@ -60,6 +60,10 @@
 #include <mad.h>
 
 #include "common.h"
+#include "jobs.h"
+#include "kernels.h"
+#include "smooth.h"
+#include "loudness.h"
 
 extern void progress_callback(char *prefix, float fraction_completed);
 extern char *basename(char *path);
@@ -67,19 +71,15 @@ extern void *xmalloc(size_t size);
 
 extern char *progname;
 extern int verbose;
+extern int smooth_filter;
+extern int use_lufs;
+extern int true_peak_meter;
 
 #define MPEG_BUFSZ 40000
 #define samplemax 32767
 #define samplemin -32768
 #define bytes_per_sample 2
 
-typedef struct {
-  double *buf;
-  int buflen;  /* elements allocated to buffer */
-  int start;   /* index of first element in buffer */
-  int n;       /* num of elements in buffer */
-} datasmooth_t;
-
 struct decode_struct {
   FILE *in;
   unsigned char buffer[MPEG_BUFSZ + MAD_BUFFER_GUARD];
@@ -91,11 +91,19 @@ struct decode_struct {
 
   double sums[2];
   double maxpow;
-  datasmooth_t powsmooth[2];
+  struct smoother powsmooth[2];
+
+  /* the decoded frame, for the meters that want whole frames */
+  int16_t frame_buf[2 * 1152];
+  struct truepeak tp;
+  struct loudness *loudness;  /* with --loudness=lufs, or NULL */
+  int loudness_channels;
+  int loudness_rate;
 
   unsigned int windowsz;
   unsigned int samples_so_far;
 
+  int show_progress;
   float last_progress;
   char prefix_buf[18];
 };
@@ -104,48 +112,20 @@ static enum mad_flow decode_input(void *, struct mad_stream *);
 static enum mad_flow decode_output(void *, struct mad_header const *, struct mad_pcm *);
 static enum mad_flow decode_error(void *, struct mad_stream *, struct mad_frame *);
 
-/*
- * Takes a full smoothing window, and returns the value of the center
- * element, smoothed.  Currently, just does a mean filter, but we could
- * do a median or gaussian filter here instead.
- */
-static inline double
-get_smoothed_data(datasmooth_t *s)
-{
-  int i;
-  /*int center = (s->n + 1) / 2;*/
-  double smoothed;
-
-  smoothed = 0;
-  for (i = 0; i < s->n; i++)
-    smoothed += s->buf[i];
-  smoothed = smoothed / s->n;
-
-  return smoothed;
-}
-
-
 static void
 get_window_power(struct decode_struct *ds)
 {
   double pow;
-  int c, end;
+  int c;
 
   /* compute the power of the current window */
   for (c = 0; c < ds->si->channels; c++) {
     pow = ds->sums[c] / (double)ds->samples_so_far;
     ds->sums[c] = 0;
-    end = ((ds->powsmooth[c].start + ds->powsmooth[c].n)
-	   % ds->powsmooth[c].buflen);
-    ds->powsmooth[c].buf[end] = pow;
-    if (ds->powsmooth[c].n == ds->powsmooth[c].buflen) {
-      ds->powsmooth[c].start = ((ds->powsmooth[c].start + 1)
-				% ds->powsmooth[c].buflen);
-      pow = get_smoothed_data(&ds->powsmooth[c]);
+    if (smooth_push(&ds->powsmooth[c], pow)) {
+      pow = smooth_value(&ds->powsmooth[c]);
       if (pow > ds->maxpow)
 	ds->maxpow = pow;
-    } else {
-      ds->powsmooth[c].n++;
     }
   }
 
@@ -175,13 +155,22 @@ signal_max_power_mp3(char *filename, struct signal_info *si)
   ds.eof = 0;
   ds.windowsz = 0;
   ds.samples_so_far = 0;
+  ds.maxpow = 0.0;
+  ds.loudness = NULL;
+  memset(&ds.tp, 0, sizeof(ds.tp));
+  /* set up smoothing window buffer */
+  for (c = 0; c < 2; c++)
+    /* use a 100-element (1 second) window */
+    smooth_init(&ds.powsmooth[c], smooth_filter, 100,
+		samplemin * (double)samplemin);
   /* initialize peaks to effectively -inf and +inf */
   si->max_sample = samplemin;
   si->min_sample = samplemax;
 
 
-  /* initialize progress meter */
-  if (verbose >= VERBOSE_PROGRESS) {
+  /* initialize progress meter; a background job keeps quiet */
+  ds.show_progress = verbose >= VERBOSE_PROGRESS && !job_in_background();
+  if (ds.show_progress) {
     strncpy(ds.prefix_buf, basename(filename), 17);
     ds.prefix_buf[17] = '\0';
     progress_callback(ds.prefix_buf, 0.0);
@@ -211,19 +200,28 @@ signal_max_power_mp3(char *filename, struct signal_info *si)
   }
 
   /* cleanup */
-  for (c = 0; c < ds.si->channels; c++)
-    if (ds.powsmooth[c].buf)
-      free(ds.powsmooth[c].buf);
+  for (c = 0; c < 2; c++)
+    smooth_free(&ds.powsmooth[c]);
 
   /* scale the pow value to be in the range 0.0 -- 1.0 */
   ds.maxpow = ds.maxpow / (samplemin * (double)samplemin);
 
+  /* or go by the integrated loudness */
+  if (ds.loudness) {
+    ds.maxpow = loudness_level(ds.loudness);
+    ds.maxpow = ds.maxpow * ds.maxpow;
+    loudness_free(ds.loudness);
+  }
+
   /* fill in the signal_info struct */
   ds.si->level = sqrt(ds.maxpow);
   if (-ds.si->min_sample > ds.si->max_sample)
     ds.si->peak = ds.si->min_sample / (double)samplemin;
   else
     ds.si->peak = ds.si->max_sample / (double)samplemax;
+  ds.si->true_peak = 0.0;
+  if (true_peak_meter)
+    ds.si->true_peak = ds.tp.max > ds.si->peak ? ds.tp.max : ds.si->peak;
 
   if (result == -1)
     return -1.0;
@@ -261,7 +259,7 @@ decode_input(void *dat, struct mad_stream *ms)
   mad_stream_buffer(ms, ds->buffer, ds->buflen);
 
   /* update progress meter */
-  if (verbose >= VERBOSE_PROGRESS) {
+  if (ds->show_progress) {
     if (ds->si->file_size == 0)
       progress = 0;
     else
@@ -298,7 +296,8 @@ decode_output(void *dat, struct mad_header const *mh, struct mad_pcm *pcm)
   struct decode_struct *ds = (struct decode_struct *)dat;
   mad_fixed_t *lchan, *rchan;
   unsigned int nsamples;
-  int sample, c;
+  int sample;
+  int16_t *fbuf;
 
   if (ds->windowsz == 0) {
     /*
@@ -306,12 +305,10 @@ decode_output(void *dat, struct mad_header const *mh, struct mad_pcm *pcm)
      */
     ds->si->bits_per_sample = 16;
     ds->sums[0] = ds->sums[1] = 0;
-
-    /* set up smoothing window buffer */
-    for (c = 0; c < 2; c++) {
-      ds->powsmooth[c].buflen = 100; /* use a 100-element (1 second) window */
-      ds->powsmooth[c].buf = (double *)xmalloc(ds->powsmooth[c].buflen * sizeof(double));
-      ds->powsmooth[c].start = ds->powsmooth[c].n = 0;
+    if (use_lufs) {
+      ds->loudness = loudness_new(pcm->channels, pcm->samplerate, 16);
+      ds->loudness_channels = pcm->channels;
+      ds->loudness_rate = pcm->samplerate;
     }
   }
 
@@ -326,6 +323,10 @@ decode_output(void *dat, struct mad_header const *mh, struct mad_pcm *pcm)
   lchan = pcm->samples[0];
   rchan = pcm->samples[1];
 
+  fbuf = NULL;
+  if ((true_peak_meter || ds->loudness) && nsamples <= 1152)
+    fbuf = ds->frame_buf;
+
   while (nsamples--) {
 
     /*
@@ -335,6 +336,8 @@ decode_output(void *dat, struct mad_header const *mh, struct mad_pcm *pcm)
     /* left channel */
     sample = scale(*lchan++);
     ds->sums[0] += sample * (double)sample;
+    if (fbuf)
+      *fbuf++ = sample;
     /* track peak */
     if (sample > ds->si->max_sample)
       ds->si->max_sample = sample;
@@ -345,6 +348,8 @@ decode_output(void *dat, struct mad_header const *mh, struct mad_pcm *pcm)
     if (pcm->channels > 1) {
       sample = scale(*rchan++);
       ds->sums[1] += sample * (double)sample;
+      if (fbuf)
+	*fbuf++ = sample;
       /* track peak */
       if (sample > ds->si->max_sample)
 	ds->si->max_sample = sample;
@@ -360,6 +365,19 @@ decode_output(void *dat, struct mad_header const *mh, struct mad_pcm *pcm)
     }
   }
 
+  if (fbuf) {
+    if (true_peak_meter)
+      truepeak_samples(ds->frame_buf, pcm->length, pcm->channels, 2,
+		       1.0f / -samplemin, &ds->tp);
+    /*
+     * The loudness filters can't follow a change of format, so frames
+     * that don't match the first one are left out of the measurement.
+     */
+    if (ds->loudness && pcm->channels == ds->loudness_channels
+	&& pcm->samplerate == ds->loudness_rate)
+      loudness_add(ds->loudness, ds->frame_buf, pcm->length, 2);
+  }
+
   return MAD_FLOW_CONTINUE;
 }
 
@@ -79,13 +79,31 @@
 
 #include "getopt.h"
 #include "common.h"
+#include "jobs.h"
+#include "kernels.h"
+#include "cache.h"
+#include "embed.h"
+#include "smooth.h"
 
 extern double signal_max_power(char *, struct signal_info *);
-extern double signal_max_power_stream(FILE *, char *, struct signal_info *);
+extern double signal_max_power_sampled(char *, struct signal_info *, double);
 extern int apply_gain(char *fname, double, struct signal_info *);
+extern uint64_t histogram_total(const struct signal_info *, int);
+extern uint64_t histogram_clippings(const struct signal_info *, int, double);
+extern double histogram_max_gain(const struct signal_info *, int, double);
 
 void compute_levels(struct signal_info *sis, char **fnames, int nfiles);
+int analyze_and_adjust(struct signal_info *sis, char **fnames, int nfiles);
+int adjust_file(struct signal_info *sis, char **fnames, int i, double gain);
+struct level_job;
+static int adjust_files(struct signal_info *sis, char **fnames, int nfiles,
+			double gain, struct level_job *lj);
 double average_levels(struct signal_info *sis, int nfiles, double threshold);
+double file_gain(const struct signal_info *si);
+void report_clipping(const struct signal_info *si, double gain, char *fname);
+void report_estimate(const struct signal_info *si, FILE *fp);
+const char *level_units(void);
+int parse_raw_format(const char *arg, struct raw_format *rf);
 int strncaseeq(const char *s1, const char *s2, size_t n);
 char *basename(char *path);
 void *xmalloc(size_t size);
@@ -109,25 +127,64 @@ Usage: %s [OPTION]... [FILE]...\n\
 Normalize volume of multiple audio files\n\
 \n\
   -a, --amplitude=AMP          normalize the volume to the target amplitude\n\
-                                 AMP [default -12dBFS]\n\
+                                 AMP [default -12dBFS, or -23LUFS with\n\
+                                 --loudness=lufs]\n\
   -b, --batch                  batch mode: get average of all levels, and\n\
                                  use one adjustment, based on the average\n\
                                  level, for all files\n\
+      --block-size=SIZE        read and write files SIZE bytes at a time;\n\
+                                 the suffixes k and M mean kilobytes and\n\
+                                 megabytes [default 1M]\n\
+      --cache[=hash]           remember levels between runs, and don't\n\
+                                 analyze unchanged files again; with\n\
+                                 \"hash\", also check their contents\n\
+      --checkpoint             keep the state of each WAV file's analysis\n\
+                                 in FILE.normalize, and only analyze what\n\
+                                 has been appended to the file since\n\
+      --clip-budget=PCT        turn off limiter, and keep the adjustment\n\
+                                 small enough that no more than PCT\n\
+                                 percent of the samples are clipped\n\
       --clipping               turn off limiter; do clipping instead\n\
+      --embed                  store levels in the files themselves, and\n\
+                                 use levels stored there instead of\n\
+                                 analyzing the files again\n\
+      --exact-limiter          limit 24- and 32-bit samples with the exact\n\
+                                 limiter curve, not a faster approximation\n\
+                                 that may be off by one in the last bit\n\
+      --fast=FRACTION          estimate levels from a random sample of\n\
+                                 FRACTION of each file (or a percentage,\n\
+                                 with %%), scanning files in full when\n\
+                                 the estimate is too uncertain\n\
       --fractions              display levels as fractions of maximum\n\
                                  amplitude instead of decibels\n\
   -g, --gain=ADJ               don't compute levels, just apply adjustment\n\
                                  ADJ to the files.  Use the suffix \"dB\"\n\
                                  to indicate a gain in decibels.\n\
+  -j, --jobs=N                 process up to N files at once [default 1];\n\
+                                 0 means one for each processor\n\
   -l, --limiter=LEV            limit all samples above LEV [default -6dBFS]\n\
+      --loudness=MEASURE       measure loudness as rms, the windowed RMS\n\
+                                 power, or as lufs, the gated loudness of\n\
+                                 ITU-R BS.1770 [default rms]\n\
   -m, --mix                    mix mode: get average of all levels, and\n\
                                  normalize volume of each file to the\n\
                                  average\n\
   -n, --no-adjust              compute and display the volume adjustment,\n\
                                  but don't apply it to any of the files\n\
-      --peak                   adjust by peak level instead of using\n\
-                                 loudness analysis\n\
+      --no-cache               don't use the level cache [default]\n\
+      --peak[=true]            adjust by peak level instead of using\n\
+                                 loudness analysis; with \"true\", by the\n\
+                                 peak between samples, oversampled 4x\n\
   -q, --quiet                  quiet (decrease verbosity to zero)\n\
+      --raw=FMT:CH:RATE        read FILEs as headerless PCM samples in\n\
+                                 format FMT (u8, s8, or s16, s24, or s32\n\
+                                 followed by le or be), with CH channels\n\
+                                 at RATE samples per second, e.g.\n\
+                                 s16le:2:44100; raw files are only analyzed\n\
+      --rebuild-cache          analyze every file, replacing any levels\n\
+                                 in the cache\n\
+      --smoothing=FILTER       smooth the loudness over time with FILTER:\n\
+                                 mean, median, or gaussian [default mean]\n\
   -t, --average-threshold=T    when computing average level, ignore any\n\
                                  levels more than T decibels from average\n\
   -T, --adjust-threshold=T     don't bother applying any adjustment smaller\n\
@@ -138,6 +195,9 @@ Normalize volume of multiple audio files\n\
   -V, --version                display version information and exit\n\
   -h, --help                   display this help and exit\n\
 \n\
+A FILE of \"-\" means standard input, which is analyzed but not adjusted;\n\
+with -g, it is adjusted onto standard output instead.\n\
+\n\
 Report bugs to <chrisvaill@gmail.com>.\n"), progname);
 }
 
@@ -150,6 +210,18 @@ enum {
   OPT_NO_PROGRESS  = 0x106,
   OPT_QUERY        = 0x107,
   OPT_FRONTEND     = 0x108,
+  OPT_BLOCK_SIZE   = 0x109,
+  OPT_CACHE        = 0x10a,
+  OPT_NO_CACHE     = 0x10b,
+  OPT_REBUILD_CACHE = 0x10c,
+  OPT_EMBED        = 0x10d,
+  OPT_CLIP_BUDGET  = 0x10e,
+  OPT_SMOOTHING    = 0x10f,
+  OPT_LOUDNESS     = 0x110,
+  OPT_FAST         = 0x111,
+  OPT_CHECKPOINT   = 0x112,
+  OPT_RAW          = 0x113,
+  OPT_EXACT_LIMITER = 0x114,
 };
 
 /* options */
@@ -157,6 +229,7 @@ int verbose = VERBOSE_PROGRESS;
 int do_print_only = FALSE;
 int do_apply_gain = TRUE;
 double target = 0.2511886431509580; /* -12dBFS */
+int target_given = FALSE;
 double threshold = -1.0; /* in decibels */
 int do_compute_levels = TRUE;
 int output_bitwidth = 0;
@@ -164,7 +237,9 @@ int gain_in_decibels = FALSE;
 int batch_mode = FALSE;
 int mix_mode = FALSE;
 int use_limiter = TRUE;
+int exact_limiter = FALSE; /* call tanh() for every sample over the level */
 int use_peak = FALSE;
+int use_true_peak = FALSE; /* with use_peak, go by the true peak */
 int use_fractions = FALSE;
 int show_progress = TRUE;
 int do_query = FALSE;
@@ -173,17 +248,34 @@ double lmtr_lvl = 0.5;
 double adjust_thresh = 0.125; /* don't adjust less than this many dB */
 int id3_compat = FALSE;
 int id3_unsync = FALSE;
+int jobs = 1;
+int file_jobs = 1; /* threads to use on each file's analysis */
+long io_block_size = 1024 * 1024; /* bytes to read or write at a time */
+int use_cache = FALSE;
+int cache_hash = FALSE;    /* check file contents against the cache, too */
+int rebuild_cache = FALSE;
+int use_embed = FALSE;
+double clip_budget = -1.0; /* fraction of samples allowed to clip */
+int sample_histogram = FALSE; /* count samples by value when analyzing */
+int true_peak_meter = FALSE; /* meter the true peak when analyzing */
+int smooth_filter = SMOOTH_MEAN;
+int use_lufs = FALSE; /* measure BS.1770 loudness instead of RMS power */
+double fast_fraction = 0.0; /* of each file to read, with --fast */
+int use_checkpoints = FALSE; /* resume analysis from FILE.normalize */
+int use_raw = FALSE; /* files are headerless, in raw_format */
+struct raw_format raw_format;
 
 int
 main(int argc, char *argv[])
 {
-  int c, i, nfiles, ret;
-  struct signal_info *sis, *psi;
-  double level = 0.0, gain = 1.0, dBdiff = 0.0;
+  int c, i, nfiles, nstdin;
+  struct signal_info *sis;
+  double level = 0.0, gain = 1.0, dBdiff = 0.0, max_gain;
   char **fnames, *p;
   char cbuf[32];
   struct stat st;
   int file_needs_adjust = FALSE;
+  int pipelined;
 
   struct option longopts[] = {
     {"help", 0, NULL, 'h'},
@@ -196,6 +288,7 @@ main(int argc, char *argv[])
     {"average-threshold", 1, NULL, 't'},
     {"threshold", 1, NULL, 't'}, /* deprecate */
     {"gain", 1, NULL, 'g'},
+    {"jobs", 1, NULL, 'j'},
     {"limiter", 1, NULL, 'l'},
     {"adjust-threshold", 1, NULL, 'T'},
     {"mix", 0, NULL, 'm'},
@@ -203,13 +296,25 @@ main(int argc, char *argv[])
     {"limit", 0, NULL, 'c'}, /* deprecate */
     {"output-bitwidth", 1, NULL, 'w'},
     {"clipping", 0, NULL, OPT_CLIPPING},
-    {"peak", 0, NULL, OPT_PEAK},
+    {"peak", 2, NULL, OPT_PEAK},
     {"fractions", 0, NULL, OPT_FRACTIONS},
     {"id3-compat", 0, NULL, OPT_ID3_COMPAT},
     {"id3-unsync", 0, NULL, OPT_ID3_UNSYNC},
     {"no-progress", 0, NULL, OPT_NO_PROGRESS},
     {"query", 0, NULL, OPT_QUERY},
     {"frontend", 0, NULL, OPT_FRONTEND},
+    {"block-size", 1, NULL, OPT_BLOCK_SIZE},
+    {"cache", 2, NULL, OPT_CACHE},
+    {"no-cache", 0, NULL, OPT_NO_CACHE},
+    {"rebuild-cache", 0, NULL, OPT_REBUILD_CACHE},
+    {"embed", 0, NULL, OPT_EMBED},
+    {"clip-budget", 1, NULL, OPT_CLIP_BUDGET},
+    {"smoothing", 1, NULL, OPT_SMOOTHING},
+    {"loudness", 1, NULL, OPT_LOUDNESS},
+    {"fast", 1, NULL, OPT_FAST},
+    {"checkpoint", 0, NULL, OPT_CHECKPOINT},
+    {"raw", 1, NULL, OPT_RAW},
+    {"exact-limiter", 0, NULL, OPT_EXACT_LIMITER},
     {NULL, 0, NULL, 0}
   };
 
@@ -229,16 +334,20 @@ main(int argc, char *argv[])
   textdomain(PACKAGE);
 #endif
 
+  /* pick the sample-crunching code that suits this processor */
+  kernels_init();
+
   /* get args */
-  while ((c = getopt_long(argc, argv, "hVnvqbmcT:l:g:a:t:w:", longopts, NULL)) != EOF) {
+  while ((c = getopt_long(argc, argv, "hVnvqbmcT:l:g:a:t:w:j:", longopts, NULL)) != EOF) {
     switch(c) {
     case 'a':
       target = strtod(optarg, &p);
+      target_given = TRUE;
 
-      /* check if "dB" or "dBFS" is given after number */
+      /* check if "dB", "dBFS", or "LUFS" is given after number */
       while(isspace(*p))
 	p++;
-      if (strncaseeq(p, "db", 2)) {
+      if (strncaseeq(p, "db", 2) || strncaseeq(p, "lufs", 4)) {
 	/* amplitude given as dBFS */
 
 	if (target > 0) {
@@ -283,6 +392,16 @@ main(int argc, char *argv[])
 	exit(1);
       }
       break;
+    case 'j':
+      jobs = strtol(optarg, &p, 0);
+      if (*p != '\0' || jobs < 0) {
+	fprintf(stderr, _("%s: invalid argument to -j option\n"), progname);
+	usage_short();
+	exit(1);
+      }
+      if (jobs == 0)
+	jobs = jobs_online_cpus();
+      break;
     case 'n':
       do_print_only = TRUE;
       do_apply_gain = FALSE;
@@ -331,9 +450,21 @@ main(int argc, char *argv[])
     case OPT_CLIPPING:
       use_limiter = FALSE;
       break;
+    case OPT_EXACT_LIMITER:
+      exact_limiter = TRUE;
+      break;
     case OPT_PEAK:
       use_peak = TRUE;
       use_limiter = FALSE;
+      if (optarg) {
+	if (strcmp(optarg, "true") != 0) {
+	  fprintf(stderr, _("%s: invalid argument to --peak option\n"),
+		  progname);
+	  usage_short();
+	  exit(1);
+	}
+	use_true_peak = TRUE;
+      }
       break;
     case OPT_FRACTIONS:
       use_fractions = TRUE;
@@ -356,6 +487,105 @@ main(int argc, char *argv[])
       frontend = TRUE;
       verbose = VERBOSE_QUIET;
       break;
+    case OPT_BLOCK_SIZE:
+      io_block_size = strtol(optarg, &p, 0);
+      if (*p == 'k' || *p == 'K') {
+	io_block_size *= 1024;
+	p++;
+      } else if (*p == 'm' || *p == 'M') {
+	io_block_size *= 1024 * 1024;
+	p++;
+      }
+      if (*p != '\0' || io_block_size <= 0
+	  || io_block_size > 1024 * 1024 * 1024) {
+	fprintf(stderr, _("%s: invalid argument to --block-size option\n"),
+		progname);
+	usage_short();
+	exit(1);
+      }
+      break;
+    case OPT_CACHE:
+      use_cache = TRUE;
+      if (optarg) {
+	if (strcmp(optarg, "hash") != 0) {
+	  fprintf(stderr, _("%s: invalid argument to --cache option\n"),
+		  progname);
+	  usage_short();
+	  exit(1);
+	}
+	cache_hash = TRUE;
+      }
+      break;
+    case OPT_NO_CACHE:
+      use_cache = FALSE;
+      rebuild_cache = FALSE;
+      break;
+    case OPT_REBUILD_CACHE:
+      use_cache = TRUE;
+      rebuild_cache = TRUE;
+      break;
+    case OPT_EMBED:
+      use_embed = TRUE;
+      break;
+    case OPT_CHECKPOINT:
+      use_checkpoints = TRUE;
+      break;
+    case OPT_CLIP_BUDGET:
+      clip_budget = strtod(optarg, &p);
+      if (*p == '%')
+	p++;
+      if (*p != '\0' || clip_budget < 0 || clip_budget > 100) {
+	fprintf(stderr, _("%s: invalid argument to --clip-budget option\n"),
+		progname);
+	usage_short();
+	exit(1);
+      }
+      clip_budget /= 100.0;
+      use_limiter = FALSE;
+      break;
+    case OPT_FAST:
+      fast_fraction = strtod(optarg, &p);
+      if (*p == '%') {
+	fast_fraction /= 100.0;
+	p++;
+      }
+      if (*p != '\0' || fast_fraction <= 0 || fast_fraction > 1) {
+	fprintf(stderr, _("%s: invalid argument to --fast option\n"),
+		progname);
+	usage_short();
+	exit(1);
+      }
+      break;
+    case OPT_RAW:
+      if (parse_raw_format(optarg, &raw_format) == -1) {
+	fprintf(stderr, _("%s: invalid argument to --raw option\n"),
+		progname);
+	usage_short();
+	exit(1);
+      }
+      use_raw = TRUE;
+      break;
+    case OPT_SMOOTHING:
+      smooth_filter = smooth_parse_filter(optarg);
+      if (smooth_filter == -1) {
+	fprintf(stderr, _("%s: invalid argument to --smoothing option\n"),
+		progname);
+	usage_short();
+	exit(1);
+      }
+      break;
+    case OPT_LOUDNESS:
+      if (strcmp(optarg, "lufs") == 0)
+	use_lufs = TRUE;
+      else if (strcmp(optarg, "rms") == 0)
+	use_lufs = FALSE;
+      else {
+	fprintf(stderr, _("%s: invalid argument to --loudness option\n"),
+		progname);
+	usage_short();
+	exit(1);
+      }
+      break;
     case 'v':
       verbose++;
       break;
@@ -377,6 +607,8 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
       printf("  audiofile");
 #endif
       printf("\n");
+      printf(_("Sample processing uses the %s instruction set.\n"),
+	     kernels_isa());
       exit(0);
     case 'h':
       usage();
@@ -407,6 +639,86 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
     usage_short();
     exit(1);
   }
+  if (use_lufs && use_peak) {
+    if (verbose >= VERBOSE_PROGRESS)
+      fprintf(stderr, _("%s: Warning: --peak doesn't measure loudness, "
+			"ignoring --loudness\n"), progname);
+    use_lufs = FALSE;
+  }
+  /* EBU R128 asks for -23 LUFS */
+  if (use_lufs && !target_given)
+    target = DBFSTOAMP(-23.0);
+  if (clip_budget >= 0 && (use_peak || use_limiter)) {
+    if (verbose >= VERBOSE_PROGRESS)
+      fprintf(stderr,
+	      _("%s: Warning: nothing is clipped with the limiter on "
+		"or with --peak, ignoring --clip-budget\n"), progname);
+    clip_budget = -1.0;
+  }
+  if (fast_fraction > 0 && (use_peak || use_lufs || clip_budget >= 0)) {
+    if (verbose >= VERBOSE_PROGRESS)
+      fprintf(stderr,
+	      _("%s: Warning: --peak, --loudness=lufs, and --clip-budget "
+		"need every sample, ignoring --fast\n"), progname);
+    fast_fraction = 0.0;
+  }
+  /*
+   * We can analyze the standard input and raw files, but we've
+   * nowhere to write them back to.  With -g, though, we don't need
+   * the level first, so the standard input is adjusted onto the
+   * standard output, as a filter.
+   */
+  nstdin = 0;
+  for (i = optind; i < argc; i++)
+    if (strcmp(argv[i], "-") == 0)
+      nstdin++;
+  if (do_apply_gain && (use_raw || (nstdin && do_compute_levels))) {
+    if (use_raw)
+      fprintf(stderr, _("%s: Warning: raw files can't be adjusted, not adjusting files\n"), progname);
+    else
+      fprintf(stderr, _("%s: Warning: stdin specified on command line, not adjusting files\n"), progname);
+    do_apply_gain = FALSE;
+    do_print_only = TRUE;
+  }
+  if (do_apply_gain && nstdin) {
+    if (nstdin > 1) {
+      fprintf(stderr, _("%s: error: the standard input can only be "
+			"adjusted once\n"), progname);
+      exit(1);
+    }
+    if (frontend) {
+      fprintf(stderr, _("%s: error: the standard input is adjusted onto "
+			"the standard output, which --frontend needs\n"),
+	      progname);
+      exit(1);
+    }
+    if (isatty(STDOUT_FILENO)) {
+      fprintf(stderr, _("%s: error: not writing audio to a terminal\n"),
+	      progname);
+      exit(1);
+    }
+  }
+  /*
+   * If we're clipping, count the samples by value as we compute the
+   * levels, so we know how many will clip without reading the files
+   * again.  With --fast, we don't read them all, so we don't report
+   * the clipping.
+   */
+  sample_histogram = do_compute_levels && !use_limiter && !use_peak
+    && (clip_budget >= 0 || (do_print_only && fast_fraction == 0));
+  /*
+   * Meter the peaks between the samples when something will look at
+   * them: --peak=true, or the limiter deciding if a file needs it.
+   */
+  true_peak_meter = use_true_peak || (use_limiter && do_apply_gain);
+#if !USE_PTHREADS
+  if (jobs > 1) {
+    fprintf(stderr,
+	    _("%s: Warning: compiled without thread support, ignoring -j\n"),
+	    progname);
+    jobs = 1;
+  }
+#endif
 
 
   /*
@@ -416,18 +728,14 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
   progress_info.batch_size = 0;
   fnames = (char **)xmalloc((argc - optind) * sizeof(char *));
   progress_info.file_sizes = (off_t *)xmalloc((argc - optind) * sizeof(off_t));
+  progress_info.file_fractions = (float *)xmalloc((argc - optind) * sizeof(float));
+  progress_info.active_size = 0;
   for (i = optind; i < argc; i++) {
-#if 0 /* FIXME: read from stdin currently not supported */
     if (strcmp(argv[i], "-") == 0) {
-      if (do_apply_gain) {
-	fprintf(stderr, _("%s: Warning: stdin specified on command line, not adjusting files\n"), progname);
-	do_apply_gain = FALSE;
-	do_print_only = TRUE;
-      }
+      /* there's no telling how much a stream holds */
+      progress_info.file_sizes[nfiles] = 0;
       fnames[nfiles++] = argv[i];
-    } else
-#endif
-    if (stat(argv[i], &st) == -1) {
+    } else if (stat(argv[i], &st) == -1) {
       fprintf(stderr, _("%s: file %s: %s\n"),
 	      progname, argv[i], strerror(errno));
     } else {
@@ -448,6 +756,8 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
   sis = (struct signal_info *)xmalloc(nfiles * sizeof(struct signal_info));
   for (i = 0; i < nfiles; i++) {
     sis[i].file_size = progress_info.file_sizes[i];
+    sis[i].hist = NULL;
+    sis[i].max_gain = 0;
     sis[i].orig_index = i;
   }
 
@@ -459,10 +769,17 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
       printf("FILE %d %s\n", i, fnames[i]);
   }
 
+  /*
+   * If each file gets its own gain, we can adjust each one as soon as
+   * we know its level, instead of reading all the files twice over.
+   */
+  pipelined = do_compute_levels && do_apply_gain
+    && !batch_mode && !mix_mode && !frontend;
+
   /*
    * Compute the levels
    */
-  if (do_compute_levels) {
+  if (do_compute_levels && !pipelined) {
     compute_levels(sis, fnames, nfiles);
 
     /* anything that came back with a level of -1 was bad, so remove it */
@@ -486,8 +803,17 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
 	target = level;
 
       /* For batch mode, we use one gain for all files */
-      if (batch_mode)
+      if (batch_mode) {
 	gain = target / level;
+	if (clip_budget >= 0) {
+	  max_gain = histogram_max_gain(sis, nfiles, clip_budget);
+	  if (max_gain > 0 && gain > max_gain)
+	    gain = max_gain;
+	}
+	if (sample_histogram && do_print_only)
+	  for (i = 0; i < nfiles; i++)
+	    report_clipping(&sis[i], gain, fnames[i]);
+      }
 
       /* frontend mode: print "AVERAGE_LEVEL <level>" */
       if (frontend)
@@ -498,18 +824,25 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
 	  if (use_fractions) {
 	    printf(_("%-12.6f average level\n"), level);
 	  } else {
-	    sprintf(cbuf, "%0.4fdBFS", AMPTODBFS(level));
+	    sprintf(cbuf, "%0.4f%s", AMPTODBFS(level), level_units());
 	    printf(_("%-12s average level\n"), cbuf);
 	  }
 	}
       } else if (verbose >= VERBOSE_INFO) {
 	if (use_fractions)
 	  printf(_("Average level: %0.4f\n"), level);
+	else if (use_lufs)
+	  printf(_("Average loudness: %0.4fLUFS\n"), AMPTODBFS(level));
 	else
 	  printf(_("Average level: %0.4fdBFS\n"), AMPTODBFS(level));
       }
     }
 
+    for (i = 0; i < nfiles; i++) {
+      free(sis[i].hist);
+      sis[i].hist = NULL;
+    }
+
   } /* end of if (do_compute_levels) */
 
 
@@ -566,48 +899,19 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
     progress_info.batch_start = time(NULL);
     progress_info.finished_size = 0;
 
-    for (i = 0; i < nfiles; i++) {
-
-      if (!batch_mode) {
-	if (use_peak)
-	  gain = 1.0 / sis[i].peak;
-	else
-	  gain = target / sis[i].level;
-      }
-
-      /* frontend mode: print "ADJUSTING <number> <gain>" */
-      if (frontend)
-	printf("ADJUSTING %d %f\n", sis[i].orig_index, FRACTODB(gain));
-
-      progress_info.file_start = time(NULL);
-      progress_info.on_file = i;
-
-      psi = do_compute_levels ? &sis[i] : NULL;
-      ret = apply_gain(fnames[i], gain, psi);
-      if (ret == -1) {
-	fprintf(stderr, _("%s: error applying adjustment to %s: %s\n"),
-		progname, fnames[i], strerror(errno));
-      } else {
-	if (ret == 0) {
-	  /* gain was not applied */
-	  if (!batch_mode) {
-	    if (verbose >= VERBOSE_PROGRESS)
-	      fprintf(stderr, _("%s already normalized, not adjusting..."),
-		      fnames[i]);
-	  }
-	} else {
-	  /* gain was applied */
+    if (pipelined) {
+      file_needs_adjust = analyze_and_adjust(sis, fnames, nfiles);
+    } else if (jobs > 1 && nfiles > 1) {
+      file_needs_adjust = adjust_files(sis, fnames, nfiles, gain, NULL);
+    } else {
+      /* one file at a time, so each may use all the jobs */
+      file_jobs = jobs;
+      for (i = 0; i < nfiles; i++) {
+	if (!batch_mode)
+	  gain = file_gain(&sis[i]);
+	if (adjust_file(sis, fnames, i, gain) == 1)
 	  file_needs_adjust = TRUE;
-	}
-	/* frontend mode: print "ADJUSTED <number> 1|0" */
-	if (frontend)
-	  printf("ADJUSTED %d %d\n", sis[i].orig_index, ret);
       }
-
-      progress_info.finished_size += progress_info.file_sizes[i];
-
-      if (verbose >= VERBOSE_PROGRESS && !batch_mode)
-	fputc('\n', stderr);
     }
 
     /* we're done with the second progress meter, so go to next line */
@@ -643,14 +947,14 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
 	  printf("%-12s ", cbuf);
 	  sprintf(cbuf, "%0.6f", sis[i].peak);
 	  printf("%-12s ", cbuf);
-	  sprintf(cbuf, "%0.6f", target / sis[i].level);
+	  sprintf(cbuf, "%0.6f", file_gain(&sis[i]));
 	  printf("%-10s ", cbuf);
 	} else {
-	  sprintf(cbuf, "%0.4fdBFS", AMPTODBFS(sis[i].level));
+	  sprintf(cbuf, "%0.4f%s", AMPTODBFS(sis[i].level), level_units());
 	  printf("%-12s ", cbuf);
 	  sprintf(cbuf, "%0.4fdBFS", AMPTODBFS(sis[i].peak));
 	  printf("%-12s ", cbuf);
-	  sprintf(cbuf, "%0.4fdB", AMPTODBFS(target / sis[i].level));
+	  sprintf(cbuf, "%0.4fdB", AMPTODBFS(file_gain(&sis[i])));
 	  printf("%-10s ", cbuf);
 	}
 	printf("%s\n", fnames[i]);
@@ -658,7 +962,7 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
       if (use_fractions) {
 	printf(_("%-12.6f average level\n"), level);
       } else {
-	sprintf(cbuf, "%0.4fdBFS", AMPTODBFS(level));
+	sprintf(cbuf, "%0.4f%s", AMPTODBFS(level), level_units());
 	printf(_("%-12s average level\n"), cbuf);
       }
 
@@ -669,10 +973,7 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
      * file_needs_adjust yet, so we do it now.
      */
     for (i = 0; i < nfiles; i++) {
-      if (use_peak)
-	gain = 1.0 / sis[i].peak;
-      else
-	gain = target / sis[i].level;
+      gain = file_gain(&sis[i]);
       dBdiff = FRACTODB(gain);
       
       if (fabs(dBdiff) >= adjust_thresh) {
@@ -685,6 +986,7 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
 
   free(sis);
   free(progress_info.file_sizes);
+  free(progress_info.file_fractions);
   free(fnames);
 
   /*
@@ -708,15 +1010,343 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
   return 0;
 }
 
+/*
+ * Progress bookkeeping at the start and end of each file.  These may
+ * be called from several jobs at once.
+ */
+static void
+progress_start_file(int i)
+{
+  /* the foreground owns the per-file progress */
+  if (job_in_background())
+    return;
+  jobs_lock();
+  progress_info.file_start = time(NULL);
+  progress_info.on_file = i;
+  progress_info.file_fractions[i] = 0;
+  jobs_unlock();
+}
+
+static void
+progress_finish_file(int i)
+{
+  jobs_lock();
+  progress_info.active_size -=
+    progress_info.file_fractions[i] * progress_info.file_sizes[i];
+  progress_info.file_fractions[i] = 0;
+  progress_info.finished_size += progress_info.file_sizes[i];
+  jobs_unlock();
+}
+
+struct level_job {
+  struct signal_info *sis;
+  char **fnames;
+  double *powers; /* what signal_max_power() returned for each file */
+  int *errnos;    /* errno after signal_max_power() for each file */
+};
+
+/* what levels are shown in, when not shown as fractions */
+const char *
+level_units(void)
+{
+  return use_lufs ? "LUFS" : "dBFS";
+}
+
+/*
+ * Parse the argument to --raw, FORMAT:CHANNELS:RATE, where FORMAT is
+ * u8, s8, or s16, s24, or s32 followed by le or be for the byte
+ * order.  Returns -1 if it's no good.
+ */
+int
+parse_raw_format(const char *arg, struct raw_format *rf)
+{
+  char *p;
+  long n;
+
+  if (arg[0] != 's' && arg[0] != 'u')
+    return -1;
+  rf->is_signed = arg[0] == 's';
+  n = strtol(arg + 1, &p, 10);
+  if (n != 8 && n != 16 && n != 24 && n != 32)
+    return -1;
+  rf->bits_per_sample = n;
+  rf->big_endian = FALSE;
+  if (n > 8) {
+    /* we only take unsigned samples of 8 bits, as WAV files have */
+    if (!rf->is_signed)
+      return -1;
+    if (strncmp(p, "be", 2) == 0)
+      rf->big_endian = TRUE;
+    else if (strncmp(p, "le", 2) != 0)
+      return -1;
+    p += 2;
+  }
+
+  if (*p++ != ':')
+    return -1;
+  n = strtol(p, &p, 10);
+  if (n < 1 || n > 65535 || *p++ != ':')
+    return -1;
+  rf->channels = n;
+  n = strtol(p, &p, 10);
+  if (n < 1 || *p != '\0')
+    return -1;
+  rf->samples_per_sec = n;
+  return 0;
+}
+
+/*
+ * The name of the method used to compute levels.  Levels stored in
+ * the cache or in the files by some other method are ignored.
+ */
+const char *
+analysis_method(void)
+{
+  static char method[32];
+
+  /* gated loudness isn't smoothed */
+  if (use_lufs)
+    return "lufs";
+  if (smooth_filter == SMOOTH_MEAN)
+    return "rms";
+  sprintf(method, "rms-%s", smooth_filter_name(smooth_filter));
+  return method;
+}
+
+/*
+ * Whether the level estimated by --fast is good enough: it mustn't
+ * leave any doubt about whether the file needs adjusting, and if
+ * we're going to adjust it, the true level must be likely within
+ * FAST_TOLERANCE dB of it.
+ */
+#define FAST_TOLERANCE 0.25
+
+static int
+estimate_will_do(const struct signal_info *si)
+{
+  struct signal_info tmp;
+  double lo, hi;
+
+  /* it was measured in full after all */
+  if (si->level_hi == 0)
+    return TRUE;
+
+  /* the gains at either end of the interval, in dB */
+  tmp = *si;
+  tmp.level = si->level_hi;
+  lo = FRACTODB(file_gain(&tmp));
+  tmp.level = si->level_lo;
+  hi = FRACTODB(file_gain(&tmp));
+
+  /* too small to apply either way */
+  if (lo > -adjust_thresh && hi < adjust_thresh)
+    return TRUE;
+  /* straddles the threshold */
+  if (hi > -adjust_thresh && lo < adjust_thresh)
+    return FALSE;
+  if (do_apply_gain && FRACTODB(si->level_hi / si->level) > FAST_TOLERANCE)
+    return FALSE;
+  return TRUE;
+}
+
+/*
+ * Compute the level of the i'th file.  With -j, this runs for several
+ * files at once, so it must not print anything but whole lines.
+ */
+static void
+compute_level(int i, void *arg)
+{
+  struct level_job *lj = (struct level_job *)arg;
+  struct signal_info *sis = lj->sis;
+  char **fnames = lj->fnames;
+  struct cache_key key;
+  double power;
+  int found, keep;
+
+  /* frontend mode: print "ANALYZING <number>" for each file index */
+  if (frontend) {
+    jobs_lock();
+    printf("ANALYZING %d\n", i);
+    jobs_unlock();
+  }
+
+  sis[i].level = 0;
+  sis[i].level_lo = sis[i].level_hi = 0;
+  sis[i].true_peak = 0;
+  sis[i].hist = NULL;
+
+  progress_start_file(i);
+
+  /*
+   * Nothing is stored for the standard input, or for raw files,
+   * whose format comes from the command line.
+   */
+  keep = !use_raw && strcmp(fnames[i], "-") != 0;
+
+  /*
+   * Levels we've stored don't say how many samples will clip, and
+   * those stored by a run that didn't meter the true peak (-n, say)
+   * don't have it, though we need it to apply the limiter.
+   */
+  found = keep && use_cache
+    && cache_lookup(fnames[i], cache_hash, &key, &sis[i], &power)
+    && !sample_histogram && (!true_peak_meter || sis[i].true_peak > 0);
+  if (!found && keep && use_embed && !rebuild_cache && !sample_histogram) {
+    found = embed_lookup(fnames[i], &sis[i], &power)
+      && (!true_peak_meter || sis[i].true_peak > 0);
+    if (found && use_cache)
+      cache_store(&key, &sis[i], power);
+  }
+
+  if (!found && fast_fraction > 0 && strcmp(fnames[i], "-") != 0) {
+    /* estimates aren't kept */
+    power = signal_max_power_sampled(fnames[i], &sis[i], fast_fraction);
+    found = power >= 0 && estimate_will_do(&sis[i]);
+  }
+
+  if (!found) {
+    errno = 0;
+    power = signal_max_power(fnames[i], &sis[i]);
+    if (power >= 0 && keep && use_embed) {
+      if (embed_store(fnames[i], &sis[i], power) == -1) {
+	if (verbose >= VERBOSE_INFO) {
+	  jobs_lock();
+	  fprintf(stderr, _("%s: unable to store levels in %s\n"),
+		  progname, fnames[i]);
+	  jobs_unlock();
+	}
+      } else if (use_cache) {
+	/* we just changed the file, so its key has changed too */
+	cache_make_key(fnames[i], cache_hash, &key);
+      }
+    }
+    if (power >= 0 && keep && use_cache)
+      cache_store(&key, &sis[i], power);
+  }
+
+  if (strcmp(fnames[i], "-") == 0)
+    fnames[i] = "STDIN";
+
+  lj->powers[i] = power;
+  lj->errnos[i] = errno;
+
+  progress_finish_file(i);
+}
+
+/*
+ * Report the level of the i'th file.  Reports are always made in file
+ * order, whatever order the levels were computed in.
+ */
+static void
+report_level(int i, void *arg)
+{
+  struct level_job *lj = (struct level_job *)arg;
+  struct signal_info *sis = lj->sis;
+  char **fnames = lj->fnames;
+  double power = lj->powers[i];
+  char cbuf[32];
+
+  if (power < 0 || power < EPSILON) {
+    free(sis[i].hist);
+    sis[i].hist = NULL;
+  }
+  if (power < 0) {
+    fprintf(stderr, _("%s: error reading %s"), progname, fnames[i]);
+    if (lj->errnos[i])
+      fprintf(stderr, ": %s\n", strerror(lj->errnos[i]));
+    else
+      fprintf(stderr, "\n");
+    sis[i].level = -1;
+    return;
+  }
+  /* frontend mode: print "LEVEL <number> <level>" for each file index */
+  if (frontend)
+    printf("LEVEL %d %f\n", i, AMPTODBFS(sis[i].level));
+  if (power < EPSILON) {
+    if (verbose >= VERBOSE_PROGRESS) {
+      if (show_progress)
+	fprintf(stderr,
+		"\r                                     "
+		"                                     \r");
+      fprintf(stderr,
+	      _("File %s has zero power, ignoring...\n"), fnames[i]);
+    }
+    sis[i].level = -1;
+    return;
+  }
+
+  if (clip_budget >= 0 && !batch_mode)
+    sis[i].max_gain = histogram_max_gain(&sis[i], 1, clip_budget);
+
+  if (do_print_only) {
+
+    /* in mix mode we don't have enough info to print gain yet */
+    if (!mix_mode) {
+
+      /* clear the progress meter first */
+      if (verbose >= VERBOSE_PROGRESS && show_progress)
+	fprintf(stderr,
+		"\r                                     "
+		"                                     \r");
+
+      if (use_fractions) {
+	sprintf(cbuf, "%0.6f", sis[i].level);
+	printf("%-12s ", cbuf);
+	sprintf(cbuf, "%0.6f", sis[i].peak);
+	printf("%-12s ", cbuf);
+      } else {
+	sprintf(cbuf, "%0.4f%s", AMPTODBFS(sis[i].level), level_units());
+	printf("%-12s ", cbuf);
+	sprintf(cbuf, "%0.4fdBFS", AMPTODBFS(sis[i].peak));
+	printf("%-12s ", cbuf);
+      }
+      if (!batch_mode) {
+	if (use_fractions)
+	  sprintf(cbuf, "%0.6f", file_gain(&sis[i]));
+	else
+	  sprintf(cbuf, "%0.4fdB", AMPTODBFS(file_gain(&sis[i])));
+	printf("%-10s ", cbuf);
+      }
+      printf("%s\n", fnames[i]);
+
+      if (sis[i].level_hi > 0)
+	report_estimate(&sis[i], stdout);
+      if (sis[i].hist && !batch_mode)
+	report_clipping(&sis[i], file_gain(&sis[i]), fnames[i]);
+    }
+
+  } else if (verbose >= VERBOSE_INFO) {
+    if (show_progress)
+      fprintf(stderr,
+	      "\r                                     "
+	      "                                     \r");
+    if (use_fractions)
+      fprintf(stderr, _("Level for %s: %0.4f (%0.4f peak)\n"),
+	      fnames[i], sis[i].level, sis[i].peak);
+    else if (use_lufs)
+      fprintf(stderr, _("Loudness of %s: %0.4fLUFS (%0.4fdBFS peak)\n"),
+	      fnames[i], AMPTODBFS(sis[i].level), AMPTODBFS(sis[i].peak));
+    else
+      fprintf(stderr, _("Level for %s: %0.4fdBFS (%0.4fdBFS peak)\n"),
+	      fnames[i], AMPTODBFS(sis[i].level), AMPTODBFS(sis[i].peak));
+    if (sis[i].level_hi > 0)
+      report_estimate(&sis[i], stderr);
+  }
+
+  /* in batch mode, we need all the histograms for the batch gain */
+  if (!batch_mode) {
+    free(sis[i].hist);
+    sis[i].hist = NULL;
+  }
+}
+
 /*
  * Compute the RMS levels of the files.
  */
 void
 compute_levels(struct signal_info *sis, char **fnames, int nfiles)
 {
-  double power;
-  int i;
-  char cbuf[32];
+  struct level_job lj;
   /*struct wavfmt fmt = { 1, 2, 44100, 176400, 0, 16 };*/
 
   if (verbose >= VERBOSE_PROGRESS) {
@@ -733,117 +1363,339 @@ compute_levels(struct signal_info *sis, char **fnames, int nfiles)
   progress_info.batch_start = time(NULL);
   progress_info.finished_size = 0;
 
-  for (i = 0; i < nfiles; i++) {
-
-    /* frontend mode: print "ANALYZING <number>" for each file index */
-    if (frontend)
-      printf("ANALYZING %d\n", i);
+  lj.sis = sis;
+  lj.fnames = fnames;
+  lj.powers = (double *)xmalloc(nfiles * sizeof(double));
+  lj.errnos = (int *)xmalloc(nfiles * sizeof(int));
 
-    sis[i].level = 0;
+  /* if there are fewer files than jobs, share out the spare ones */
+  file_jobs = nfiles < jobs ? jobs / nfiles : 1;
 
-#if 0 /* FIXME: reinstate stdin reading */
-    if (strcmp(fnames[i], "-") == 0) {
-      progress_info.file_start = time(NULL);
-      progress_info.on_file = i;
-      errno = 0;
+  if (use_cache && cache_open(rebuild_cache) == -1)
+    use_cache = FALSE;
 
-      /* for a stream, format info is passed through sis[i].fmt */
-      sis[i].channels = 2;
-      sis[i].bits_per_sample = 16;
-      sis[i].samples_per_sec = 44100;
-      power = signal_max_power_stream(stdin, NULL, &sis[i]);
-      fnames[i] = "STDIN";
+  run_jobs(jobs, nfiles, compute_level, report_level, &lj);
 
-    } else {
-#endif
+  if (use_cache)
+    cache_close();
 
-      progress_info.file_start = time(NULL);
-      progress_info.on_file = i;
-      errno = 0;
+  free(lj.powers);
+  free(lj.errnos);
 
-      power = signal_max_power(fnames[i], &sis[i]);
+  /* we're done with the level calculation progress meter, so go to
+     next line */
+  if (verbose == VERBOSE_PROGRESS && !do_print_only)
+    fputc('\n', stderr);
+}
 
-#if 0 /* FIXME */
-    }
-#endif
-    if (power < 0) {
-      fprintf(stderr, _("%s: error reading %s"), progname, fnames[i]);
-      if (errno)
-	fprintf(stderr, ": %s\n", strerror(errno));
-      else
-	fprintf(stderr, "\n");
-      sis[i].level = -1;
-      goto error_update_progress;
-    }
-    /* frontend mode: print "LEVEL <number> <level>" for each file index */
-    if (frontend)
-      printf("LEVEL %d %f\n", i, AMPTODBFS(sis[i].level));
-    if (power < EPSILON) {
-      if (verbose >= VERBOSE_PROGRESS) {
-	if (show_progress)
-	  fprintf(stderr,
-		  "\r                                     "
-		  "                                     \r");
-	fprintf(stderr,
-		_("File %s has zero power, ignoring...\n"), fnames[i]);
-      }
-      sis[i].level = -1;
-      goto error_update_progress;
+/*
+ * Say how applying the gain to the i'th file went, given what
+ * apply_gain() returned and errno after it.  The caller finishes off
+ * the line of an "already normalized" message.
+ */
+static void
+report_adjust_result(struct signal_info *sis, char **fnames, int i,
+		     int ret, int err)
+{
+  if (ret == -1) {
+    fprintf(stderr, _("%s: error applying adjustment to %s: %s\n"),
+	    progname, fnames[i], strerror(err));
+    return;
+  }
+  if (ret == 0) {
+    /* gain was not applied */
+    if (!batch_mode) {
+      if (verbose >= VERBOSE_PROGRESS)
+	fprintf(stderr, _("%s already normalized, not adjusting..."),
+		fnames[i]);
     }
+  }
+  /* frontend mode: print "ADJUSTED <number> 1|0" */
+  if (frontend)
+    printf("ADJUSTED %d %d\n", sis[i].orig_index, ret);
+}
 
-    if (do_print_only) {
+/*
+ * Apply the gain to the i'th file, and say how it went.  Returns what
+ * apply_gain() returned.
+ */
+int
+adjust_file(struct signal_info *sis, char **fnames, int i, double gain)
+{
+  int ret, err;
 
-      /* in mix mode we don't have enough info to print gain yet */
-      if (!mix_mode) {
+  /* frontend mode: print "ADJUSTING <number> <gain>" */
+  if (frontend)
+    printf("ADJUSTING %d %f\n", sis[i].orig_index, FRACTODB(gain));
 
-	/* clear the progress meter first */
-	if (verbose >= VERBOSE_PROGRESS && show_progress)
-	  fprintf(stderr,
-		  "\r                                     "
-		  "                                     \r");
+  jobs_lock();
+  progress_info.file_start = time(NULL);
+  progress_info.on_file = i;
+  jobs_unlock();
 
-	if (use_fractions) {
-	  sprintf(cbuf, "%0.6f", sis[i].level);
-	  printf("%-12s ", cbuf);
-	  sprintf(cbuf, "%0.6f", sis[i].peak);
-	  printf("%-12s ", cbuf);
-	} else {
-	  sprintf(cbuf, "%0.4fdBFS", AMPTODBFS(sis[i].level));
-	  printf("%-12s ", cbuf);
-	  sprintf(cbuf, "%0.4fdBFS", AMPTODBFS(sis[i].peak));
-	  printf("%-12s ", cbuf);
-	}
-	if (!batch_mode) {
-	  if (use_fractions)
-	    sprintf(cbuf, "%0.6f", target / sis[i].level);
-	  else
-	    sprintf(cbuf, "%0.4fdB", AMPTODBFS(target / sis[i].level));
-	  printf("%-10s ", cbuf);
-	}
-	printf("%s\n", fnames[i]);
-      }
+  ret = apply_gain(fnames[i], gain, do_compute_levels ? &sis[i] : NULL);
+  err = errno;
+  report_adjust_result(sis, fnames, i, ret, err);
 
-    } else if (verbose >= VERBOSE_INFO) {
-      if (show_progress)
-	fprintf(stderr,
-		"\r                                     "
-		"                                     \r");
-      if (use_fractions)
-	fprintf(stderr, _("Level for %s: %0.4f (%0.4f peak)\n"),
-		fnames[i], sis[i].level, sis[i].peak);
-      else
-	fprintf(stderr, _("Level for %s: %0.4fdBFS (%0.4fdBFS peak)\n"),
-		fnames[i], AMPTODBFS(sis[i].level), AMPTODBFS(sis[i].peak));
+  jobs_lock();
+  progress_info.finished_size += progress_info.file_sizes[i];
+  jobs_unlock();
+
+  if (verbose >= VERBOSE_PROGRESS && !batch_mode)
+    fputc('\n', stderr);
+
+  return ret;
+}
+
+struct adjust_job {
+  struct signal_info *sis;
+  char **fnames;
+  double gain;          /* the gain for every file, in batch mode */
+  struct level_job *lj; /* if set, compute each file's level first */
+  int *rets;            /* what apply_gain() returned for each file */
+  int *errnos;          /* errno after apply_gain() for each file */
+  int adjusted;         /* TRUE once a file has been adjusted */
+};
+
+/* the gain for the i'th file */
+static double
+adjust_job_gain(const struct adjust_job *aj, int i)
+{
+  return batch_mode ? aj->gain : file_gain(&aj->sis[i]);
+}
+
+/*
+ * Apply the gain to the i'th file, computing its level first if
+ * asked to.  This runs for several files at once, each with a temp
+ * file of its own, so it leaves the talking to report_adjust().
+ */
+static void
+adjust_one(int i, void *arg)
+{
+  struct adjust_job *aj = (struct adjust_job *)arg;
+  struct signal_info *sis = aj->sis;
+
+  if (aj->lj) {
+    compute_level(i, aj->lj);
+    /* report_level() will drop the file, later on */
+    if (aj->lj->powers[i] < EPSILON) {
+      jobs_lock();
+      progress_info.finished_size += progress_info.file_sizes[i];
+      jobs_unlock();
+      return;
     }
+    /* as report_level() will, but we need the gain now */
+    if (clip_budget >= 0)
+      sis[i].max_gain = histogram_max_gain(&sis[i], 1, clip_budget);
+  }
+
+  progress_start_file(i);
+  errno = 0;
+  aj->rets[i] = apply_gain(aj->fnames[i], adjust_job_gain(aj, i),
+			   do_compute_levels ? &sis[i] : NULL);
+  aj->errnos[i] = errno;
+  progress_finish_file(i);
+}
 
-  error_update_progress:
-    progress_info.finished_size += progress_info.file_sizes[i];
+/*
+ * Say how the i'th file went.  Reports are made in file order, so the
+ * frontend sees each file's "ADJUSTING" and "ADJUSTED" lines
+ * together, just as if the files had been adjusted one at a time.
+ */
+static void
+report_adjust(int i, void *arg)
+{
+  struct adjust_job *aj = (struct adjust_job *)arg;
+  struct signal_info *sis = aj->sis;
+
+  if (aj->lj) {
+    report_level(i, aj->lj);
+    if (sis[i].level < 0)
+      return;
   }
 
-  /* we're done with the level calculation progress meter, so go to
-     next line */
-  if (verbose == VERBOSE_PROGRESS && !do_print_only)
+  /* frontend mode: print "ADJUSTING <number> <gain>" */
+  if (frontend)
+    printf("ADJUSTING %d %f\n", sis[i].orig_index,
+	   FRACTODB(adjust_job_gain(aj, i)));
+
+  /* clear the progress meter first */
+  if (verbose >= VERBOSE_PROGRESS && show_progress)
+    fprintf(stderr,
+	    "\r                                     "
+	    "                                     \r");
+  report_adjust_result(sis, aj->fnames, i, aj->rets[i], aj->errnos[i]);
+  if (aj->rets[i] == 0 && !batch_mode && verbose >= VERBOSE_PROGRESS)
     fputc('\n', stderr);
+
+  if (aj->rets[i] == 1)
+    aj->adjusted = TRUE;
+}
+
+/*
+ * Apply the gain to up to jobs files at once, computing each one's
+ * level first if lj is set.  Returns TRUE if any file was adjusted.
+ */
+static int
+adjust_files(struct signal_info *sis, char **fnames, int nfiles, double gain,
+	     struct level_job *lj)
+{
+  struct adjust_job aj;
+
+  aj.sis = sis;
+  aj.fnames = fnames;
+  aj.gain = gain;
+  aj.lj = lj;
+  aj.rets = (int *)xmalloc(nfiles * sizeof(int));
+  aj.errnos = (int *)xmalloc(nfiles * sizeof(int));
+  aj.adjusted = FALSE;
+
+  /* if there are fewer files than jobs, share out the spare ones */
+  file_jobs = nfiles < jobs ? jobs / nfiles : 1;
+
+  run_jobs(jobs, nfiles, adjust_one, report_adjust, &aj);
+
+  free(aj.rets);
+  free(aj.errnos);
+
+  return aj.adjusted;
+}
+
+/*
+ * Compute the level of each file and adjust it straight away, while
+ * its data is still in the page cache, computing the level of the
+ * next file on another thread in the meantime.  Only for when each
+ * file gets its own gain.  Returns TRUE if any file was adjusted.
+ */
+int
+analyze_and_adjust(struct signal_info *sis, char **fnames, int nfiles)
+{
+  struct level_job lj;
+  double gain;
+  int i, adjusted = FALSE;
+
+  lj.sis = sis;
+  lj.fnames = fnames;
+  lj.powers = (double *)xmalloc(nfiles * sizeof(double));
+  lj.errnos = (int *)xmalloc(nfiles * sizeof(int));
+
+  /* every file is read twice, once to analyze and once to adjust */
+  progress_info.batch_size *= 2;
+
+  if (use_cache && cache_open(rebuild_cache) == -1)
+    use_cache = FALSE;
+
+  if (jobs > 1 && nfiles > 1) {
+    /*
+     * With -j, each job adjusts its file as soon as it has the level,
+     * rather than one job adjusting while another analyzes.
+     */
+    adjusted = adjust_files(sis, fnames, nfiles, 1.0, &lj);
+  } else {
+    /* we're busy adjusting, so the analysis gets any other jobs */
+    file_jobs = jobs > 1 ? jobs - 1 : 1;
+
+    /* nothing to overlap the first file with */
+    compute_level(0, &lj);
+    if (verbose >= VERBOSE_PROGRESS && show_progress)
+      fprintf(stderr,
+	      "\r                                     "
+	      "                                     \r");
+
+    for (i = 0; i < nfiles; i++) {
+      if (i + 1 < nfiles)
+	job_start(compute_level, i + 1, &lj);
+
+      jobs_lock();
+      report_level(i, &lj);
+      jobs_unlock();
+
+      if (sis[i].level >= 0) {
+	gain = file_gain(&sis[i]);
+	if (adjust_file(sis, fnames, i, gain) == 1)
+	  adjusted = TRUE;
+      } else {
+	jobs_lock();
+	progress_info.finished_size += progress_info.file_sizes[i];
+	jobs_unlock();
+      }
+
+      job_wait();
+    }
+  }
+
+  if (use_cache)
+    cache_close();
+
+  free(lj.powers);
+  free(lj.errnos);
+
+  return adjusted;
+}
+
+/*
+ * The gain for a file, when each file gets its own.
+ */
+double
+file_gain(const struct signal_info *si)
+{
+  double gain;
+
+  if (use_peak)
+    return 1.0 / (use_true_peak && si->true_peak > 0
+		  ? si->true_peak : si->peak);
+  gain = target / si->level;
+  if (si->max_gain > 0 && gain > si->max_gain)
+    gain = si->max_gain;
+  return gain;
+}
+
+/*
+ * Say how sure we are of a level estimated by --fast.
+ */
+void
+report_estimate(const struct signal_info *si, FILE *fp)
+{
+  char hi[32];
+
+  if (use_fractions)
+    sprintf(hi, "%0.6f", si->level_hi);
+  else
+    sprintf(hi, "%0.4f%s", AMPTODBFS(si->level_hi), level_units());
+  fprintf(fp, _("  (estimated from part of the file; likely no more than %s)\n"),
+	  hi);
+}
+
+/*
+ * Say how much clipping applying gain to a file would cause, going by
+ * its histogram, as _do_apply_gain() would if we applied it.
+ */
+void
+report_clipping(const struct signal_info *si, double gain, char *fname)
+{
+  uint64_t nclippings, total;
+  float clip_loss;
+
+  /* an adjustment this small wouldn't be applied at all */
+  if (fabs(FRACTODB(gain)) < adjust_thresh)
+    return;
+  total = histogram_total(si, 1);
+  if (total == 0)
+    return;
+  nclippings = histogram_clippings(si, 1, gain);
+  clip_loss = (float)nclippings / (float)total;
+
+  if (verbose >= VERBOSE_INFO) {
+    if (nclippings)
+      fprintf(stderr, _("%s: %s: %llu clippings predicted, %.4f%% loss\n"),
+	      progname, fname, (unsigned long long)nclippings,
+	      clip_loss * 100);
+  } else if (verbose >= VERBOSE_PROGRESS) {
+    if (clip_loss > CLIPPING_WARN_THRESH)
+      fprintf(stderr,
+	      _("%s: Warning: %s would lose %0.2f%% of data to clipping\n"),
+	      progname, fname, clip_loss * 100);
+  }
 }
 
 /*
@@ -924,6 +1776,9 @@ average_levels(struct signal_info *sis, int nlevels, double threshold)
 	  if (use_fractions) {
 	    printf(_("Throwing out level of %0.4f (different by %0.2fdB)\n"),
 		   sis[i].level, level_difference);
+	  } else if (use_lufs) {
+	    printf(_("Throwing out loudness of %0.4fLUFS (different by %0.2fLU)\n"),
+		   AMPTODBFS(sis[i].level), level_difference);
 	  } else {
 	    printf(_("Throwing out level of %0.4fdBFS (different by %0.2fdB)\n"),
 		   AMPTODBFS(sis[i].level), level_difference);
@@ -967,6 +1822,7 @@ progress_callback(char *prefix, float fraction_completed)
   off_t kb_done;
   float batch_fraction = 0;
   unsigned int batch_eta_hr, batch_eta_min, batch_eta_sec;
+  int on_file;
 
   if (!show_progress)
     return;
@@ -976,9 +1832,22 @@ progress_callback(char *prefix, float fraction_completed)
   if (fraction_completed > 1.0)
     fraction_completed = 1.0;
 
+  /*
+   * If several files are in progress at once, we keep track of how
+   * far along each one is, and only show the progress of the batch.
+   */
+  jobs_lock();
+  on_file = job_current();
+  if (on_file >= 0) {
+    progress_info.active_size += (fraction_completed
+				  - progress_info.file_fractions[on_file])
+      * progress_info.file_sizes[on_file];
+    progress_info.file_fractions[on_file] = fraction_completed;
+  }
+
   /* figure out the ETA for this file */
   file_eta_hr = file_eta_sec = file_eta_min = 0;
-  if (fraction_completed > 0.0) {
+  if (fraction_completed > 0.0 && on_file < 0) {
     time_spent = now - progress_info.file_start;
     if (fraction_completed == 0.0)
       file_eta_sec = 0;
@@ -998,8 +1867,11 @@ progress_callback(char *prefix, float fraction_completed)
   /* figure out the ETA for the whole batch */
   batch_eta_hr = batch_eta_min = batch_eta_sec = 0;
   if (progress_info.batch_size != 0) {
-    kb_done = progress_info.finished_size
-      + fraction_completed * progress_info.file_sizes[progress_info.on_file];
+    if (on_file >= 0)
+      kb_done = progress_info.finished_size + progress_info.active_size;
+    else
+      kb_done = progress_info.finished_size
+	+ fraction_completed * progress_info.file_sizes[progress_info.on_file];
     batch_fraction = (float)kb_done / (float)progress_info.batch_size;
     time_spent = now - progress_info.batch_start;
     if (kb_done == 0)
@@ -1020,8 +1892,9 @@ progress_callback(char *prefix, float fraction_completed)
   }
 
 
-  /* if progress on current file is zero, don't do file ETA */
-  if (fraction_completed <= 0.0) {
+  /* if progress on current file is zero (or there are several current
+     files), don't do file ETA */
+  if (fraction_completed <= 0.0 || on_file >= 0) {
     if (progress_info.batch_size == 0) {
       /* if we don't have batch info, don't compute batch ETA either */
       sprintf(buf, _(" %-17s  --%% done, ETA --:--:-- (batch  --%% done, ETA --:--:--)"),
@@ -1043,6 +1916,7 @@ progress_callback(char *prefix, float fraction_completed)
   }
 
   fprintf(stderr, "%s \r", buf);
+  jobs_unlock();
 }
 
 /*
@@ -0,0 +1,355 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+#include "config.h"
+
+#include <stdio.h>
+#if STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#else
+# if HAVE_STDLIB_H
+#  include <stdlib.h>
+# endif
+# if HAVE_STRING_H
+#  include <string.h>
+# endif
+#endif
+#if HAVE_MATH_H
+# include <math.h>
+#endif
+
+#include "common.h"
+#include "smooth.h"
+
+extern void *xmalloc(size_t size);
+
+static const char *filter_names[] = { "mean", "median", "gaussian" };
+
+/*
+ * The mean filter keeps a running sum, adding each value as it comes
+ * in and subtracting it as it goes out.  So that the sum doesn't
+ * depend on the order the values came in (a long file is analyzed a
+ * piece at a time, and the pieces must agree with a single scan), it
+ * is kept exactly, in fixed point: whole + frac / 2^FRAC_BITS, in
+ * units of 2^scale, where scale is chosen so the whole part of the
+ * largest possible sum fits in FRAC_BITS bits.  Any bits of a value
+ * below the fractional part are dropped, the same way every time.
+ */
+#define FRAC_BITS 62
+#define FRAC_ONE ((uint64_t)1 << FRAC_BITS)
+
+static void
+split_value(const struct smoother *s, double value,
+	    uint64_t *whole, uint64_t *frac)
+{
+  double x;
+
+  x = ldexp(value, -s->scale);
+  *whole = (uint64_t)x;
+  *frac = (uint64_t)ldexp(x - (double)*whole, FRAC_BITS);
+}
+
+static void
+mean_add(struct smoother *s, double value)
+{
+  uint64_t whole, frac;
+
+  split_value(s, value, &whole, &frac);
+  s->whole += whole;
+  s->frac += frac;
+  if (s->frac >= FRAC_ONE) {
+    s->frac -= FRAC_ONE;
+    s->whole++;
+  }
+}
+
+static void
+mean_remove(struct smoother *s, double value)
+{
+  uint64_t whole, frac;
+
+  split_value(s, value, &whole, &frac);
+  s->whole -= whole;
+  if (s->frac < frac) {
+    s->frac += FRAC_ONE;
+    s->whole--;
+  }
+  s->frac -= frac;
+}
+
+/*
+ * The median filter keeps the lower half of the window in a max-heap
+ * and the upper half in a min-heap, with the lower half holding the
+ * extra value if there's an odd number.  The heaps hold indices into
+ * buf, and pos[i] says where index i is: at lo[pos[i]] if pos[i] is
+ * nonnegative, otherwise at hi[-1 - pos[i]].  So we can find and take
+ * out the oldest value, and put in a new one, in O(log n) time.
+ */
+#define LO 0
+#define HI 1
+
+static inline int
+heap_before(const struct smoother *s, int which, int a, int b)
+{
+  if (which == LO)
+    return s->buf[a] > s->buf[b];
+  return s->buf[a] < s->buf[b];
+}
+
+static inline void
+heap_set(struct smoother *s, int which, int p, int i)
+{
+  if (which == LO) {
+    s->lo[p] = i;
+    s->pos[i] = p;
+  } else {
+    s->hi[p] = i;
+    s->pos[i] = -1 - p;
+  }
+}
+
+static void
+heap_sift_up(struct smoother *s, int which, int p)
+{
+  int *heap = which == LO ? s->lo : s->hi;
+  int i = heap[p];
+
+  while (p > 0 && heap_before(s, which, i, heap[(p - 1) / 2])) {
+    heap_set(s, which, p, heap[(p - 1) / 2]);
+    p = (p - 1) / 2;
+  }
+  heap_set(s, which, p, i);
+}
+
+static void
+heap_sift_down(struct smoother *s, int which, int p)
+{
+  int *heap = which == LO ? s->lo : s->hi;
+  int n = which == LO ? s->nlo : s->nhi;
+  int i = heap[p];
+  int child;
+
+  for (;;) {
+    child = 2 * p + 1;
+    if (child >= n)
+      break;
+    if (child + 1 < n && heap_before(s, which, heap[child + 1], heap[child]))
+      child++;
+    if (!heap_before(s, which, heap[child], i))
+      break;
+    heap_set(s, which, p, heap[child]);
+    p = child;
+  }
+  heap_set(s, which, p, i);
+}
+
+static void
+heap_insert(struct smoother *s, int which, int i)
+{
+  int p;
+
+  p = which == LO ? s->nlo++ : s->nhi++;
+  heap_set(s, which, p, i);
+  heap_sift_up(s, which, p);
+}
+
+/* take out the index at position p of a heap, and return it */
+static int
+heap_remove(struct smoother *s, int which, int p)
+{
+  int *heap = which == LO ? s->lo : s->hi;
+  int n, i, last;
+
+  i = heap[p];
+  n = which == LO ? --s->nlo : --s->nhi;
+  if (p < n) {
+    /* fill the hole with the last one, and move that where it goes */
+    last = heap[n];
+    heap_set(s, which, p, last);
+    heap_sift_up(s, which, p);
+    if (heap[p] == last)
+      heap_sift_down(s, which, p);
+  }
+  return i;
+}
+
+static void
+median_balance(struct smoother *s)
+{
+  while (s->nlo > s->nhi + 1)
+    heap_insert(s, HI, heap_remove(s, LO, 0));
+  while (s->nhi > s->nlo)
+    heap_insert(s, LO, heap_remove(s, HI, 0));
+}
+
+static void
+median_add(struct smoother *s, int i)
+{
+  if (s->nlo == 0 || s->buf[i] <= s->buf[s->lo[0]])
+    heap_insert(s, LO, i);
+  else
+    heap_insert(s, HI, i);
+  median_balance(s);
+}
+
+static void
+median_remove(struct smoother *s, int i)
+{
+  if (s->pos[i] >= 0)
+    heap_remove(s, LO, s->pos[i]);
+  else
+    heap_remove(s, HI, -1 - s->pos[i]);
+  median_balance(s);
+}
+
+void
+smooth_init(struct smoother *s, int filter, int len, double max_value)
+{
+  double center, sigma, sum, d;
+  int e, j;
+
+  s->filter = filter;
+  s->len = len;
+  s->n = 0;
+  s->start = 0;
+  s->buf = (double *)xmalloc(len * sizeof(double));
+  s->lo = s->hi = s->pos = NULL;
+  s->kernel = NULL;
+
+  switch (filter) {
+  case SMOOTH_MEAN:
+    if (max_value <= 0)
+      max_value = 1.0;
+    frexp(max_value * len, &e);
+    s->scale = e - FRAC_BITS;
+    s->whole = s->frac = 0;
+    break;
+  case SMOOTH_MEDIAN:
+    s->lo = (int *)xmalloc(len * sizeof(int));
+    s->hi = (int *)xmalloc(len * sizeof(int));
+    s->pos = (int *)xmalloc(len * sizeof(int));
+    s->nlo = s->nhi = 0;
+    break;
+  case SMOOTH_GAUSSIAN:
+    /* the window spans three standard deviations either side */
+    s->kernel = (double *)xmalloc(len * sizeof(double));
+    center = (len - 1) / 2.0;
+    sigma = len / 6.0;
+    sum = 0;
+    for (j = 0; j < len; j++) {
+      d = (j - center) / sigma;
+      s->kernel[j] = exp(-0.5 * d * d);
+      sum += s->kernel[j];
+    }
+    for (j = 0; j < len; j++)
+      s->kernel[j] /= sum;
+    break;
+  }
+}
+
+void
+smooth_free(struct smoother *s)
+{
+  free(s->buf);
+  free(s->lo);
+  free(s->hi);
+  free(s->pos);
+  free(s->kernel);
+}
+
+int
+smooth_push(struct smoother *s, double value)
+{
+  int i, full;
+
+  full = s->n == s->len;
+  if (full) {
+    /* drop the oldest value, and put the new one in its place */
+    i = s->start;
+    if (s->filter == SMOOTH_MEAN)
+      mean_remove(s, s->buf[i]);
+    else if (s->filter == SMOOTH_MEDIAN)
+      median_remove(s, i);
+    s->start = (s->start + 1) % s->len;
+  } else {
+    i = (s->start + s->n) % s->len;
+    s->n++;
+  }
+
+  s->buf[i] = value;
+  if (s->filter == SMOOTH_MEAN)
+    mean_add(s, value);
+  else if (s->filter == SMOOTH_MEDIAN)
+    median_add(s, i);
+
+  return full;
+}
+
+double
+smooth_value(const struct smoother *s)
+{
+  double sum, wsum;
+  int i, j;
+
+  if (s->n == 0)
+    return 0.0;
+
+  switch (s->filter) {
+  case SMOOTH_MEDIAN:
+    if (s->nlo > s->nhi)
+      return s->buf[s->lo[0]];
+    return (s->buf[s->lo[0]] + s->buf[s->hi[0]]) / 2.0;
+  case SMOOTH_GAUSSIAN:
+    /* weight the values in order, oldest first */
+    sum = wsum = 0;
+    for (j = 0, i = s->start; j < s->n; j++, i++) {
+      if (i == s->len)
+	i = 0;
+      sum += s->kernel[j] * s->buf[i];
+      wsum += s->kernel[j];
+    }
+    return sum / wsum;
+  default:
+    sum = ldexp((double)s->whole + ldexp((double)s->frac, -FRAC_BITS),
+		s->scale);
+    return sum / s->n;
+  }
+}
+
+double
+smooth_get(const struct smoother *s, int i)
+{
+  return s->buf[(s->start + i) % s->len];
+}
+
+int
+smooth_parse_filter(const char *name)
+{
+  int i;
+
+  for (i = 0; i < (int)(sizeof(filter_names) / sizeof(filter_names[0])); i++)
+    if (strcmp(name, filter_names[i]) == 0)
+      return i;
+  return -1;
+}
+
+const char *
+smooth_filter_name(int filter)
+{
+  return filter_names[filter];
+}
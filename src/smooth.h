@@ -0,0 +1,89 @@
+/* Copyright (C) 1999--2005 Chris Vaill
+   This file is part of normalize.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
+
+/*
+ * Smoothing of the sequence of window powers, shared by the WAV and
+ * MP3 analyzers.  A smoother holds the last few values pushed into
+ * it, and gives the mean, median, or gaussian-weighted mean of them.
+ */
+
+#ifndef _SMOOTH_H_
+#define _SMOOTH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum smooth_filter {
+  SMOOTH_MEAN     = 0,
+  SMOOTH_MEDIAN   = 1,
+  SMOOTH_GAUSSIAN = 2
+};
+
+struct smoother {
+  int filter;
+  int len;          /* the window length */
+  int n;            /* values in the window, up to len */
+  int start;        /* buf index of the oldest value */
+  double *buf;
+
+  /* for the mean: the exact sum of the values (see smooth.c) */
+  int scale;
+  uint64_t whole;
+  uint64_t frac;
+
+  /* for the median: two heaps of buf indices, lower and upper halves */
+  int *lo, *hi;
+  int nlo, nhi;
+  int *pos;         /* where each buf index is in its heap */
+
+  /* for the gaussian: the weights, oldest value first */
+  double *kernel;
+};
+
+/*
+ * Set up a smoother for a window of len values.  The values pushed
+ * must be between 0 and max_value.
+ */
+void smooth_init(struct smoother *s, int filter, int len, double max_value);
+void smooth_free(struct smoother *s);
+
+/*
+ * Add a value to the window.  If the window was already full, the
+ * oldest value is dropped to make room, and TRUE is returned.
+ */
+int smooth_push(struct smoother *s, double value);
+
+/*
+ * The smoothed value of the window.  The cost doesn't grow with the
+ * window length, except for the gaussian.  If the window isn't full,
+ * we smooth what's there.
+ */
+double smooth_value(const struct smoother *s);
+
+/* the i'th oldest value in the window */
+double smooth_get(const struct smoother *s, int i);
+
+/* the filter with the given name, or -1 if there's none */
+int smooth_parse_filter(const char *name);
+const char *smooth_filter_name(int filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMOOTH_H_ */
@@ -15,7 +15,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*/
 
-#define _POSIX_C_SOURCE 2
+#define _POSIX_C_SOURCE 199506L
 
 #include "config.h"
 
@@ -51,6 +51,9 @@
 #else
 # include "wiener_af.h"
 #endif
+#if USE_PTHREADS
+# include <pthread.h>
+#endif
 
 #ifdef ENABLE_NLS
 # define _(msgid) gettext (msgid)
@@ -61,6 +64,11 @@
 #define N_(msgid) (msgid)
 
 #include "common.h"
+#include "jobs.h"
+#include "kernels.h"
+#include "smooth.h"
+#include "loudness.h"
+#include "checkpoint.h"
 
 #undef DEBUG
 
@@ -74,6 +82,15 @@ extern void *xmalloc(size_t size);
 
 extern char *progname;
 extern int verbose;
+extern int file_jobs;
+extern long io_block_size;
+extern int sample_histogram;
+extern int true_peak_meter;
+extern int smooth_filter;
+extern int use_lufs;
+extern int use_checkpoints;
+extern int use_raw;
+extern struct raw_format raw_format;
 
 static inline long
 get_sample(unsigned char *pdata, int bytes_per_sample)
@@ -108,76 +125,722 @@ get_sample(unsigned char *pdata, int bytes_per_sample)
 }
 
 
-typedef struct {
-  double *buf;
-  int buflen;  /* elements allocated to buffer */
-  int start;   /* index of first element in buffer */
-  int n;       /* num of elements in buffer */
-} datasmooth_t;
+/*
+ * For a long file, the analysis can be split among several threads,
+ * each scanning its own segment of the file.  A segment is always a
+ * whole number of 1/100 second windows, so every window's power is
+ * computed from exactly the same samples as in a single scan.  The
+ * smoothing windows that straddle the boundary between two segments
+ * are filled in afterwards from the powers at either side, so the
+ * result is bit-for-bit the same as a single scan of the file.
+ */
+#define MIN_SEGMENT_WINDOWS 1000  /* don't bother with segments < 10 sec */
+
+struct segment {
+  struct scan *sc;
+  AFframecount start, end;  /* frames [start, end) of the file */
+  AFframecount done;        /* the end of the last window scanned */
+  struct smoother *powsmooth; /* smoothing state for each channel */
+  double *head;             /* powers of the first smoothing window */
+  int nhead;                /*   (head[c * buflen + i] for channel c) */
+  double maxpow;
+  long max_sample, min_sample;
+  uint64_t *hist;           /* sample counts, or NULL (see signal_info) */
+  struct truepeak tp;
+  char *prefix;             /* progress meter prefix, or NULL */
+  int status;               /* 0 if ok, -1 on a read error or short read */
+#if USE_PTHREADS
+  pthread_t thread;
+  int started;
+#endif
+};
+
+struct scan {
+  AFfilehandle fh;
+  int channels;
+  int bytes_per_sample;
+  int framesz;
+  unsigned int windowsz;
+  int buflen;               /* smoothing window length, in windows */
+  double maxpow;            /* the largest possible window power */
+  int block_windows;        /* windows read from the file at a time */
+  AFframecount framecount;
+  int nsegments;
+  int hist_bins;            /* 0 if we're not counting samples */
+  int hist_shift;
+  int truepeak;             /* TRUE if we're metering the true peak */
+  float tp_scale;           /* what takes samples to fractions of full scale */
+  struct loudness *loudness; /* for --loudness=lufs, or NULL */
+  char *prefix;             /* progress meter prefix, or NULL */
+};
 
 /*
- * Takes a full smoothing window, and returns the value of the center
- * element, smoothed.  Currently, just does a mean filter, but we could
- * do a median or gaussian filter here instead.
+ * Scan the windows of one segment, keeping track of the peaks and the
+ * maximum smoothed power.  Only the first segment has a progress meter
+ * prefix; the others are the same size and run alongside it.
  */
-static inline double
-get_smoothed_data(datasmooth_t *s)
+static int
+scan_segment(struct segment *seg)
 {
-  int i;
-  /*int center = (s->n + 1) / 2;*/
-  double smoothed;
+  struct scan *sc = seg->sc;
+  AFframecount win_start, win_end, block_left, want;
+  int last_window;
+  int c, frames_recvd, framesz;
+  struct sumsq *sums;
+  double pow;
+  struct smoother *powsmooth = seg->powsmooth;
+  unsigned char *data_buf;
+  const unsigned char *win_data;
+#if !USE_AUDIOFILE
+  const void *frames;
+#endif
+  float progress, last_progress = 0.0;
+
+  framesz = sc->framesz;
+  sums = (struct sumsq *)xmalloc(sc->channels * sizeof(struct sumsq));
+  data_buf = (unsigned char *)xmalloc(sc->block_windows
+				      * sc->windowsz * framesz);
+
+  /*
+   * win_start, win_end, and windowsz are in units of frames.  c is in
+   * units of channels.
+   *
+   * The actual window extends from win_start to win_end - 1, inclusive.
+   *
+   * We read block_windows windows at a time, and block_left is the
+   * number of frames of the block we haven't looked at yet.  Blocks
+   * are a whole number of windows, so a window only comes up short
+   * at the end of the data.
+   */
+  win_start = seg->start;
+  win_data = data_buf;
+  block_left = 0;
+  last_window = FALSE;
+  seg->status = 0;
+
+#if !USE_AUDIOFILE && HAVE_PREAD
+  /*
+   * The true-peak filter needs to have seen the samples just before
+   * the segment, to come up with what a single scan would.  What it
+   * makes of those samples is the previous segment's business.
+   */
+  if (sc->truepeak && seg->start > 0) {
+    float max = seg->tp.max;
+
+    want = TRUEPEAK_TAPS - 1;
+    if (want > seg->start)
+      want = seg->start;
+    if (afReadFramesAtDirect(sc->fh, AF_DEFAULT_TRACK, seg->start - want,
+			     data_buf, want, &frames) != want)
+      goto error;
+    truepeak_samples(frames, want, sc->channels, sc->bytes_per_sample,
+		     sc->tp_scale, &seg->tp);
+    seg->tp.max = max;
+  }
+#endif
+
+  do {
+
+    if (block_left == 0) {
+      /* a segment with no end goes on until the data does */
+      want = (AFframecount)sc->block_windows * sc->windowsz;
+      if (seg->end >= 0 && seg->end - win_start < want)
+	want = seg->end - win_start;
+
+      if (sc->nsegments == 1 && seg->start == 0) {
+#if !USE_AUDIOFILE
+	/* straight out of the file's memory mapping, if possible */
+	frames_recvd = afReadFramesDirect(sc->fh, AF_DEFAULT_TRACK,
+					  data_buf, want, &frames);
+	win_data = (const unsigned char *)frames;
+#else
+	frames_recvd = afReadFrames(sc->fh, AF_DEFAULT_TRACK, data_buf, want);
+#endif
+	if (frames_recvd == -1)
+	  goto error;
+	if (frames_recvd == 0)
+	  break;
+      } else {
+#if !USE_AUDIOFILE && HAVE_PREAD
+	/* read from our own part of the file */
+	frames_recvd = afReadFramesAtDirect(sc->fh, AF_DEFAULT_TRACK,
+					    win_start, data_buf, want,
+					    &frames);
+	/*
+	 * The data chunk should never come up short here, except at
+	 * the end of the file, which may be shorter than its header
+	 * says.
+	 */
+	if (frames_recvd == -1
+	    || (frames_recvd != want && seg->end != sc->framecount))
+	  goto error;
+	if (frames_recvd == 0)
+	  break;
+	win_data = (const unsigned char *)frames;
+#endif
+      }
+      block_left = frames_recvd;
+    }
+
+    /* set up the window end */
+    win_end = win_start + sc->windowsz;
+    if (seg->end >= 0 && win_end >= seg->end) {
+      win_end = seg->end;
+      last_window = TRUE;
+    }
+    /* the file may be shorter than its header says */
+    if (win_end - win_start > block_left)
+      win_end = win_start + block_left;
+
+    /* sum the squares and track the peaks, all channels at once */
+    scan_samples(win_data, win_end - win_start, sc->channels,
+		 sc->bytes_per_sample, sums,
+		 &seg->max_sample, &seg->min_sample);
+    if (sc->truepeak)
+      truepeak_samples(win_data, win_end - win_start, sc->channels,
+		       sc->bytes_per_sample, sc->tp_scale, &seg->tp);
+    if (sc->loudness)
+      loudness_add(sc->loudness, win_data, win_end - win_start,
+		   sc->bytes_per_sample);
+    if (seg->hist)
+      histogram_samples(win_data, (win_end - win_start) * sc->channels,
+			sc->bytes_per_sample, sc->hist_shift,
+			seg->hist + sc->hist_bins / 2);
+    win_data += (win_end - win_start) * framesz;
+    block_left -= win_end - win_start;
+    seg->done = win_end;
 
-  smoothed = 0;
-  for (i = 0; i < s->n; i++)
-    smoothed += s->buf[i];
-  smoothed = smoothed / s->n;
+    /* compute power for each channel */
+    for (c = 0; c < sc->channels; c++) {
+      pow = sumsq_value(&sums[c]) / (double)(win_end - win_start);
 
-  return smoothed;
+      /* keep the segment's first smoothing window for stitching */
+      if (seg->nhead < sc->buflen)
+	seg->head[c * sc->buflen + seg->nhead] = pow;
+
+      if (smooth_push(&powsmooth[c], pow)) {
+	pow = smooth_value(&powsmooth[c]);
+	if (pow > seg->maxpow)
+	  seg->maxpow = pow;
+      }
+    }
+    if (seg->nhead < sc->buflen)
+      seg->nhead++;
+
+    /* update progress meter */
+    if (seg->prefix) {
+      if (seg->end - seg->start - sc->windowsz == 0)
+	progress = 0;
+      else
+	progress = (win_end - seg->start - sc->windowsz)
+	  / (float)(seg->end - seg->start - sc->windowsz);
+      if (progress >= last_progress + 0.01) {
+	progress_callback(seg->prefix, progress);
+	last_progress += 0.01;
+      }
+    }
+
+    /* slide the window ahead */
+    win_start += sc->windowsz;
+
+  } while (!last_window);
+
+  free(data_buf);
+  free(sums);
+  return 0;
+
+ error:
+  seg->status = -1;
+  free(data_buf);
+  free(sums);
+  return -1;
 }
 
+#if USE_PTHREADS
+static void *
+scan_thread(void *arg)
+{
+  scan_segment((struct segment *)arg);
+  return NULL;
+}
+#endif
+
+static void
+init_segment(struct segment *seg, struct scan *sc,
+	     AFframecount start, AFframecount end, long samplemax)
+{
+  int c;
+
+  seg->sc = sc;
+  seg->start = start;
+  seg->end = end;
+  seg->done = start;
+  seg->maxpow = 0.0;
+  /* initialize peaks to effectively -inf and +inf */
+  seg->max_sample = -samplemax - 1;
+  seg->min_sample = samplemax;
+  seg->prefix = sc->prefix;
+  seg->status = 0;
+  seg->nhead = 0;
+  seg->head = (double *)xmalloc(sc->channels * sc->buflen * sizeof(double));
+  memset(&seg->tp, 0, sizeof(seg->tp));
+  seg->hist = NULL;
+  if (sc->hist_bins) {
+    seg->hist = (uint64_t *)xmalloc(sc->hist_bins * sizeof(uint64_t));
+    memset(seg->hist, 0, sc->hist_bins * sizeof(uint64_t));
+  }
+
+  /* set up smoothing window buffer */
+  seg->powsmooth = (struct smoother *)xmalloc(sc->channels
+					      * sizeof(struct smoother));
+  for (c = 0; c < sc->channels; c++)
+    smooth_init(&seg->powsmooth[c], smooth_filter, sc->buflen, sc->maxpow);
+}
+
+static void
+free_segment(struct segment *seg)
+{
+  int c;
+
+  for (c = 0; c < seg->sc->channels; c++)
+    smooth_free(&seg->powsmooth[c]);
+  free(seg->powsmooth);
+  free(seg->head);
+  free(seg->hist);
+}
+
+/* pick up a scan where a checkpoint left off */
+static void
+resume_segment(struct segment *seg, const struct checkpoint *ck)
+{
+  int c, i;
+
+  for (c = 0; c < seg->sc->channels; c++)
+    for (i = 0; i < ck->nvalues; i++)
+      smooth_push(&seg->powsmooth[c], ck->values[c * ck->nvalues + i]);
+  seg->maxpow = ck->maxpow;
+  seg->max_sample = ck->max_sample;
+  seg->min_sample = ck->min_sample;
+  if (seg->sc->truepeak)
+    seg->tp.max = ck->true_peak;
+}
 
 /*
- * Get the maximum power level of the file
- * (and the peak sample info, if si is not NULL)
+ * Split frames [start, end) of the file into nsegments segments, and
+ * scan them concurrently.  If resume isn't NULL, the first segment
+ * picks up where it left off.  Returns 0 on success, -1 if any
+ * segment couldn't be read.
  */
-double
-signal_max_power(char *filename, struct signal_info *si)
+static int
+scan_segments(struct scan *sc, struct segment *segs,
+	      AFframecount start, AFframecount end, long samplemax,
+	      const struct checkpoint *resume)
 {
-  AFfilehandle fhin;
-  AFframecount framecount;
-  int samp_fmt, samp_width;
+  AFframecount nwindows, seg_start, seg_end;
+  int s;
+
+  nwindows = (end - start + sc->windowsz - 1) / sc->windowsz;
+  seg_start = start;
+  for (s = 0; s < sc->nsegments; s++) {
+    if (s == sc->nsegments - 1)
+      seg_end = end;
+    else
+      seg_end = start + nwindows * (s + 1) / sc->nsegments * sc->windowsz;
+    init_segment(&segs[s], sc, seg_start, seg_end, samplemax);
+    if (s > 0)
+      segs[s].prefix = NULL;
+    seg_start = seg_end;
+  }
+  if (resume)
+    resume_segment(&segs[0], resume);
 
-  int bytes_per_sample, framesz, frames_recvd;
-  int last_window;
-  unsigned int windowsz;
-  unsigned int win_start, old_start, win_end, old_end;
+#if USE_PTHREADS
+  for (s = 1; s < sc->nsegments; s++)
+    segs[s].started = pthread_create(&segs[s].thread, NULL,
+				     scan_thread, &segs[s]) == 0;
+#endif
+  scan_segment(&segs[0]);
+  for (s = 1; s < sc->nsegments; s++) {
+#if USE_PTHREADS
+    if (segs[s].started) {
+      pthread_join(segs[s].thread, NULL);
+      continue;
+    }
+#endif
+    /* no thread for this one, so do it ourselves */
+    scan_segment(&segs[s]);
+  }
+
+  for (s = 0; s < sc->nsegments; s++)
+    if (segs[s].status != 0)
+      return -1;
+  return 0;
+}
 
-  int i, c, end, offset;
-  long sample, samplemax, samplemin;
-  double *sums;
+/*
+ * Compute the smoothed powers for the smoothing windows that span the
+ * start of each segment after the first.  Every segment is at least
+ * one smoothing window long, so the end of the previous segment holds
+ * everything we need.
+ */
+static double
+stitch_segments(struct scan *sc, struct segment *segs)
+{
+  struct smoother ring;
+  double pow, maxpow;
+  int s, c, i;
+
+  maxpow = 0.0;
+  for (s = 1; s < sc->nsegments; s++) {
+    for (c = 0; c < sc->channels; c++) {
+      /* pick up where the previous segment left off */
+      smooth_init(&ring, smooth_filter, sc->buflen, sc->maxpow);
+      for (i = 0; i < sc->buflen; i++)
+	smooth_push(&ring, smooth_get(&segs[s - 1].powsmooth[c], i));
+      for (i = 0; i < segs[s].nhead; i++) {
+	smooth_push(&ring, segs[s].head[c * sc->buflen + i]);
+	pow = smooth_value(&ring);
+	if (pow > maxpow)
+	  maxpow = pow;
+      }
+      smooth_free(&ring);
+    }
+  }
+
+  return maxpow;
+}
+
+#if !USE_AUDIOFILE && HAVE_PREAD
+/*
+ * Hash the smoothing window's worth of frames before frame end with
+ * FNV-1a, so we can tell if a checkpoint still applies to the file.
+ */
+static int
+hash_frames(struct scan *sc, AFframecount end, uint64_t *phash)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  AFframecount start;
+  unsigned char *buf;
+  const void *frames;
+  const unsigned char *p;
+  int n, i;
+
+  start = end - (AFframecount)sc->buflen * sc->windowsz;
+  if (start < 0)
+    start = 0;
+  n = end - start;
+  buf = (unsigned char *)xmalloc(n * sc->framesz + 1);
+  if (afReadFramesAtDirect(sc->fh, AF_DEFAULT_TRACK, start, buf, n,
+			   &frames) != n) {
+    free(buf);
+    return -1;
+  }
+  p = (const unsigned char *)frames;
+  for (i = 0; i < n * sc->framesz; i++)
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  free(buf);
+  *phash = h;
+  return 0;
+}
+
+/*
+ * Whether the checkpoint ck can be resumed from: it must be for a file
+ * of the same format, stop at a window boundary no later than end, and
+ * the frames before that boundary must be the ones it saw.
+ */
+static int
+checkpoint_fits(struct scan *sc, struct signal_info *si,
+		const struct checkpoint *ck, AFframecount end)
+{
+  uint64_t hash;
+
+  if (ck->channels != si->channels
+      || ck->bits_per_sample != si->bits_per_sample
+      || ck->samples_per_sec != si->samples_per_sec)
+    return FALSE;
+  if (ck->frames <= 0 || ck->frames > end || ck->frames % sc->windowsz != 0)
+    return FALSE;
+  /* the smoother is only short of full at the start of the file */
+  if (ck->nvalues > sc->buflen
+      || (ck->nvalues < sc->buflen
+	  && ck->frames != (AFframecount)ck->nvalues * sc->windowsz))
+    return FALSE;
+  if (sc->truepeak && ck->true_peak < 0)
+    return FALSE;
+  return hash_frames(sc, ck->frames, &hash) == 0 && hash == ck->hash;
+}
+
+/*
+ * Save where the scan stands, which is at the end of seg, the last
+ * segment.  maxpow and the peaks in si are those of the whole file so
+ * far.
+ */
+static void
+save_checkpoint(char *filename, struct scan *sc, struct signal_info *si,
+		struct segment *seg, double maxpow, double true_peak)
+{
+  struct checkpoint ck;
+  int c, i;
+
+  ck.channels = si->channels;
+  ck.bits_per_sample = si->bits_per_sample;
+  ck.samples_per_sec = si->samples_per_sec;
+  ck.frames = seg->done;
+  ck.maxpow = maxpow;
+  ck.max_sample = si->max_sample;
+  ck.min_sample = si->min_sample;
+  ck.true_peak = sc->truepeak ? true_peak : -1.0;
+  ck.nvalues = seg->powsmooth[0].n;
+  if (ck.nvalues == 0 || hash_frames(sc, ck.frames, &ck.hash) == -1)
+    return;
+  ck.values = (double *)xmalloc(sc->channels * ck.nvalues * sizeof(double));
+  for (c = 0; c < sc->channels; c++)
+    for (i = 0; i < ck.nvalues; i++)
+      ck.values[c * ck.nvalues + i] = smooth_get(&seg->powsmooth[c], i);
+
+  if (checkpoint_save(filename, &ck) == -1 && verbose >= VERBOSE_PROGRESS)
+    fprintf(stderr, _("%s: Warning: unable to save a checkpoint for %s: %s\n"),
+	    progname, filename, strerror(errno));
+  checkpoint_free(&ck);
+}
+
+/*
+ * With --fast, we estimate the level from a sample of the file's
+ * smoothing windows.  The file is cut into as many equal strata as we
+ * have spans to read, and a whole smoothing window is read from a
+ * random place in each one, lined up with the windows of a full scan,
+ * so each span's power is one of the powers a full scan would see.
+ *
+ * The largest power we find is a lower bound on the level, and it's
+ * what we report.  For an upper bound, we go by the top of the
+ * distribution of the span powers, in decibels: if the gaps between
+ * the largest values are exponentially distributed, as they are for
+ * most distributions, their spread tells us how far past the largest
+ * one we saw the file's largest could be.  When the powers can't go
+ * much higher than the largest we saw, this overestimates, which only
+ * means we scan the file in full more often than we need to.
+ */
+#define FAST_MIN_SPANS 20     /* fewer than this tell us too little */
+#define FAST_TAIL 10          /* how many of the top gaps to look at */
+#define FAST_Q_HI 2.9702      /* the 95% point of the Gumbel distribution */
+
+/* a small, repeatable random number generator (xorshift64*) */
+static uint64_t
+next_random(uint64_t *state)
+{
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static int
+compare_descending(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/*
+ * Bound the maximum power, given the powers of n spans sampled from
+ * nspans, in dB.  Sorts db.  Returns -1 if there's too little to go
+ * on.
+ */
+static int
+estimate_max(double *db, int n, double nspans, double *lo, double *hi)
+{
+  double beta, r;
+  int i, k;
+
+  qsort(db, n, sizeof(double), compare_descending);
+  k = FAST_TAIL;
+  if (k > n - 1)
+    k = n - 1;
+  /* silent spans don't count */
+  while (k > 0 && db[k] == -HUGE_VAL)
+    k--;
+  if (k < 2)
+    return -1;
+
+  /* the scale of the tail: i times the gap below the i'th largest */
+  beta = 0.0;
+  for (i = 1; i <= k; i++)
+    beta += i * (db[i - 1] - db[i]);
+  beta /= k;
+
+  /* the largest of nspans exceeds the largest of n by about beta r */
+  r = log(nspans / n);
+  *lo = db[0];
+  *hi = db[0] + beta * (r + FAST_Q_HI);
+  /* nothing is louder than a full scale square wave */
+  if (*hi > 0.0)
+    *hi = 0.0;
+  return 0;
+}
+
+/*
+ * Estimate the level of the file from a fraction of its spans.
+ * Returns the estimated power, or -1 if the file should be scanned in
+ * full instead.
+ */
+static double
+sample_spans(struct scan *sc, struct signal_info *si, double fraction,
+	     long samplemin)
+{
+  AFframecount nwindows, npos, pos, want;
+  double nspans, *db, value, maxpow, lo, hi;
+  struct smoother *powsmooth;
+  struct sumsq *sums;
+  unsigned char *data_buf;
+  const unsigned char *data;
+  const void *frames;
+  uint64_t seed;
+  int n, k, c, w, ret;
+
+  nwindows = sc->framecount / sc->windowsz;
+  nspans = (double)nwindows / sc->buflen;
+  n = (int)ceil(fraction * nspans);
+  if (n < FAST_MIN_SPANS)
+    n = FAST_MIN_SPANS;
+  /* if we'd read half the file anyway, we might as well read it all */
+  if (n > nspans / 2)
+    return -1.0;
+  npos = nwindows - sc->buflen + 1;
+
+  want = (AFframecount)sc->buflen * sc->windowsz;
+  data_buf = (unsigned char *)xmalloc(want * sc->framesz);
+  db = (double *)xmalloc(n * sizeof(double));
+  sums = (struct sumsq *)xmalloc(sc->channels * sizeof(struct sumsq));
+  powsmooth = (struct smoother *)xmalloc(sc->channels
+					 * sizeof(struct smoother));
+
+  /* the same file gets the same sample every time */
+  seed = 0x9E3779B97F4A7C15ULL ^ (uint64_t)sc->framecount;
+  si->max_sample = samplemin;
+  si->min_sample = -samplemin - 1;
+  ret = 0;
+  for (k = 0; k < n && ret == 0; k++) {
+    pos = npos * k / n;
+    pos += next_random(&seed) % (npos * (k + 1) / n - pos);
+    if (afReadFramesAtDirect(sc->fh, AF_DEFAULT_TRACK, pos * sc->windowsz,
+			     data_buf, want, &frames) != want) {
+      ret = -1;
+      break;
+    }
+    data = (const unsigned char *)frames;
+
+    maxpow = 0.0;
+    for (c = 0; c < sc->channels; c++)
+      smooth_init(&powsmooth[c], smooth_filter, sc->buflen, sc->maxpow);
+    for (w = 0; w < sc->buflen; w++) {
+      scan_samples(data, sc->windowsz, sc->channels, sc->bytes_per_sample,
+		   sums, &si->max_sample, &si->min_sample);
+      data += sc->windowsz * sc->framesz;
+      for (c = 0; c < sc->channels; c++)
+	smooth_push(&powsmooth[c],
+		    sumsq_value(&sums[c]) / (double)sc->windowsz);
+    }
+    for (c = 0; c < sc->channels; c++) {
+      value = smooth_value(&powsmooth[c]);
+      if (value > maxpow)
+	maxpow = value;
+      smooth_free(&powsmooth[c]);
+    }
+    db[k] = maxpow > 0.0 ? 10 * log10(maxpow / sc->maxpow) : -HUGE_VAL;
+
+    if (sc->prefix)
+      progress_callback(sc->prefix, (k + 1) / (float)n);
+  }
+  if (ret == 0)
+    ret = estimate_max(db, n, nspans, &lo, &hi);
+
+  free(powsmooth);
+  free(sums);
+  free(db);
+  free(data_buf);
+  if (ret == -1)
+    return -1.0;
+
+  si->level = si->level_lo = DBTOFRAC(lo);
+  si->level_hi = DBTOFRAC(hi);
+  if (-si->min_sample > si->max_sample)
+    si->peak = si->min_sample / (double)samplemin;
+  else
+    si->peak = si->max_sample / (double)(-samplemin - 1);
+  return si->level * si->level;
+}
+#endif
+
+/*
+ * Measure the file, or, if fraction isn't zero, try to estimate its
+ * level from that fraction of it.
+ */
+static double
+measure_file(char *filename, struct signal_info *si, double fraction)
+{
+  AFfilehandle fhin;
+  AFfilesetup setup;
+  int samp_fmt, samp_width, stream;
+  struct scan sc;
+  struct segment *segs, *last;
+  struct checkpoint ck, *resume;
+  AFframecount start, whole;
+  int checkpointing, scanned;
+
+  int s, c, b;
+  long samplemax, samplemin;
   double pow, maxpow;
-  datasmooth_t *powsmooth;
-  unsigned char *data_buf = NULL;
 
-  float progress, last_progress = 0.0;
   char prefix_buf[18];
 #if USE_MAD
   char *suffix;
+  int i;
+#endif
+
+  /* "-" is the standard input, which we can only read straight through */
+  stream = strcmp(filename, "-") == 0;
 
+#if USE_MAD
   i = strlen(filename);
-  if (i >= 4) {
+  if (i >= 4 && !use_raw) {
     suffix = filename + i - 4;
     if (strncaseeq(suffix, ".mp3", 4))
-      return signal_max_power_mp3(filename, si);
+      return fraction > 0 ? -1.0 : signal_max_power_mp3(filename, si);
   }
 #endif
-#if DEBUG
-  unsigned long total_frames_recvd = 0;
-#endif
 
-  fhin = afOpenFile(filename, "r", NULL);
+  si->hist = NULL;
+  si->level_lo = si->level_hi = 0.0;
+
+  /* headerless input is in whatever format we were told */
+  setup = AF_NULL_FILESETUP;
+  if (use_raw) {
+    setup = afNewFileSetup();
+    afInitFileFormat(setup, AF_FILE_RAWDATA);
+    afInitChannels(setup, AF_DEFAULT_TRACK, raw_format.channels);
+    afInitRate(setup, AF_DEFAULT_TRACK, raw_format.samples_per_sec);
+    afInitSampleFormat(setup, AF_DEFAULT_TRACK,
+		       raw_format.is_signed
+		       ? AF_SAMPFMT_TWOSCOMP : AF_SAMPFMT_UNSIGNED,
+		       raw_format.bits_per_sample);
+    afInitByteOrder(setup, AF_DEFAULT_TRACK,
+		    raw_format.big_endian
+		    ? AF_BYTEORDER_BIGENDIAN : AF_BYTEORDER_LITTLEENDIAN);
+  }
+  if (stream)
+    fhin = afOpenFD(fileno(stdin), "r", setup);
+  else
+    fhin = afOpenFile(filename, "r", setup);
+  if (setup != AF_NULL_FILESETUP)
+    afFreeFileSetup(setup);
   if (fhin == AF_NULL_FILEHANDLE)
     goto error1;
+#if !USE_AUDIOFILE
+  /* a file we keep checkpoints for may be rewritten while we read it */
+  if (use_checkpoints && !stream)
+    afUnmapFile(fhin);
+#endif
 
   /* pass back format info in *si */
   afGetSampleFormat(fhin, AF_DEFAULT_TRACK, &samp_fmt, &samp_width);
@@ -188,143 +851,213 @@ signal_max_power(char *filename, struct signal_info *si)
   /* set virtual format to be always 2's complement */
   afSetVirtualSampleFormat(fhin, AF_DEFAULT_TRACK, AF_SAMPFMT_TWOSCOMP, samp_width);
 
-  bytes_per_sample = (si->bits_per_sample - 1) / 8 + 1;
-  samplemax = (1 << (bytes_per_sample * 8 - 1)) - 1;
+  sc.fh = fhin;
+  sc.channels = si->channels;
+  sc.bytes_per_sample = (si->bits_per_sample - 1) / 8 + 1;
+  samplemax = (1 << (sc.bytes_per_sample * 8 - 1)) - 1;
   samplemin = -samplemax - 1;
-  framecount = afGetFrameCount(fhin, AF_DEFAULT_TRACK);
+  /* this is negative for a stream that doesn't say how long it is */
+  sc.framecount = afGetFrameCount(fhin, AF_DEFAULT_TRACK);
 
-  /* initialize peaks to effectively -inf and +inf */
-  si->max_sample = samplemin;
-  si->min_sample = samplemax;
 #if DEBUG
   if (verbose >= VERBOSE_DEBUG) {
     fprintf(stderr,
 	    "bytes_per_sample: %d framecount: %ld\n"
 	    "samplemax: %ld samplemin: %ld\n",
-	    bytes_per_sample, framecount, samplemax, samplemin);
+	    sc.bytes_per_sample, (long)sc.framecount, samplemax, samplemin);
   }
 #endif
 
-  sums = (double *)xmalloc(si->channels * sizeof(double));
-  for (c = 0; c < si->channels; c++)
-    sums[c] = 0;
-
-  /* set up buffer to hold 1/100 of a second worth of frames */
-  windowsz = (unsigned int)(si->samples_per_sec / 100);
+  /* 1/100 of a second worth of frames */
+  sc.windowsz = (unsigned int)(si->samples_per_sec / 100);
   /* we care about the virtual frame size, not the format's particular
      frame size, which might be zero */
   /*framesz = afGetFrameSize(fhin, AF_DEFAULT_TRACK, 1);*/
-  framesz = si->channels * bytes_per_sample;
+  sc.framesz = si->channels * sc.bytes_per_sample;
   /* We use 4 bytes for 24-bit samples, adjust the frame size */
-  if (bytes_per_sample == 3)
-    framesz += si->channels;
-  data_buf = (unsigned char *)xmalloc(windowsz * framesz);
+  if (sc.bytes_per_sample == 3)
+    sc.framesz += si->channels;
+  sc.buflen = 100; /* use a 100-element (1 second) smoothing window */
+  sc.maxpow = samplemin * (double)samplemin;
 
-  /* set up smoothing window buffer */
-  powsmooth = (datasmooth_t *)xmalloc(si->channels * sizeof(datasmooth_t));
-  for (c = 0; c < si->channels; c++) {
-    powsmooth[c].buflen = 100; /* use a 100-element (1 second) window */
-    powsmooth[c].buf = (double *)xmalloc(powsmooth[c].buflen * sizeof(double));
-    powsmooth[c].start = powsmooth[c].n = 0;
+  /*
+   * Count the samples by value, if asked.  Samples of 16 bits or less
+   * get a bin for each value; for wider ones, we only keep the top 16
+   * bits.
+   */
+  sc.hist_bins = sc.hist_shift = 0;
+  if (sample_histogram) {
+    if (sc.bytes_per_sample > 2)
+      sc.hist_shift = sc.bytes_per_sample * 8 - 16;
+    sc.hist_bins = 1 << (sc.bytes_per_sample * 8 - sc.hist_shift);
+  }
+
+  /* meter the peaks between the samples, too, if asked and we can */
+  sc.truepeak = true_peak_meter && si->channels <= TRUEPEAK_CHANNELS;
+  sc.tp_scale = 1.0f / -samplemin;
+
+  /* read as many whole windows at a time as fit in a block */
+  sc.block_windows = 1;
+  if (sc.windowsz * sc.framesz > 0)
+    sc.block_windows = io_block_size / (sc.windowsz * sc.framesz);
+  if (sc.block_windows < 1)
+    sc.block_windows = 1;
+
+  /*
+   * Measure the integrated loudness too, if asked.  Its filters have
+   * to see the whole file in order, so we can't split it up.
+   */
+  sc.loudness = NULL;
+  if (use_lufs) {
+    sc.loudness = loudness_new(si->channels, si->samples_per_sec,
+			       si->bits_per_sample);
+    if (sc.loudness == NULL) {
+      fprintf(stderr, _("%s: can't measure the loudness of %s\n"),
+	      progname, filename);
+      afCloseFile(fhin);
+      goto error1;
+    }
   }
 
-  /* initialize progress meter */
-  if (verbose >= VERBOSE_PROGRESS) {
+  /* initialize progress meter; a background job keeps quiet */
+  sc.prefix = NULL;
+  if (verbose >= VERBOSE_PROGRESS && !job_in_background()
+      && sc.framecount >= 0) {
     strncpy(prefix_buf, basename(filename), 17);
     prefix_buf[17] = '\0';
     progress_callback(prefix_buf, 0.0);
-    last_progress = 0.0;
+    sc.prefix = prefix_buf;
   }
 
-
+#if !USE_AUDIOFILE && HAVE_PREAD
   /*
-   * win_start, win_end, old_start, windowsz, interval, and i are in
-   * units of frames.  c is in units of channels.
-   *
-   * The actual window extends from win_start to win_end - 1, inclusive.
+   * Read a sample of the file if we can.  The loudness and the sample
+   * counts need every sample.
    */
-  old_start = win_start = 0;
-  win_end = 0;
-  last_window = FALSE;
-  maxpow = 0.0;
-
-  do {
-
-    /* set up the window end */
-    old_end = win_end;
-    win_end = win_start + windowsz;
-    if (win_end >= framecount) {
-      win_end = framecount;
-      last_window = TRUE;
+  if (fraction > 0 && !stream && sc.windowsz > 0 && sc.loudness == NULL
+      && sc.hist_bins == 0) {
+    maxpow = sample_spans(&sc, si, fraction, samplemin);
+    if (maxpow >= 0) {
+      afCloseFile(fhin);
+      return maxpow;
     }
+  }
+#endif
 
-    /* read a windowsz sized chunk of frames */
-    frames_recvd = afReadFrames(fhin, AF_DEFAULT_TRACK, data_buf, windowsz);
-#if DEBUG
-    printf("frames: %d\n", frames_recvd);
+  /*
+   * With --checkpoint, pick up where the last run left off, if all
+   * that's happened to the file since is that more was added to it,
+   * and stop at the last whole window to save where we got to.  The
+   * loudness and the sample counts aren't kept in checkpoints.
+   */
+  start = 0;
+  whole = sc.framecount;
+  resume = NULL;
+  checkpointing = FALSE;
+#if !USE_AUDIOFILE && HAVE_PREAD
+  if (use_checkpoints && !stream && !use_raw && sc.windowsz > 0
+      && sc.loudness == NULL && sc.hist_bins == 0) {
+    checkpointing = TRUE;
+    whole -= whole % sc.windowsz;
+    if (checkpoint_load(filename, &ck) == 0) {
+      if (checkpoint_fits(&sc, si, &ck, whole)) {
+	resume = &ck;
+	start = ck.frames;
+      } else
+	checkpoint_free(&ck);
+    }
+  }
 #endif
-    if (frames_recvd == -1)
-      goto error2;
-    if (frames_recvd == 0)
-      break;
 
-#if DEBUG
-    total_frames_recvd += frames_recvd;
+  /* split the file up if we've been given threads to spare */
+  sc.nsegments = 1;
+#if USE_PTHREADS && !USE_AUDIOFILE && HAVE_PREAD
+  if (file_jobs > 1 && !stream && sc.windowsz > 0 && sc.loudness == NULL) {
+    sc.nsegments = (whole - start) / sc.windowsz / MIN_SEGMENT_WINDOWS;
+    if (sc.nsegments > file_jobs)
+      sc.nsegments = file_jobs;
+    if (sc.nsegments < 1)
+      sc.nsegments = 1;
+  }
 #endif
 
-    for (c = 0; c < si->channels; c++) {
-      sums[c] = 0;
-      offset = c * (framesz / si->channels);
-      for (i = 0; i < (win_end - win_start); i++) {
-	sample = get_sample(data_buf + offset, bytes_per_sample);
-	offset += framesz;
-	sums[c] += sample * (double)sample;
-	/* track peak */
-	if (sample > si->max_sample)
-	  si->max_sample = sample;
-	if (sample < si->min_sample)
-	  si->min_sample = sample;
-      }
+  segs = (struct segment *)xmalloc(sc.nsegments * sizeof(struct segment));
+  scanned = FALSE;
+  if (sc.nsegments > 1 || start > 0) {
+    scanned = scan_segments(&sc, segs, start, whole, samplemax, resume) == 0;
+    if (resume)
+      checkpoint_free(resume);
+    if (!scanned) {
+      /*
+       * Something is wrong with the file (it may have been cut
+       * short, say), so go back and read it the ordinary way, which
+       * knows how to cope.
+       */
+      for (s = 0; s < sc.nsegments; s++)
+	free_segment(&segs[s]);
+      sc.nsegments = 1;
+      start = 0;
+      whole = sc.framecount;
+      checkpointing = FALSE;
     }
+  }
+  if (!scanned) {
+    init_segment(&segs[0], &sc, 0, whole, samplemax);
+    if (scan_segment(&segs[0]) == -1)
+      goto error2;
+  }
+  last = &segs[sc.nsegments - 1];
 
-    /* compute power for each channel */
-    for (c = 0; c < si->channels; c++) {
-      pow = sums[c] / (double)(win_end - win_start);
-
-      end = (powsmooth[c].start + powsmooth[c].n) % powsmooth[c].buflen;
-      powsmooth[c].buf[end] = pow;
-      if (powsmooth[c].n == powsmooth[c].buflen) {
-	powsmooth[c].start = (powsmooth[c].start + 1) % powsmooth[c].buflen;
-	pow = get_smoothed_data(&powsmooth[c]);
-	if (pow > maxpow)
-	  maxpow = pow;
-      } else {
-	powsmooth[c].n++;
-      }
-    }
+  /* put the pieces back together */
+  maxpow = stitch_segments(&sc, segs);
+  si->max_sample = samplemin;
+  si->min_sample = samplemax;
+  si->true_peak = 0.0;
+  for (s = 0; s < sc.nsegments; s++) {
+    if (segs[s].maxpow > maxpow)
+      maxpow = segs[s].maxpow;
+    if (segs[s].tp.max > si->true_peak)
+      si->true_peak = segs[s].tp.max;
+    if (segs[s].max_sample > si->max_sample)
+      si->max_sample = segs[s].max_sample;
+    if (segs[s].min_sample < si->min_sample)
+      si->min_sample = segs[s].min_sample;
+  }
 
-    /* update progress meter */
-    if (verbose >= VERBOSE_PROGRESS) {
-      if (framecount - windowsz == 0)
-	progress = 0;
-      else
-	progress = (win_end - windowsz) / (float)(framecount - windowsz);
-      if (progress >= last_progress + 0.01) {
-	progress_callback(prefix_buf, progress);
-	last_progress += 0.01;
-      }
+#if !USE_AUDIOFILE && HAVE_PREAD
+  if (checkpointing && last->done == whole) {
+    if (whole > start)
+      save_checkpoint(filename, &sc, si, last, maxpow, si->true_peak);
+
+    /* finish off the last, partial window, which it doesn't cover */
+    if (whole < sc.framecount) {
+      last->prefix = NULL;
+      last->start = whole;
+      last->end = sc.framecount;
+      if (scan_segment(last) == -1)
+	goto error2;
+      if (last->maxpow > maxpow)
+	maxpow = last->maxpow;
+      if (last->tp.max > si->true_peak)
+	si->true_peak = last->tp.max;
+      if (last->max_sample > si->max_sample)
+	si->max_sample = last->max_sample;
+      if (last->min_sample < si->min_sample)
+	si->min_sample = last->min_sample;
     }
-
-    /* slide the window ahead */
-    old_start = win_start;
-    win_start += windowsz;
-
-  } while (!last_window);
-
-#if DEBUG
-    printf("%lu samples read\n", total_frames_recvd * si->channels);
+  }
 #endif
 
+  if (sc.hist_bins) {
+    si->hist = segs[0].hist;
+    si->hist_bins = sc.hist_bins;
+    si->hist_shift = sc.hist_shift;
+    segs[0].hist = NULL;
+    for (s = 1; s < sc.nsegments; s++)
+      for (b = 0; b < sc.hist_bins; b++)
+	si->hist[b] += segs[s].hist[b];
+  }
+
   if (maxpow < EPSILON) {
     /*
      * Either this whole file has zero power, or was too short to ever
@@ -332,27 +1065,35 @@ signal_max_power(char *filename, struct signal_info *si)
      * get maxpow from whatever data we did collect.
      */
     for (c = 0; c < si->channels; c++) {
-      pow = get_smoothed_data(&powsmooth[c]);
+      pow = smooth_value(&last->powsmooth[c]);
       if (pow > maxpow)
 	maxpow = pow;
     }
   }
 
-  for (c = 0; c < si->channels; c++)
-    free(powsmooth[c].buf);
-  free(powsmooth);
-  free(data_buf);
-  free(sums);
+  for (s = 0; s < sc.nsegments; s++)
+    free_segment(&segs[s]);
+  free(segs);
 
   /* scale the pow value to be in the range 0.0 -- 1.0 */
   maxpow = maxpow / (samplemin * (double)samplemin);
 
+  /* or go by the integrated loudness */
+  if (sc.loudness) {
+    maxpow = loudness_level(sc.loudness);
+    maxpow = maxpow * maxpow;
+    loudness_free(sc.loudness);
+  }
+
   /* fill in the signal_info struct */
   si->level = sqrt(maxpow);
   if (-si->min_sample > si->max_sample)
     si->peak = si->min_sample / (double)samplemin;
   else
     si->peak = si->max_sample / (double)samplemax;
+  /* the sample peak is a lower bound on the true peak */
+  if (sc.truepeak && si->true_peak < si->peak)
+    si->true_peak = si->peak;
 
   afCloseFile(fhin);
 
@@ -360,173 +1101,146 @@ signal_max_power(char *filename, struct signal_info *si)
 
   /* error handling stuff */
  error2:
-  for (c = 0; c < si->channels; c++)
-    free(powsmooth[c].buf);
-  free(powsmooth);
-  free(data_buf);
-  free(sums);
+  for (s = 0; s < sc.nsegments; s++)
+    free_segment(&segs[s]);
+  free(segs);
+  loudness_free(sc.loudness);
   afCloseFile(fhin);
  error1:
   return -1.0;
 }
 
-#if 0
 /*
- * Get the maximum power level of the data read from a stream
- * (and the peak sample, if ppeak is not NULL)
+ * Get the maximum power level of the file
+ * (and the peak sample info, if si is not NULL)
  */
 double
-signal_max_power_stream(FILE *in, char *filename, struct signal_info *si)
-
+signal_max_power(char *filename, struct signal_info *si)
 {
-  struct wavfmt *fmt;
-  int bytes_per_sample;
-  int last_window;
-  unsigned int windowsz;
-  unsigned int win_start, old_start, win_end, old_end;
-
-  int i, c;
-  long sample, samplemax, samplemin;
-  double *sums;
-  double pow, maxpow;
-  datasmooth_t *powsmooth;
-
-  char prefix_buf[18];
-
-  unsigned char *data_buf = NULL;
-  int filled_sz;
-
-  if (filename == NULL || strcmp(filename, "-") == 0)
-    filename = "STDIN";
-
-  /* WAV format info must be passed to us in si->fmt */
-  fmt = &si->fmt;
-
-  windowsz = (unsigned int)(fmt->samples_per_sec / 100);
-
-  bytes_per_sample = (fmt->bits_per_sample - 1) / 8 + 1;
-  samplemax = (1 << (bytes_per_sample * 8 - 1)) - 1;
-  samplemin = -samplemax - 1;
-  /* initialize peaks to effectively -inf and +inf */
-  si->max_sample = samplemin;
-  si->min_sample = samplemax;
-
-  sums = (double *)xmalloc(fmt->channels * sizeof(double));
-  for (c = 0; c < fmt->channels; c++)
-    sums[c] = 0;
-
-  data_buf = (unsigned char *)xmalloc(windowsz
-				      * fmt->channels * bytes_per_sample);
-
-  /* set up smoothing window buffer */
-  powsmooth = (datasmooth_t *)xmalloc(fmt->channels * sizeof(datasmooth_t));
-  for (c = 0; c < fmt->channels; c++) {
-    powsmooth[c].buflen = 100; /* use a 100-element (1 second) window */
-    powsmooth[c].buf = (double *)xmalloc(powsmooth[c].buflen * sizeof(double));
-    powsmooth[c].start = powsmooth[c].n = 0;
-  }
-
-  /* initialize progress meter */
-  if (verbose >= VERBOSE_PROGRESS) {
-    strncpy(prefix_buf, basename(filename), 17);
-    prefix_buf[17] = 0;
-    progress_callback(prefix_buf, 0.0);
-  }
-
-
-  /*
-   * win_start, win_end, old_start, windowsz, interval, and i are in
-   * units of samples.  c is in units of channels.
-   *
-   * The actual window extends from win_start to win_end - 1, inclusive.
-   */
-  old_start = win_start = 0;
-  win_end = 0;
-  last_window = FALSE;
-  maxpow = 0.0;
-
-  do {
+  return measure_file(filename, si, 0.0);
+}
 
-    /* set up the window end */
-    old_end = win_end;
-    win_end = win_start + windowsz;
+/*
+ * Estimate the level of the file from the given fraction of it, as
+ * for --fast.  si->level_lo and si->level_hi are set to the likely
+ * bounds on the level, and the peaks are only those of the part that
+ * was read.  Returns -1 if the file can't be sampled, or is too short
+ * for sampling to pay, in which case it should be scanned in full.
+ */
+double
+signal_max_power_sampled(char *filename, struct signal_info *si,
+			 double fraction)
+{
+  return measure_file(filename, si, fraction);
+}
 
-    /* read a windowsz sized chunk */
-    filled_sz = fread(data_buf, bytes_per_sample,
-		      windowsz * fmt->channels, in);
+/*
+ * The number of samples counted in the histograms of sis[0..n-1].
+ */
+uint64_t
+histogram_total(const struct signal_info *sis, int n)
+{
+  uint64_t total = 0;
+  int i, b;
+
+  for (i = 0; i < n; i++)
+    if (sis[i].hist)
+      for (b = 0; b < sis[i].hist_bins; b++)
+	total += sis[i].hist[b];
+  return total;
+}
 
-    /* if we couldn't read a complete chunk, then this is the last chunk */
-    if (filled_sz < windowsz * fmt->channels) {
-      win_end = win_start + (filled_sz / fmt->channels);
-      last_window = TRUE;
-    }
+/*
+ * The number of counted samples in sis[0..n-1] that would be clipped
+ * by applying gain, by the same rules _do_apply_gain() uses.  Samples
+ * of more than 16 bits are counted in ranges of values, so for them
+ * this is only an estimate.
+ */
+uint64_t
+histogram_clippings(const struct signal_info *sis, int n, double gain)
+{
+  const struct signal_info *si;
+  uint64_t nclipped = 0;
+  long samplemax, samplemin, v;
+  double sample_d;
+  int i, b, half, bytes, rounded;
+
+  /* no clipping is done unless the gain is more than 1 */
+  if (gain <= 1.0)
+    return 0;
+
+  for (i = 0; i < n; i++) {
+    si = &sis[i];
+    if (si->hist == NULL)
+      continue;
+    bytes = (si->bits_per_sample - 1) / 8 + 1;
+    samplemax = (1L << (bytes * 8 - 1)) - 1;
+    samplemin = -samplemax - 1;
+    half = si->hist_bins / 2;
+#if USE_LOOKUPTABLE
+    /* the lookup table rounds before it clips */
+    rounded = bytes <= 2;
+#else
+    rounded = FALSE;
+#endif
 
-    for (c = 0; c < fmt->channels; c++) {
-      sums[c] = 0;
-      for (i = 0; i < (win_end - win_start); i++) {
-	sample = get_sample(data_buf + (i * fmt->channels * bytes_per_sample)
-			    + (c * bytes_per_sample), bytes_per_sample);
-	sums[c] += sample * (double)sample;
-	/* track peak */
-	if (sample > si->max_sample)
-	  si->max_sample = sample;
-	if (sample < si->min_sample)
-	  si->min_sample = sample;
-      }
+    /* the largest samples clip first, so work in from either end */
+    for (b = si->hist_bins - 1; b >= half; b--) {
+      v = (long)(b - half) * (1L << si->hist_shift);
+      if (si->hist_shift)
+	v += 1L << (si->hist_shift - 1);
+      sample_d = rounded ? ROUND(v * gain) : v * gain;
+      if (sample_d <= samplemax)
+	break;
+      nclipped += si->hist[b];
     }
-
-    /* compute power for each channel */
-    for (c = 0; c < fmt->channels; c++) {
-      int end;
-      pow = sums[c] / (double)(win_end - win_start);
-
-      end = (powsmooth[c].start + powsmooth[c].n) % powsmooth[c].buflen;
-      powsmooth[c].buf[end] = pow;
-      if (powsmooth[c].n == powsmooth[c].buflen) {
-	powsmooth[c].start = (powsmooth[c].start + 1) % powsmooth[c].buflen;
-	pow = get_smoothed_data(&powsmooth[c]);
-	if (pow > maxpow)
-	  maxpow = pow;
-      } else {
-	powsmooth[c].n++;
-      }
+    for (b = 0; b < half; b++) {
+      v = (long)(b - half) * (1L << si->hist_shift);
+      if (si->hist_shift)
+	v += 1L << (si->hist_shift - 1);
+      sample_d = rounded ? ROUND(v * gain) : v * gain;
+      if (sample_d >= samplemin)
+	break;
+      nclipped += si->hist[b];
     }
+  }
 
-    /* slide the window ahead */
-    old_start = win_start;
-    win_start += windowsz;
+  return nclipped;
+}
 
-  } while (!last_window);
+/*
+ * The largest gain that clips no more than budget (a fraction) of the
+ * samples counted in sis[0..n-1].  Returns 0 if no gain would clip
+ * that many.
+ */
+double
+histogram_max_gain(const struct signal_info *sis, int n, double budget)
+{
+  uint64_t allowed;
+  double lo, hi, mid;
+  int i;
 
-  if (maxpow < EPSILON) {
-    /*
-     * Either this whole file has zero power, or was too short to ever
-     * fill the smoothing buffer.  In the latter case, we need to just
-     * get maxpow from whatever data we did collect.
-     */
-    for (c = 0; c < fmt->channels; c++) {
-      pow = get_smoothed_data(&powsmooth[c]);
-      if (pow > maxpow)
-	maxpow = pow;
-    }
+  allowed = (uint64_t)(budget * histogram_total(sis, n));
+
+  /* find a gain that's too much */
+  lo = 1.0;
+  hi = 2.0;
+  while (histogram_clippings(sis, n, hi) <= allowed) {
+    lo = hi;
+    hi *= 2.0;
+    /* more than enough to clip anything but silence */
+    if (hi > 4294967296.0)
+      return 0.0;
   }
 
-  for (c = 0; c < fmt->channels; c++)
-    free(powsmooth[c].buf);
-  free(powsmooth);
-  free(data_buf);
-  free(sums);
-
-  /* scale the pow value to be in the range 0.0 -- 1.0 */
-  maxpow = maxpow / (samplemin * (double)samplemin);
-
-  /* fill in the signal_info struct */
-  si->level = sqrt(maxpow);
-  if (-si->min_sample > si->max_sample)
-    si->peak = si->min_sample / (double)samplemin;
-  else
-    si->peak = si->max_sample / (double)samplemax;
+  /* and close in on the largest one that isn't */
+  for (i = 0; i < 50; i++) {
+    mid = (lo + hi) / 2.0;
+    if (histogram_clippings(sis, n, mid) <= allowed)
+      lo = mid;
+    else
+      hi = mid;
+  }
 
-  return maxpow;
+  return lo;
 }
-#endif
@@ -20,7 +20,8 @@
  * library for those who don't have the real thing.
  */
 
-#define _POSIX_C_SOURCE 2
+#define _XOPEN_SOURCE 600
+#define _GNU_SOURCE /* for fallocate() */
 
 #include "config.h"
 
@@ -57,6 +58,12 @@
 #if HAVE_FCNTL_H
 # include <fcntl.h>
 #endif
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
 #if HAVE_BYTESWAP_H
 # include <byteswap.h>
 #else
@@ -81,6 +88,7 @@
 
 #include "riff.h"
 #include "wiener_af.h"
+#include "kernels.h"
 
 extern char *progname;
 
@@ -115,8 +123,167 @@ struct _AFfilehandle {
   riff_chunk_t data_chnk;
   struct wavfmt fmt;
   enum openmode mode;
+
+  /*
+   * WAV data is little-endian, and unsigned for 8 bits or less, but
+   * raw data can be anything.
+   */
+  int file_format;
+  int byte_order;
+  int sample_format;
+  int keep_samples;         /* leave samples as they are in the file */
+
+  /* for a stream we can't seek in, such as a pipe */
+  int streaming;
+  int length_unknown;       /* the header didn't say how much data */
+  off_t stream_left;        /* bytes of data still to come, if known */
+
+  /* for reading, the whole file if we could map it, and our place in it */
+  unsigned char *map;
+  size_t map_len;
+  off_t map_pos;
 };
 
+#if HAVE_MMAP && HAVE_SYS_MMAN_H
+/*
+ * If we're reading a regular file, map it into memory, so reads
+ * become a matter of copying from the mapping, or for samples that
+ * need no conversion, just pointing into it.  Pipes, and anything
+ * else we can't map, are read through stdio as usual.
+ */
+static void
+_afMapFile(AFfilehandle fh, int fd)
+{
+  struct stat st;
+  void *p;
+
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    return;
+  /* the file might be too big to map on a 32-bit system */
+  if ((off_t)(size_t)st.st_size != st.st_size)
+    return;
+  p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    return;
+#if HAVE_POSIX_MADVISE
+  posix_madvise(p, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+  fh->map = (unsigned char *)p;
+  fh->map_len = (size_t)st.st_size;
+  fh->map_pos = fh->data_chnk.offset;
+}
+#endif
+
+/* read and throw away n bytes of a stream */
+static int
+_afSkipStream(FILE *fp, uint32_t n)
+{
+  char buf[1024];
+  size_t want;
+
+  while (n > 0) {
+    want = n < sizeof(buf) ? n : sizeof(buf);
+    if (fread(buf, 1, want, fp) < want)
+      return -1;
+    n -= want;
+  }
+  return 0;
+}
+
+/*
+ * Find the format and the start of the data in a WAV stream we can't
+ * seek in, by reading through the chunks before the data.  A program
+ * writing a WAV file to a pipe can't know how long it will be, so it
+ * may give the data's size as 0 or 0xFFFFFFFF, and then we read until
+ * the stream ends.
+ */
+static int
+_afReadStreamHeader(AFfilehandle fh)
+{
+  FILE *fp = riff_stream(fh->riff);
+  unsigned char hdr[12];
+  uint32_t size;
+  int have_fmt = 0;
+
+  if (fread(hdr, 12, 1, fp) < 1
+      || memcmp(hdr, "RIFF", 4) != 0 || memcmp(hdr + 8, "WAVE", 4) != 0) {
+    fprintf(stderr, _("%s: WAV header not found\n"), progname);
+    return -1;
+  }
+
+  for (;;) {
+    if (fread(hdr, 8, 1, fp) < 1)
+      break;
+    size = hdr[4] | hdr[5] << 8 | hdr[6] << 16 | (uint32_t)hdr[7] << 24;
+
+    if (memcmp(hdr, "data", 4) == 0) {
+      if (!have_fmt)
+	break;
+      fh->data_chnk.offset = 0;
+      fh->data_chnk.size = size;
+      fh->length_unknown = size == 0 || size == 0xFFFFFFFF;
+      fh->stream_left = size;
+      return 0;
+    }
+
+    /* chunks are padded to an even length */
+    size += size & 1;
+    if (memcmp(hdr, "fmt ", 4) == 0 && size >= sizeof(struct wavfmt)) {
+      if (fread(&fh->fmt, sizeof(struct wavfmt), 1, fp) < 1)
+	break;
+      size -= sizeof(struct wavfmt);
+      have_fmt = 1;
+    }
+    if (_afSkipStream(fp, size) == -1)
+      break;
+  }
+
+  if (have_fmt)
+    fprintf(stderr, _("%s: WAV data not found\n"), progname);
+  else
+    fprintf(stderr, _("%s: WAV header not found\n"), progname);
+  return -1;
+}
+
+/* set up to read raw sample data in the format setup describes */
+static int
+_afInitRaw(AFfilehandle fh, AFfilesetup setup, int fd)
+{
+  struct stat st;
+  int bytes_per_sample;
+
+  if (setup->sample_width < 1 || setup->sample_width > 32
+      || (setup->sample_format != AF_SAMPFMT_TWOSCOMP
+	  && setup->sample_format != AF_SAMPFMT_UNSIGNED)
+      || setup->nchannels < 1 || setup->rate < 1) {
+    /* bad setup error -- shouldn't happen in normalize */
+    fprintf(stderr, "%s: internal error: bad file format\n", progname);
+    return -1;
+  }
+
+  fh->fmt.format_tag = 1;
+  fh->fmt.channels = setup->nchannels;
+  fh->fmt.samples_per_sec = setup->rate;
+  fh->fmt.bits_per_sample = setup->sample_width;
+  bytes_per_sample = (fh->fmt.bits_per_sample - 1) / 8 + 1;
+  fh->fmt.block_align = bytes_per_sample * fh->fmt.channels;
+  fh->fmt.avg_bytes_per_sec = fh->fmt.block_align * fh->fmt.samples_per_sec;
+  fh->file_format = AF_FILE_RAWDATA;
+  fh->byte_order = setup->byte_order;
+  fh->sample_format = setup->sample_format;
+
+  /* the data is the whole file, or the whole stream */
+  fh->data_chnk.offset = 0;
+  fh->data_chnk.size = 0xFFFFFFFF;
+  fh->length_unknown = 1;
+  if (!fh->streaming && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    if (st.st_size < 0xFFFFFFFF)
+      fh->data_chnk.size = st.st_size;
+    fh->length_unknown = 0;
+  }
+  fh->stream_left = fh->data_chnk.size;
+  return 0;
+}
 
 AFfilehandle
 afOpenFile(const char *filename, const char *mode, AFfilesetup setup)
@@ -149,6 +316,10 @@ afOpenFD(int fd, const char *mode, AFfilesetup setup)
     fprintf(stderr, _("%s: unable to malloc\n"), progname);
     goto error1;
   }
+  memset(newfh, 0, sizeof(struct _AFfilehandle));
+  newfh->map = NULL;
+  newfh->file_format = AF_FILE_WAVE;
+  newfh->byte_order = AF_BYTEORDER_LITTLEENDIAN;
 
   if (mode[0] == 'w') {
 
@@ -176,6 +347,8 @@ afOpenFD(int fd, const char *mode, AFfilesetup setup)
       }
     }
 
+    newfh->sample_format = setup->sample_format;
+
     /* construct WAV fmt header from setup struct */
     fmt = &newfh->fmt;
     fmt->format_tag = 1;
@@ -207,6 +380,17 @@ afOpenFD(int fd, const char *mode, AFfilesetup setup)
      * open for writing
      */
 
+    /*
+     * If we can't go back and fill in the sizes of the chunks when
+     * we're done, as on a pipe, we say the sizes aren't known, as
+     * WAV streams do.  Appending would put the sizes at the end.
+     */
+    newfh->streaming = lseek(fd, 0, SEEK_CUR) == -1 && errno == ESPIPE;
+#if defined(F_GETFL) && defined(O_APPEND)
+    if ((ret = fcntl(fd, F_GETFL)) != -1 && (ret & O_APPEND))
+      newfh->streaming = 1;
+#endif
+
     riff = riff_fdopen(fd, RIFF_WRONLY);
     if (riff == NULL) {
       fprintf(stderr, _("%s: error opening WAV file: %s\n"),
@@ -216,7 +400,7 @@ afOpenFD(int fd, const char *mode, AFfilesetup setup)
 
     newfh->top_chnk.id = RIFFID_RIFF;
     newfh->top_chnk.type = riff_string_to_fourcc("WAVE");
-    newfh->top_chnk.size = 0;
+    newfh->top_chnk.size = newfh->streaming ? 0xFFFFFFFF : 0;
     if (riff_create_chunk(riff, &newfh->top_chnk) == -1) {
       fprintf(stderr, _("%s: error writing: %s\n"), progname, strerror(errno));
       goto error3;
@@ -224,7 +408,7 @@ afOpenFD(int fd, const char *mode, AFfilesetup setup)
 
     /* write WAV fmt header */
     newfh->fmt_chnk.id = riff_string_to_fourcc("fmt ");
-    newfh->fmt_chnk.size = 0;
+    newfh->fmt_chnk.size = sizeof(struct wavfmt);
     riff_create_chunk(riff, &newfh->fmt_chnk);
     if (fwrite(fmt, sizeof(struct wavfmt), 1, riff_stream(riff)) < 1) {
       fprintf(stderr, "%s: unable to write WAV header: %s\n",
@@ -235,7 +419,7 @@ afOpenFD(int fd, const char *mode, AFfilesetup setup)
 
     /* start data chunk */
     newfh->data_chnk.id = riff_string_to_fourcc("data");
-    newfh->data_chnk.size = 0;
+    newfh->data_chnk.size = newfh->streaming ? 0xFFFFFFFF : 0;
     riff_create_chunk(riff, &newfh->data_chnk);
 
     newfh->riff = riff;
@@ -253,23 +437,40 @@ afOpenFD(int fd, const char *mode, AFfilesetup setup)
 	      progname, strerror(errno));
       goto error2;
     }
-
-    riff_descend(riff, &newfh->top_chnk, NULL, RIFF_SRCH_OFF);
-    newfh->fmt_chnk.id = riff_string_to_fourcc("fmt ");
-    ret = riff_descend(riff, &newfh->fmt_chnk, NULL, RIFF_SRCH_FLAT);
-    if (ret == -1) {
-      fprintf(stderr, _("%s: error searching for WAV header: %s\n"),
-	      progname, strerror(errno));
-      goto error3;
-    } else if (ret == 0) {
-      fprintf(stderr, _("%s: WAV header not found\n"), progname);
-      goto error3;
+    newfh->riff = riff;
+    newfh->mode = AF_RDONLY;
+    newfh->streaming = lseek(fd, 0, SEEK_CUR) == -1 && errno == ESPIPE;
+
+    if (setup && setup->format == AF_FILE_RAWDATA) {
+      if (_afInitRaw(newfh, setup, fd) == -1)
+	goto error3;
+#if HAVE_MMAP && HAVE_SYS_MMAN_H
+      if (!newfh->streaming)
+	_afMapFile(newfh, fd);
+#endif
+      return newfh;
     }
 
     /* WAV format info will be passed back */
     fmt = &newfh->fmt;
 
-    fread(fmt, sizeof(struct wavfmt), 1, riff_stream(riff));
+    if (newfh->streaming) {
+      if (_afReadStreamHeader(newfh) == -1)
+	goto error3;
+    } else {
+      riff_descend(riff, &newfh->top_chnk, NULL, RIFF_SRCH_OFF);
+      newfh->fmt_chnk.id = riff_string_to_fourcc("fmt ");
+      ret = riff_descend(riff, &newfh->fmt_chnk, NULL, RIFF_SRCH_FLAT);
+      if (ret == -1) {
+	fprintf(stderr, _("%s: error searching for WAV header: %s\n"),
+		progname, strerror(errno));
+	goto error3;
+      } else if (ret == 0) {
+	fprintf(stderr, _("%s: WAV header not found\n"), progname);
+	goto error3;
+      }
+      fread(fmt, sizeof(struct wavfmt), 1, riff_stream(riff));
+    }
 #ifdef WORDS_BIGENDIAN
     fmt->format_tag        = bswap_16(fmt->format_tag);
     fmt->channels          = bswap_16(fmt->channels);
@@ -307,6 +508,11 @@ afOpenFD(int fd, const char *mode, AFfilesetup setup)
     }
 #endif
 
+    newfh->sample_format = (fmt->bits_per_sample <= 8
+			    ? AF_SAMPFMT_UNSIGNED : AF_SAMPFMT_TWOSCOMP);
+    if (newfh->streaming)
+      return newfh;
+
     riff_ascend(riff, &newfh->fmt_chnk);
     newfh->data_chnk.id = riff_string_to_fourcc("data");
     ret = riff_descend(riff, &newfh->data_chnk, NULL, RIFF_SRCH_FLAT);
@@ -319,8 +525,9 @@ afOpenFD(int fd, const char *mode, AFfilesetup setup)
       goto error3;
     }
 
-    newfh->riff = riff;
-    newfh->mode = AF_RDONLY;
+#if HAVE_MMAP && HAVE_SYS_MMAN_H
+    _afMapFile(newfh, fd);
+#endif
   }
 
   return newfh;
@@ -338,8 +545,15 @@ int
 afCloseFile(AFfilehandle fh)
 {
   if (fh) {
-    riff_ascend(fh->riff, &fh->data_chnk);
-    riff_ascend(fh->riff, &fh->top_chnk);
+#if HAVE_MMAP && HAVE_SYS_MMAN_H
+    if (fh->map)
+      munmap(fh->map, fh->map_len);
+#endif
+    /* fill in the chunk sizes, if we can */
+    if (!(fh->mode == AF_WRONLY && fh->streaming)) {
+      riff_ascend(fh->riff, &fh->data_chnk);
+      riff_ascend(fh->riff, &fh->top_chnk);
+    }
     riff_close(fh->riff);
     free(fh);
   }
@@ -381,57 +595,38 @@ _afGetFrameSize(AFfilehandle fh, int track, int expand3to4)
   return bytes_per_sample * fh->fmt.channels;
 }
 
-int
-afReadFrames(AFfilehandle fh, int track, void *buffer, int frame_count)
+/*
+ * Convert frames just read from the file into the virtual format
+ * (twos complement, host byte order, 24-bit samples in 32 bits).
+ */
+static void
+_afConvertFrames(AFfilehandle fh, void *buffer, int frames_recvd)
 {
-  int framesize, frames_recvd, samples_recvd, i;
-  int offset_current, bytes_remaining, frames_remaining;
-  int8_t *psrc, *pdest;
-  int8_t *p8;
+  int samples_recvd, bytes_per_sample;
 #ifdef WORDS_BIGENDIAN
+  int i;
   int32_t *p32;
   int16_t *p16;
 #endif
 
-  framesize = _afGetFrameSize(fh, track, 0);
-
-  /* FIXME: need to update this for large file support */
-  offset_current = ftell(riff_stream(fh->riff));
-  bytes_remaining = fh->data_chnk.offset + fh->data_chnk.size - offset_current;
-  if (bytes_remaining < 0)
-    bytes_remaining = 0;
-  frames_remaining = bytes_remaining / framesize;
-
-  if (frames_remaining < frame_count)
-    frame_count = frames_remaining;
+  if (fh->keep_samples)
+    return;
 
-  frames_recvd = fread(buffer, framesize, frame_count, riff_stream(fh->riff));
   samples_recvd = frames_recvd * fh->fmt.channels;
+  bytes_per_sample = (fh->fmt.bits_per_sample - 1) / 8 + 1;
+
+  /* big-endian raw data is made little-endian, like WAV data, first */
+  if (fh->byte_order == AF_BYTEORDER_BIGENDIAN && bytes_per_sample > 1)
+    swap_bytes(buffer, samples_recvd, bytes_per_sample);
 
   if (fh->fmt.bits_per_sample <= 8) {
     /* 8-bit WAV samples are unsigned (0-255), but normalize wants
      * twos complement, so we adjust.  See afSetVirtualSampleFormat() */
-    p8 = (int8_t *)buffer;
-    for (i = 0; i < samples_recvd; i++) {
-      *p8 = *((uint8_t *)p8) - 128;
-      p8++;
-    }
+    if (fh->sample_format == AF_SAMPFMT_UNSIGNED)
+      flip_sign8(buffer, samples_recvd);
   } else if (fh->fmt.bits_per_sample > 16 && fh->fmt.bits_per_sample <= 24) {
     /* align 24-bit samples on 32-bit boundaries */
-
-    /* point to 3-byte values (source) */
-    psrc = (int8_t *)buffer + (samples_recvd - 1) * 3;
-    /* point to 4-byte values (dest) */
-    pdest = (int8_t *)buffer + (samples_recvd - 1) * 4;
-
-    for (i = 0; i < samples_recvd; i++) {
-      pdest[3] = (psrc[2] & 0x80) ? 0xFF : 0x00;
-      pdest[2] = psrc[2];
-      pdest[1] = psrc[1];
-      pdest[0] = psrc[0];
-      psrc -= 3;
-      pdest -= 4;
-    }
+    expand24(buffer, samples_recvd);
   }
 
 #ifdef WORDS_BIGENDIAN
@@ -451,29 +646,227 @@ afReadFrames(AFfilehandle fh, int track, void *buffer, int frame_count)
     }
   } /* else fh->fmt.bits_per_sample <= 8, so no swapping necessary */
 #endif
+}
+
+/*
+ * Do the samples in the file need changing to get them into the
+ * virtual format?
+ */
+static int
+_afNeedsConversion(AFfilehandle fh)
+{
+  int bits = fh->fmt.bits_per_sample;
+
+  if (fh->keep_samples)
+    return 0;
+  if ((bits <= 8 && fh->sample_format == AF_SAMPFMT_UNSIGNED)
+      || (bits > 16 && bits <= 24))
+    return 1;
+  if (bits > 8 && fh->byte_order == AF_BYTEORDER_BIGENDIAN)
+    return 1;
+#ifdef WORDS_BIGENDIAN
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/*
+ * Get up to frame_count frames starting at byte offset pos of the
+ * mapped file.  If pframes is given and the frames can be used just
+ * as they are, *pframes is pointed at them in the mapping; otherwise
+ * they're copied into buffer and converted.
+ *
+ * Touching a page of the mapping past the end of the file raises
+ * SIGBUS, so if the file has been truncated since we mapped it (a
+ * growing file being rewritten, say), only what's left of it is read,
+ * and the read comes up short as it would through stdio.  That only
+ * narrows the window, though; files we expect to change, such as those
+ * we keep checkpoints for, aren't mapped at all (see afUnmapFile()).
+ */
+static int
+_afReadMapped(AFfilehandle fh, off_t pos, void *buffer, int frame_count,
+	      const void **pframes)
+{
+  int framesize, bytes_per_sample;
+  off_t data_end, bytes_remaining, file_len;
+  const unsigned char *p;
+  struct stat st;
+
+  framesize = _afGetFrameSize(fh, AF_DEFAULT_TRACK, 0);
+  bytes_per_sample = (fh->fmt.bits_per_sample - 1) / 8 + 1;
+
+  file_len = (off_t)fh->map_len;
+  if (fstat(fileno(riff_stream(fh->riff)), &st) == -1)
+    file_len = 0;
+  else if (st.st_size < file_len)
+    file_len = st.st_size;
+
+  /* the data chunk may claim more than the file really holds */
+  data_end = fh->data_chnk.offset + (off_t)fh->data_chnk.size;
+  if (data_end > file_len)
+    data_end = file_len;
+  bytes_remaining = data_end - pos;
+  if (bytes_remaining < 0)
+    bytes_remaining = 0;
+  if (bytes_remaining / framesize < frame_count)
+    frame_count = bytes_remaining / framesize;
+
+  /* packed 24-bit samples are only ever copied out, so can go anywhere */
+  p = fh->map + pos;
+  if (pframes && !_afNeedsConversion(fh)
+      && (bytes_per_sample == 3 || (size_t)p % bytes_per_sample == 0)) {
+    *pframes = p;
+  } else {
+    memcpy(buffer, p, (size_t)frame_count * framesize);
+    _afConvertFrames(fh, buffer, frame_count);
+    if (pframes)
+      *pframes = buffer;
+  }
+
+  return frame_count;
+}
+
+int
+afReadFrames(AFfilehandle fh, int track, void *buffer, int frame_count)
+{
+  return afReadFramesDirect(fh, track, buffer, frame_count, NULL);
+}
+
+/*
+ * Like afReadFrames(), but if the file is mapped into memory and the
+ * samples need no conversion, buffer is left alone and *pframes is
+ * pointed straight at the frames in the mapping.  Otherwise they're
+ * read into buffer, and *pframes is set to buffer.  Frames in the
+ * mapping stay valid until the file is closed.  This is not part of
+ * the real audiofile interface.
+ */
+int
+afReadFramesDirect(AFfilehandle fh, int track, void *buffer, int frame_count,
+		   const void **pframes)
+{
+  int framesize, frames_recvd;
+  int offset_current, bytes_remaining, frames_remaining;
+
+  framesize = _afGetFrameSize(fh, track, 0);
+
+  if (fh->map) {
+    frames_recvd = _afReadMapped(fh, fh->map_pos, buffer, frame_count,
+				 pframes);
+    fh->map_pos += (off_t)frames_recvd * framesize;
+    return frames_recvd;
+  }
+
+  if (fh->streaming) {
+    /* the stream's data lasts until it ends, if we don't know better */
+    if (!fh->length_unknown && fh->stream_left / framesize < frame_count)
+      frame_count = fh->stream_left / framesize;
+    frames_recvd = fread(buffer, framesize, frame_count,
+			 riff_stream(fh->riff));
+    fh->stream_left -= (off_t)frames_recvd * framesize;
+    _afConvertFrames(fh, buffer, frames_recvd);
+    if (pframes)
+      *pframes = buffer;
+    return frames_recvd;
+  }
+
+  /* FIXME: need to update this for large file support */
+  offset_current = ftell(riff_stream(fh->riff));
+  bytes_remaining = fh->data_chnk.offset + fh->data_chnk.size - offset_current;
+  if (bytes_remaining < 0)
+    bytes_remaining = 0;
+  frames_remaining = bytes_remaining / framesize;
+
+  if (frames_remaining < frame_count)
+    frame_count = frames_remaining;
+
+  frames_recvd = fread(buffer, framesize, frame_count, riff_stream(fh->riff));
+  _afConvertFrames(fh, buffer, frames_recvd);
+  if (pframes)
+    *pframes = buffer;
 
   return frames_recvd;
 }
 
+#if HAVE_PREAD
 /*
- * WARNING: afWriteFrames messes up the contents of buffer.  This is
- * inconsistent with the real audiofile, but normalize doesn't
- * care.
+ * Read frames starting at frame number frame_offset of the track.
+ * This does not use or move the file position, so several threads
+ * may read different parts of the same file through one handle at
+ * the same time.  This is not part of the real audiofile interface.
  */
 int
-afWriteFrames(AFfilehandle fh, int track, void *buffer, int frame_count)
+afReadFramesAt(AFfilehandle fh, int track, AFframecount frame_offset,
+	       void *buffer, int frame_count)
+{
+  return afReadFramesAtDirect(fh, track, frame_offset, buffer, frame_count,
+			      NULL);
+}
+
+/* afReadFramesAt(), but without copying when we can, as above */
+int
+afReadFramesAtDirect(AFfilehandle fh, int track, AFframecount frame_offset,
+		     void *buffer, int frame_count, const void **pframes)
 {
-  int framesize, i, samp_count;
-  int32_t samp;
-  int8_t *pdest;
-  int32_t *psrc;
-  int8_t *p8;
+  int fd, framesize, frames_remaining;
+  off_t pos, bytes_remaining;
+  size_t want, got;
+  ssize_t ret;
+
+  framesize = _afGetFrameSize(fh, track, 0);
+
+  pos = fh->data_chnk.offset + frame_offset * framesize;
+  if (fh->map)
+    return _afReadMapped(fh, pos, buffer, frame_count, pframes);
+
+  bytes_remaining = fh->data_chnk.offset + (off_t)fh->data_chnk.size - pos;
+  if (bytes_remaining < 0)
+    bytes_remaining = 0;
+  frames_remaining = bytes_remaining / framesize;
+
+  if (frames_remaining < frame_count)
+    frame_count = frames_remaining;
+
+  fd = fileno(riff_stream(fh->riff));
+  want = (size_t)frame_count * framesize;
+  got = 0;
+  while (got < want) {
+    ret = pread(fd, (char *)buffer + got, want - got, pos + got);
+    if (ret == -1) {
+      if (errno == EINTR)
+	continue;
+      return -1;
+    }
+    if (ret == 0)
+      break;
+    got += ret;
+  }
+
+  _afConvertFrames(fh, buffer, got / framesize);
+  if (pframes)
+    *pframes = buffer;
+
+  return got / framesize;
+}
+#endif
+
+/*
+ * Turn frames the way normalize gives them to us into the way they
+ * go in the file, in place.
+ */
+static void
+_afUnconvertFrames(AFfilehandle fh, void *buffer, int frame_count)
+{
+  int samp_count;
 #ifdef WORDS_BIGENDIAN
+  int i;
   int32_t *p32;
   int16_t *p16;
 #endif
 
-  framesize = _afGetFrameSize(fh, track, 0);
+  if (fh->keep_samples)
+    return;
+
   samp_count = frame_count * fh->fmt.channels;
 
 #ifdef WORDS_BIGENDIAN
@@ -496,44 +889,112 @@ afWriteFrames(AFfilehandle fh, int track, void *buffer, int frame_count)
   if (fh->fmt.bits_per_sample <= 8) {
     /* 8-bit WAV samples are unsigned (0-255), but normalize gives us
      * twos complement, so we adjust.  See afSetVirtualSampleFormat() */
-    p8 = buffer;
-    for (i = 0; i < samp_count; i++) {
-      *p8 = *p8 + 128;
-      p8++;
-    }
+    flip_sign8(buffer, samp_count);
   } else if (fh->fmt.bits_per_sample > 16 && fh->fmt.bits_per_sample <= 24) {
     /* 24-bit samples are aligned on 32-bit boundaries,
-     * so we have to pack them together for writing */
+     * so we have to pack them together for writing.  They are
+     * little-endian at this point, so this is a matter of dropping
+     * the high byte of each. */
+    pack24(buffer, samp_count);
+  }
+}
+
+/*
+ * WARNING: afWriteFrames messes up the contents of buffer.  This is
+ * inconsistent with the real audiofile, but normalize doesn't
+ * care.
+ */
+int
+afWriteFrames(AFfilehandle fh, int track, void *buffer, int frame_count)
+{
+  int framesize;
 
-    /* point to 4-byte values (source) */
-    psrc = (int32_t *)buffer;
-    /* point to 3-byte values (dest) */
-    pdest = (int8_t *)buffer;
+  framesize = _afGetFrameSize(fh, track, 0);
+  _afUnconvertFrames(fh, buffer, frame_count);
 
-    for (i = 0; i < samp_count; i++) {
-      samp = *psrc;
-      /* samp is always in little-endian at this point */
-#ifdef WORDS_BIGENDIAN
-      samp >>= 8;
-      pdest[2] = samp & 0xFF;
-      samp >>= 8;
-      pdest[1] = samp & 0xFF;
-      samp >>= 8;
-      pdest[0] = samp & 0xFF;
-#else
-      pdest[0] = samp & 0xFF;
-      samp >>= 8;
-      pdest[1] = samp & 0xFF;
-      samp >>= 8;
-      pdest[2] = samp & 0xFF;
+  return fwrite(buffer, framesize, frame_count, riff_stream(fh->riff));
+}
+
+#if HAVE_PWRITE
+/*
+ * Say how many frames a file being written will hold, before any are
+ * written.  The file is made that long, with its space allocated up
+ * front if the filesystem can, and the sizes in its header are filled
+ * in.  Then the frames can be written in any order, and from several
+ * threads at once, with afWriteFramesAt().  If fewer frames turn up
+ * than expected, call this again with the real number.  Fails on a
+ * stream.  This is not part of the real audiofile interface.
+ */
+int
+afSetFrameCount(AFfilehandle fh, int track, AFframecount frame_count)
+{
+  FILE *fp;
+  int fd;
+  off_t end;
+
+  if (fh->mode != AF_WRONLY || fh->streaming) {
+    errno = ESPIPE;
+    return -1;
+  }
+
+  fp = riff_stream(fh->riff);
+  fd = fileno(fp);
+  if (fflush(fp) == EOF)
+    return -1;
+  end = fh->data_chnk.offset + frame_count * _afGetFrameSize(fh, track, 0);
+
+#if HAVE_FALLOCATE
+  /* not every filesystem can, and then we just set the length */
+  if (fallocate(fd, 0, 0, end) == -1
+      && errno != EOPNOTSUPP && errno != ENOSYS && errno != EINVAL)
+    return -1;
 #endif
-      psrc++;
-      pdest += 3;
+  if (ftruncate(fd, end) == -1)
+    return -1;
+
+  /* the chunk sizes are worked out from where the stream is */
+  if (fseek(fp, end, SEEK_SET) == -1
+      || riff_ascend(fh->riff, &fh->data_chnk) == -1
+      || riff_ascend(fh->riff, &fh->top_chnk) == -1)
+    return -1;
+  return 0;
+}
+
+/*
+ * Write frames starting at frame number frame_offset of the track,
+ * within the number given to afSetFrameCount().  Like afWriteFrames(),
+ * this messes up buffer.  This does not use or move the file
+ * position.  This is not part of the real audiofile interface.
+ */
+int
+afWriteFramesAt(AFfilehandle fh, int track, AFframecount frame_offset,
+		void *buffer, int frame_count)
+{
+  int fd, framesize;
+  off_t pos;
+  size_t want, done;
+  ssize_t ret;
+
+  framesize = _afGetFrameSize(fh, track, 0);
+  _afUnconvertFrames(fh, buffer, frame_count);
+
+  fd = fileno(riff_stream(fh->riff));
+  pos = fh->data_chnk.offset + frame_offset * framesize;
+  want = (size_t)frame_count * framesize;
+  done = 0;
+  while (done < want) {
+    ret = pwrite(fd, (char *)buffer + done, want - done, pos + done);
+    if (ret == -1) {
+      if (errno == EINTR)
+	continue;
+      return -1;
     }
+    done += ret;
   }
 
-  return fwrite(buffer, framesize, frame_count, riff_stream(fh->riff));
+  return frame_count;
 }
+#endif
 
 float
 afGetFrameSize(AFfilehandle fh, int track, int expand3to4)
@@ -553,6 +1014,10 @@ afGetFrameCount(AFfilehandle fh, int track)
   int framesize;
   uint32_t tracklen;
 
+  /* a stream that didn't say how long it is */
+  if (fh->streaming && fh->length_unknown)
+    return -1;
+
   framesize = _afGetFrameSize(fh, track, 0);
   tracklen = afGetTrackBytes(fh, track);
 
@@ -607,13 +1072,13 @@ afGetFileFormat(AFfilehandle fh, int *version)
 {
   if (version)
     *version = 0;
-  return AF_FILE_WAVE;
+  return fh->file_format;
 }
 
 int
 afGetByteOrder(AFfilehandle fh, int track)
 {
-  return AF_BYTEORDER_LITTLEENDIAN;
+  return fh->byte_order;
 }
 
 int
@@ -625,12 +1090,8 @@ afGetChannels(AFfilehandle fh, int track)
 void
 afGetSampleFormat(AFfilehandle fh, int track, int *sampfmt, int *sampwidth)
 {
-  if (sampfmt) {
-    if (fh->fmt.bits_per_sample <= 8)
-      *sampfmt = AF_SAMPFMT_UNSIGNED;
-    else
-      *sampfmt = AF_SAMPFMT_TWOSCOMP;
-  }
+  if (sampfmt)
+    *sampfmt = fh->sample_format;
   if (sampwidth) {
     *sampwidth = fh->fmt.bits_per_sample;
   }
@@ -642,6 +1103,56 @@ afGetRate(AFfilehandle fh, int track)
   return (double)fh->fmt.samples_per_sec;
 }
 
+/*
+ * Have reads and writes through fh leave the samples just as they are
+ * in the file, and return how they are, as a format for the kernels
+ * (see kernels.h).  On a big-endian host, where the kernels can't
+ * describe them, nothing changes, and the usual format is returned.
+ * This is not part of the real audiofile interface.
+ */
+int
+afKeepFileSamples(AFfilehandle fh, int track)
+{
+  int bytes_per_sample;
+#ifndef WORDS_BIGENDIAN
+  int format;
+#endif
+
+  bytes_per_sample = (fh->fmt.bits_per_sample - 1) / 8 + 1;
+#ifdef WORDS_BIGENDIAN
+  return bytes_per_sample;
+#else
+  format = bytes_per_sample;
+  if (bytes_per_sample == 1 && fh->sample_format == AF_SAMPFMT_UNSIGNED)
+    format |= SAMPLES_UNSIGNED;
+  if (bytes_per_sample == 3)
+    format |= SAMPLES_PACKED;
+  if (bytes_per_sample > 1 && fh->byte_order == AF_BYTEORDER_BIGENDIAN)
+    format |= SAMPLES_SWAPPED;
+  fh->keep_samples = 1;
+  return format;
+#endif
+}
+
+/*
+ * Read fh through stdio from here on, not through a memory mapping.
+ * A page of the mapping past the end of the file raises SIGBUS, so a
+ * file that may be cut short while we read it is better read this way.
+ * Call it before reading anything.  This is not part of the real
+ * audiofile interface.
+ */
+void
+afUnmapFile(AFfilehandle fh)
+{
+#if HAVE_MMAP && HAVE_SYS_MMAN_H
+  if (fh->map) {
+    munmap(fh->map, fh->map_len);
+    fh->map = NULL;
+    fseek(riff_stream(fh->riff), fh->map_pos, SEEK_SET);
+  }
+#endif
+}
+
 /*
  * normalize only uses this to ensure that the sample format is twos
  * complement, even for 8 bit.	We do this by default, so this is a
@@ -82,7 +82,18 @@ int afCloseFile(AFfilehandle file);
 AFfilesetup afNewFileSetup(void);
 void afFreeFileSetup(AFfilesetup);
 int afReadFrames(AFfilehandle, int track, void *buffer, int frameCount);
+int afReadFramesAt(AFfilehandle, int track, AFframecount frameOffset,
+		   void *buffer, int frameCount);
+int afReadFramesDirect(AFfilehandle, int track, void *buffer, int frameCount,
+		       const void **pframes);
+int afReadFramesAtDirect(AFfilehandle, int track, AFframecount frameOffset,
+			 void *buffer, int frameCount, const void **pframes);
 int afWriteFrames(AFfilehandle, int track, void *buffer, int frameCount);
+int afSetFrameCount(AFfilehandle, int track, AFframecount frameCount);
+int afWriteFramesAt(AFfilehandle, int track, AFframecount frameOffset,
+		    void *buffer, int frameCount);
+int afKeepFileSamples(AFfilehandle, int track);
+void afUnmapFile(AFfilehandle);
 int afSyncFile(AFfilehandle);
 float afGetFrameSize(AFfilehandle, int track, int expand3to4);
 AFfileoffset afGetTrackBytes(AFfilehandle, int track);
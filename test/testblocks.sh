@@ -0,0 +1,57 @@
+#!/bin/sh
+
+LC_ALL=POSIX
+LC_NUMERIC=POSIX
+export LC_ALL LC_NUMERIC
+
+exec 3>> test.log
+echo "Testing block sizes..." >&3
+
+# 24-bit stereo, so a frame is 6 bytes, and 8-bit mono, so it's 1
+../src/mktestwav -a 0.1 -b 3 -c 2 blocks24.wav
+../src/mktestwav -a 0.3 -b 1 -c 1 blocks8.wav
+
+echo "blocks24.wav and blocks8.wav created..." >&3
+
+# Check that reading and writing the files in blocks of any size, be it
+# a single byte, part of a frame, a frame and a bit, or more than the
+# whole file, measures the same levels and writes the same files as the
+# default block size does
+LEVELS=`../src/normalize -qn blocks24.wav blocks8.wav`
+rm -rf blocks.dir
+mkdir blocks.dir
+cp blocks24.wav blocks8.wav blocks.dir
+(cd blocks.dir && ../../src/normalize -q -w 16 blocks24.wav blocks8.wav)
+for f in blocks24.wav blocks8.wav; do
+    if cmp -s $f blocks.dir/$f; then
+	echo "FAIL: $f wasn't adjusted" >&3
+	exit 1
+    fi
+done
+
+for size in 1 5 7 4k 64M; do
+    NORM=`../src/normalize -qn --block-size=$size blocks24.wav blocks8.wav`
+    if test x"$NORM" != x"$LEVELS"; then
+	echo "FAIL: levels measured with --block-size=$size differ:" >&3
+	echo "    should be: $LEVELS" >&3
+	echo "    got:       $NORM" >&3
+	exit 1
+    fi
+    rm -rf blocksN.dir
+    mkdir blocksN.dir
+    cp blocks24.wav blocks8.wav blocksN.dir
+    (cd blocksN.dir && \
+	../../src/normalize -q -w 16 --block-size=$size blocks24.wav blocks8.wav)
+    for f in blocks24.wav blocks8.wav; do
+	if ! cmp -s blocks.dir/$f blocksN.dir/$f; then
+	    echo "FAIL: $f adjusted with --block-size=$size differs" >&3
+	    exit 1
+	fi
+    done
+done
+rm -rf blocks.dir blocksN.dir
+
+echo "files read and written in blocks of every size successfully..." >&3
+echo "PASSED!" >&3
+
+exit 0
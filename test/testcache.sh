@@ -0,0 +1,101 @@
+#!/bin/sh
+
+LC_ALL=POSIX
+LC_NUMERIC=POSIX
+export LC_ALL LC_NUMERIC
+
+# correct answers
+LVL_LOUD="-6.0211dBFS  -3.0106dBFS  -5.9789dB  cached.wav"
+LVL_QUIET="-20.0015dBFS -16.9915dBFS 8.0015dB   cached.wav"
+LVL_TWOSEC="-10.4583dBFS -7.4478dBFS  -1.5417dB  cached.wav"
+LIMITED=db4f10fe6ebc56adf6f572d3a57dc97cfdcee93b
+
+# keep the cache to ourselves
+XDG_CACHE_HOME=`pwd`/cache
+export XDG_CACHE_HOME
+rm -rf cache
+
+exec 3>> test.log
+echo "Testing the level cache..." >&3
+
+../src/mktestwav -a 0.5 loud.wav
+../src/mktestwav -a 0.1 quiet.wav
+../src/mktestwav -a 0.3 -s 88200 twosec.wav
+../src/mktestwav -a 0.5 -s 88200 twosecloud.wav
+
+check_level() {
+    NORM=`../src/normalize -qn $1 cached.wav`
+    if test x"$NORM" != x"$2"; then
+	echo "FAIL: $3:" >&3
+	echo "    should be: $2" >&3
+	echo "    got:       $NORM" >&3
+	exit 1
+    fi
+}
+
+# replace the contents of cached.wav, but keep its modification time
+swap_in() {
+    touch -r cached.wav stamp
+    cp $1 cached.wav
+    touch -r stamp cached.wav
+    rm -f stamp
+}
+
+cp loud.wav cached.wav
+check_level --cache "$LVL_LOUD" "level of cached.wav is incorrect"
+if test ! -f cache/normalize/levels; then
+    echo "FAIL: cache/normalize/levels wasn't created" >&3
+    exit 1
+fi
+
+echo "cached.wav measured and cached..." >&3
+
+# With the same size and time, we should take the cache's word for it
+swap_in quiet.wav
+check_level --cache "$LVL_LOUD" "level of cached.wav didn't come from the cache"
+
+# A new time means the file has to be analyzed again
+touch cached.wav
+check_level --cache "$LVL_QUIET" "cache didn't notice cached.wav was touched"
+
+# With a hash, a change in the contents is enough
+swap_in loud.wav
+check_level --cache "$LVL_QUIET" "level of cached.wav didn't come from the cache"
+check_level --cache=hash "$LVL_LOUD" "cache didn't notice cached.wav's contents changed"
+
+# So is a new size
+swap_in twosec.wav
+check_level --cache "$LVL_TWOSEC" "cache didn't notice cached.wav was resized"
+
+# Rebuilding analyzes it whatever the cache says
+swap_in twosecloud.wav
+check_level --rebuild-cache "$LVL_LOUD" "--rebuild-cache used the cache"
+check_level --cache "$LVL_LOUD" "--rebuild-cache didn't update the cache"
+
+echo "cache entries found and invalidated successfully..." >&3
+
+# A level stored by -n has no true peak, which adjusting needs to tell
+# if the limiter is called for.  Just under -3dBFS, loud.wav's samples
+# stay in range, but its true peak doesn't, so it should be limited
+# whether or not the cache was filled in by -n first.
+rm -rf cache
+cp loud.wav uncached.wav
+../src/normalize -q -a -3.0115dBFS uncached.wav
+CHKSUM=`shasum uncached.wav`
+case "$CHKSUM" in
+    $LIMITED*) ;;
+    *) echo "FAIL: uncached.wav adjusted has bad checksum!" >&3; exit 1 ;;
+esac
+cp loud.wav cached.wav
+../src/normalize -qn --cache cached.wav > /dev/null
+../src/normalize -q --cache -a -3.0115dBFS cached.wav
+if ! cmp -s uncached.wav cached.wav; then
+    echo "FAIL: cached.wav adjusted after -n --cache wasn't limited" >&3
+    exit 1
+fi
+
+echo "levels cached by -n adjusted successfully..." >&3
+rm -rf cache
+echo "PASSED!" >&3
+
+exit 0
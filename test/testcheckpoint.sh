@@ -0,0 +1,85 @@
+#!/bin/sh
+
+LC_ALL=POSIX
+LC_NUMERIC=POSIX
+export LC_ALL LC_NUMERIC
+
+# correct answers
+LVL_HALF="-9.7475dBFS  -3.0106dBFS  -2.2525dB  growing.wav"
+LVL_FULL="-6.9470dBFS  -3.0106dBFS  -5.0530dB  growing.wav"
+LVL_FORGED="-6.0206dBFS  -3.0106dBFS  -5.9794dB  growing.wav"
+LVL_SHRUNK="-20.0015dBFS -16.9915dBFS 8.0015dB   growing.wav"
+
+exec 3>> test.log
+echo "Testing checkpoints..." >&3
+
+# The samples of a 40 second file that's quiet but for a loud burst
+# in the middle, and WAV headers for 10, 20 and 40 seconds of them
+../src/mktestwav -a 0.1 -s 864360 part1.wav
+../src/mktestwav -a 0.5 -f 440 -s 35280 part2.wav
+../src/mktestwav -a 0.05 -f 3000 -s 864360 part3.wav
+(tail -c +45 part1.wav; tail -c +45 part2.wav; tail -c +45 part3.wav) > growing.raw
+rm -f part1.wav part2.wav part3.wav
+../src/mktestwav -s 441000 growing.wav
+head -c 44 growing.wav > header10.tmp
+../src/mktestwav -s 882000 growing.wav
+head -c 44 growing.wav > header20.tmp
+../src/mktestwav -s 1764000 growing.wav
+head -c 44 growing.wav > header40.tmp
+
+check_level() {
+    NORM=`../src/normalize -qn $1 growing.wav`
+    if test x"$NORM" != x"$2"; then
+	echo "FAIL: $3:" >&3
+	echo "    should be: $2" >&3
+	echo "    got:       $NORM" >&3
+	exit 1
+    fi
+}
+
+check_frames() {
+    FRAMES=`sed -n '2s/^\([^ ]* \)\{6\}\([0-9]*\) .*/\2/p' growing.wav.normalize`
+    if test x"$FRAMES" != x"$1"; then
+	echo "FAIL: checkpoint is at frame $FRAMES, should be at $1" >&3
+	exit 1
+    fi
+}
+
+# Start with the first 20 seconds, which ends part way through the burst
+rm -f growing.wav.normalize
+(cat header20.tmp; head -c 1764000 growing.raw) > growing.wav
+check_level --checkpoint "$LVL_HALF" "level of the first half is incorrect"
+check_frames 882000
+cp growing.wav.normalize half.tmp
+
+echo "first half of growing.wav measured..." >&3
+
+# Append the rest, in place, as a recorder would; picking up where we
+# left off must give the level of a full scan
+dd if=header40.tmp of=growing.wav conv=notrunc 2>/dev/null
+tail -c +1764001 growing.raw >> growing.wav
+check_level --checkpoint "$LVL_FULL" "level after resuming is incorrect"
+check_frames 1764000
+check_level "" "$LVL_FULL" "level of a full scan is incorrect"
+cp half.tmp growing.wav.normalize
+check_level "--checkpoint -j 2" "$LVL_FULL" "level after resuming with -j 2 is incorrect"
+
+# Make sure it was really resumed, by forging a louder level into the
+# checkpoint: the samples it covers haven't changed, so it's believed
+sed '2s/^\(\([^ ]* \)\{8\}\)[^ ]*/\10x1p+28/' half.tmp > growing.wav.normalize
+check_level --checkpoint "$LVL_FORGED" "checkpoint wasn't used"
+
+echo "rest of growing.wav measured from the checkpoint..." >&3
+
+# Cut the file down to 10 seconds; the checkpoint runs past the end of
+# it, so it must be ignored
+(cat header10.tmp; head -c 882000 growing.raw) > growing.wav
+sed '2s/^\(\([^ ]* \)\{8\}\)[^ ]*/\10x1p+28/' half.tmp > growing.wav.normalize
+check_level --checkpoint "$LVL_SHRUNK" "checkpoint was used for a shrunk file"
+check_frames 441000
+
+rm -f header10.tmp header20.tmp header40.tmp half.tmp growing.raw
+echo "checkpoint of shrunk growing.wav ignored successfully..." >&3
+echo "PASSED!" >&3
+
+exit 0
@@ -0,0 +1,64 @@
+#!/bin/sh
+
+LC_ALL=POSIX
+LC_NUMERIC=POSIX
+export LC_ALL LC_NUMERIC
+
+exec 3>> test.log
+echo "Testing clipping predictions..." >&3
+
+# 24- and 32-bit samples are counted in coarser bins than 8- and 16-bit
+for bits in 8 16 24 32; do
+    ../src/mktestwav -a 0.3 -b `expr $bits / 8` -c 2 clip$bits.wav
+done
+
+echo "clip8.wav, clip16.wav, clip24.wav and clip32.wav created..." >&3
+
+# the number of clippings normalize -n predicts, and the number it
+# performs adjusting a copy, or nothing if it said there'd be none
+predicted() {
+    ../src/normalize -n -v $2 $1 2>&1 | grep 'clippings predicted' | \
+	sed 's/^.*: \([0-9]*\) clippings predicted.*$/\1/'
+}
+
+performed() {
+    cp $1 clipped.wav
+    ../src/normalize -v $2 clipped.wav 2>&1 | tr '\r' '\n' | \
+	grep 'clippings performed' | \
+	sed 's/^.*: \([0-9]*\) clippings performed.*$/\1/'
+}
+
+# Check that the clippings predicted are those performed, both with a
+# gain that clips a lot of samples and with one held down by a budget
+for bits in 8 16 24 32; do
+    f=clip$bits.wav
+    UNLIMITED=`predicted $f "-a -1dBFS --clipping"`
+    DONE=`performed $f "-a -1dBFS --clipping"`
+    if test -z "$UNLIMITED" || test x"$UNLIMITED" != x"$DONE"; then
+	echo "FAIL: clippings predicted for $f are wrong:" >&3
+	echo "    performed: $DONE" >&3
+	echo "    predicted: $UNLIMITED" >&3
+	exit 1
+    fi
+
+    BUDGET=`predicted $f "-a -1dBFS --clip-budget=1"`
+    DONE=`performed $f "-a -1dBFS --clip-budget=1"`
+    if test x"$BUDGET" != x"$DONE"; then
+	echo "FAIL: clippings predicted for $f with --clip-budget are wrong:" >&3
+	echo "    performed: $DONE" >&3
+	echo "    predicted: $BUDGET" >&3
+	exit 1
+    fi
+    # 2 channels of 44100 samples, of which no more than 1% may clip
+    if test "${BUDGET:-0}" -gt 882 || test "${BUDGET:-0}" -ge "$UNLIMITED"; then
+	echo "FAIL: $f adjusted with --clip-budget=1 clipped $BUDGET samples" >&3
+	exit 1
+    fi
+done
+
+rm -f clipped.wav
+
+echo "clippings predicted successfully..." >&3
+echo "PASSED!" >&3
+
+exit 0
@@ -0,0 +1,66 @@
+#!/bin/sh
+
+LC_ALL=POSIX
+LC_NUMERIC=POSIX
+export LC_ALL LC_NUMERIC
+
+# correct answers
+LVL_LOUD="-6.0211dBFS  -3.0106dBFS  -5.9789dB  embedded.wav"
+LVL_QUIET="-20.0015dBFS -16.9915dBFS 8.0015dB   embedded.wav"
+LVL_TWOSEC="-10.4583dBFS -7.4478dBFS  -1.5417dB  embedded.wav"
+SIZE_BEFORE=88244
+SIZE_AFTER=88444
+
+exec 3>> test.log
+echo "Testing levels stored in WAV files..." >&3
+
+../src/mktestwav -a 0.5 loud.wav
+../src/mktestwav -a 0.1 quiet.wav
+../src/mktestwav -a 0.3 -s 88200 twosec.wav
+
+check_level() {
+    NORM=`../src/normalize -qn $1 embedded.wav`
+    if test x"$NORM" != x"$2"; then
+	echo "FAIL: $3:" >&3
+	echo "    should be: $2" >&3
+	echo "    got:       $NORM" >&3
+	exit 1
+    fi
+}
+
+check_size() {
+    SIZE=`wc -c < embedded.wav | tr -d ' '`
+    if test x"$SIZE" != x"$1"; then
+	echo "FAIL: embedded.wav is $SIZE bytes, should be $1" >&3
+	exit 1
+    fi
+}
+
+cp loud.wav embedded.wav
+check_size $SIZE_BEFORE
+check_level --embed "$LVL_LOUD" "level of embedded.wav is incorrect"
+check_size $SIZE_AFTER
+
+echo "levels stored in embedded.wav..." >&3
+
+# Put other samples in place of the old ones; as long as the data
+# chunk is the same size, the stored levels are taken as they are
+tail -c +45 quiet.wav | dd of=embedded.wav bs=44 seek=1 conv=notrunc 2>/dev/null
+check_level --embed "$LVL_LOUD" "level of embedded.wav wasn't the one stored"
+
+# Rebuilding analyzes it again, and stores the new levels in place
+check_level "--embed --rebuild-cache" "$LVL_QUIET" "--rebuild-cache used the stored levels"
+check_size $SIZE_AFTER
+check_level --embed "$LVL_QUIET" "--rebuild-cache didn't store the new levels"
+
+# Give it twice as many samples, keeping the stored levels; the RIFF
+# chunk is now 4 + 24 + 8 + 176400 + 8 + 192 = 176636 bytes
+(head -c 4 twosec.wav; printf '\374\261\002\000'; tail -c +9 twosec.wav; \
+ tail -c 200 embedded.wav) > embedded.tmp
+mv -f embedded.tmp embedded.wav
+check_level --embed "$LVL_TWOSEC" "stored levels were used after embedded.wav was resized"
+
+echo "stored levels found and invalidated successfully..." >&3
+echo "PASSED!" >&3
+
+exit 0
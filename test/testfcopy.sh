@@ -0,0 +1,19 @@
+#!/bin/sh
+
+LC_ALL=POSIX
+LC_NUMERIC=POSIX
+export LC_ALL LC_NUMERIC
+
+exec 3>> test.log
+echo "Testing file copies..." >&3
+
+# Check copies between files and pipes, between stdio streams, and
+# those made adding, rewriting and growing a tag in front of some data
+if ../src/fcopytest >&3 2>&1; then :; else
+    echo "FAIL: a copy came out wrong!" >&3
+    exit 1
+fi
+
+echo "PASSED!" >&3
+
+exit 0
@@ -0,0 +1,135 @@
+#!/bin/sh
+
+LC_ALL=POSIX
+LC_NUMERIC=POSIX
+export LC_ALL LC_NUMERIC
+
+# correct answers, for a gain of 10dB, which the limiter has to rein in
+GAIN16A_AFTER=708fb41f04537900062642a138c16e0ab2c79358
+GAIN16B_AFTER=437a56f07f7b76a4a46b337609ecf08a256aec23
+GAIN8A_AFTER=9fb02fa321b762cc7c55b04a35c66b422caf43d5
+GAIN8B_AFTER=c932cd23c49be2845ef346210a5ada5087000591
+
+exec 3>> test.log
+echo "Testing gain..." >&3
+
+../src/mktestwav -a 0.5 -b 2 -c 2 gain16a.wav
+../src/mktestwav -a 0.2 -b 2 -c 1 -f 440 gain16b.wav
+../src/mktestwav -a 0.5 -b 1 -c 2 gain8a.wav
+../src/mktestwav -a 0.3 -b 1 -c 1 -f 440 gain8b.wav
+FILES="gain16a.wav gain16b.wav gain8a.wav gain8b.wav"
+
+check_sum() {
+    CHKSUM=`tail -c +44 $1 | shasum`
+    case "$CHKSUM" in
+	$2*) ;;
+	*) echo "FAIL: $3 $1 has bad checksum!" >&3; exit 1 ;;
+    esac
+}
+
+# Adjust copies of the files in dir with the given options, one run
+# for all of them if together is set, or one run each
+adjust_copies() {
+    rm -rf $1
+    mkdir $1
+    for f in $FILES; do
+	cp $f $1
+    done
+    if test x"$3" = xtogether; then
+	(cd $1 && ../../src/normalize -q $2 $FILES)
+    else
+	for f in $FILES; do
+	    (cd $1 && ../../src/normalize -q $2 $f)
+	done
+    fi
+}
+
+same_copies() {
+    for f in $FILES; do
+	if cmp -s $1/$f $2/$f; then :; else
+	    echo "FAIL: $f adjusted with $3 differs" >&3
+	    exit 1
+	fi
+    done
+}
+
+# The files in one run share lookup tables, and with -j the limiter's
+# table is built in slices, on threads; neither may change the samples
+adjust_copies gain.dir "-g 10dB" together
+check_sum gain.dir/gain16a.wav $GAIN16A_AFTER "adjusted"
+check_sum gain.dir/gain16b.wav $GAIN16B_AFTER "adjusted"
+check_sum gain.dir/gain8a.wav $GAIN8A_AFTER "adjusted"
+check_sum gain.dir/gain8b.wav $GAIN8B_AFTER "adjusted"
+adjust_copies gain1.dir "-g 10dB"
+same_copies gain.dir gain1.dir "-g 10dB, one run each,"
+adjust_copies gain1.dir "-g 10dB -j 4"
+same_copies gain.dir gain1.dir "-g 10dB -j 4, one run each,"
+adjust_copies gain.dir "-g -3dB" together
+adjust_copies gain1.dir "-g -3dB -j 4"
+same_copies gain.dir gain1.dir "-g -3dB -j 4, one run each,"
+
+echo "lookup tables shared and built in threads successfully..." >&3
+
+# Gains of a small integer over a power of two are done in fixed
+# point.  Check their samples against ones worked out by hand: each
+# sample times the gain, rounded half up, and clipped if need be.  The
+# arguments are the file, the formats of its samples and the output's
+# (u1 for unsigned 8-bit, d3 for 24-bit, or a format for od), the
+# options, the gain, and the range to clip to, if any.
+samples() {
+    case $2 in
+    u1) od -An -v -t u1 -j 44 $1 | tr -s ' ' '\n' | sed '/^$/d' | \
+	    awk '{ print $1 - 128 }' ;;
+    d3) od -An -v -t u1 -w3 -j 44 $1 | \
+	    awk '{ v = $1 + 256 * $2 + 65536 * $3
+		   if (v >= 8388608) v -= 16777216
+		   print v }' ;;
+    *) od -An -v -t $2 -j 44 $1 | tr -s ' ' '\n' | sed '/^$/d' ;;
+    esac
+}
+
+check_by_hand() {
+    cp $1 byhand.wav
+    ../src/normalize -q $4 byhand.wav
+    samples $1 $2 > byhand.in
+    samples byhand.wav $3 > byhand.out
+    BAD=`paste byhand.in byhand.out | \
+	awk -v gain=$5 -v max=$6 -v min=$7 '
+	{
+	    x = $1 * gain + 0.5
+	    want = int(x)
+	    if (want > x) want--
+	    if (max != "" && want > max) want = max
+	    if (min != "" && want < min) want = min
+	    if ($2 != want) bad++
+	}
+	END { print bad + 0 }'`
+    rm -f byhand.in byhand.out
+    if test x"$BAD" != x0; then
+	echo "FAIL: $BAD samples of $1 adjusted with $4 are wrong" >&3
+	exit 1
+    fi
+}
+
+../src/mktestwav -a 0.5 -b 4 -c 2 gain32a.wav
+../src/mktestwav -a 0.5 -b 3 -c 2 gain24a.wav
+check_by_hand gain16a.wav d2 d2 "-g 0.5" 0.5
+check_by_hand gain16a.wav d2 d2 "-g 1.5 --clipping" 1.5 32767 -32768
+check_by_hand gain16a.wav d2 d4 "-g 0.5 -w 32" 32768
+check_by_hand gain8a.wav u1 d2 "-g 0.75 -w 16" 192
+check_by_hand gain32a.wav d4 d4 "-g 1.5 --clipping" 1.5 2147483647 -2147483648
+check_by_hand gain32a.wav d4 d2 "-g 0.5 -w 16" 0.00000762939453125
+check_by_hand gain32a.wav d4 u1 "-g 0.5 -w 8" 0.0000000298023223876953125
+check_by_hand gain24a.wav d3 d3 "-g 1.5 --clipping" 1.5 8388607 -8388608
+check_by_hand gain24a.wav d3 d2 "-g 0.5 -w 16" 0.001953125
+check_by_hand gain24a.wav d3 d4 "-g 0.5 -w 32" 128
+check_by_hand gain16a.wav d2 d3 "-g 0.5 -w 24" 128
+check_by_hand gain8a.wav u1 u1 "-g 0.5" 0.5
+check_by_hand gain8a.wav u1 u1 "-g 1.5 --clipping" 1.5 127 -128
+
+echo "dyadic gains applied successfully..." >&3
+
+rm -rf gain.dir gain1.dir
+echo "PASSED!" >&3
+
+exit 0
@@ -0,0 +1,160 @@
+#!/bin/sh
+
+LC_ALL=POSIX
+LC_NUMERIC=POSIX
+export LC_ALL LC_NUMERIC
+
+# correct answers
+LVL_A="-6.0211dBFS  -3.0106dBFS  -5.9789dB  a.wav"
+LVL_B="-20.0015dBFS -16.9915dBFS 8.0015dB   b.wav"
+LVL_C="-10.6332dBFS -7.5906dBFS  -1.3668dB  c.wav"
+LVL_D="-26.0206dBFS -23.0108dBFS 14.0206dB  d.wav"
+LONG_BEFORE=15d7c615ef8f0829f001391bca4bf86b039e1d08
+LVL_LONG="-6.9470dBFS  -3.0106dBFS  -5.0530dB  long.wav"
+
+exec 3>> test.log
+echo "Testing parallel jobs..." >&3
+
+../src/mktestwav -a 0.5 -b 2 -c 1 a.wav
+../src/mktestwav -a 0.1 -b 2 -c 2 -f 440 b.wav
+../src/mktestwav -a 0.3 -b 1 -c 1 c.wav
+../src/mktestwav -a 0.05 -b 3 -c 2 -f 3000 d.wav
+
+echo "a.wav, b.wav, c.wav and d.wav created..." >&3
+
+# Check that the levels come out the same, and in the same order,
+# however many files are analyzed at once
+SERIAL=`../src/normalize -qn a.wav b.wav c.wav d.wav`
+for lvl in "$LVL_A" "$LVL_B" "$LVL_C" "$LVL_D"; do
+    case "$SERIAL" in
+	*"$lvl"*) ;;
+	*) echo "FAIL: measured volume is incorrect:" >&3
+	   echo "    should include: $lvl" >&3
+	   echo "    got:            $SERIAL" >&3
+	   exit 1 ;;
+    esac
+done
+for jobs in 2 3 8; do
+    NORM=`../src/normalize -qn -j $jobs a.wav b.wav c.wav d.wav`
+    if test x"$NORM" != x"$SERIAL"; then
+	echo "FAIL: levels measured with -j $jobs differ:" >&3
+	echo "    should be: $SERIAL" >&3
+	echo "    got:       $NORM" >&3
+	exit 1
+    fi
+done
+SERIAL=`../src/normalize -qnb a.wav b.wav c.wav d.wav`
+NORM=`../src/normalize -qnb -j 3 a.wav b.wav c.wav d.wav`
+if test x"$NORM" != x"$SERIAL"; then
+    echo "FAIL: batch levels measured with -j 3 differ:" >&3
+    echo "    should be: $SERIAL" >&3
+    echo "    got:       $NORM" >&3
+    exit 1
+fi
+
+echo "levels measured in parallel successfully..." >&3
+
+# Check that adjusting the files however many at once gives the same
+# files as adjusting them one at a time
+adjust_copies() {
+    dir=$1
+    shift
+    rm -rf $dir
+    mkdir $dir
+    cp a.wav b.wav c.wav d.wav $dir
+    (cd $dir && ../../src/normalize -q "$@" a.wav b.wav c.wav d.wav) || {
+	echo "FAIL: normalize $* failed" >&3
+	exit 1
+    }
+}
+
+same_copies() {
+    for f in a.wav b.wav c.wav d.wav; do
+	if ! cmp -s $1/$f $2/$f; then
+	    echo "FAIL: $f adjusted in $2 differs from $1" >&3
+	    exit 1
+	fi
+    done
+}
+
+adjust_copies jobs.dir -j 1
+for f in a.wav b.wav c.wav d.wav; do
+    if cmp -s $f jobs.dir/$f; then
+	echo "FAIL: $f wasn't adjusted" >&3
+	exit 1
+    fi
+done
+for jobs in 2 3 8; do
+    adjust_copies jobsN.dir -j $jobs
+    same_copies jobs.dir jobsN.dir
+done
+adjust_copies jobs.dir -b -j 1
+adjust_copies jobsN.dir -b -j 3
+same_copies jobs.dir jobsN.dir
+rm -rf jobs.dir jobsN.dir
+
+echo "files adjusted in parallel successfully..." >&3
+
+# Make a 40 second file that's quiet but for a loud burst right where
+# it's split in two, so the level depends on how the segments' smoothing
+# windows are put back together
+../src/mktestwav -c 2 -s 1764000 long.wav
+../src/mktestwav -a 0.1 -c 2 -s 864360 part1.wav
+../src/mktestwav -a 0.5 -c 2 -f 440 -s 35280 part2.wav
+../src/mktestwav -a 0.05 -c 2 -f 3000 -s 864360 part3.wav
+(head -c 44 long.wav; tail -c +45 part1.wav; tail -c +45 part2.wav; \
+ tail -c +45 part3.wav) > long.tmp
+mv -f long.tmp long.wav
+rm -f part1.wav part2.wav part3.wav
+CHKSUM=`shasum long.wav`
+case "$CHKSUM" in
+    $LONG_BEFORE*) ;;
+    *) echo "FAIL: created long.wav has bad checksum!" >&3; exit 1 ;;
+esac
+
+# Check that splitting its analysis among jobs doesn't change its level
+for jobs in 1 2 3 4; do
+    NORM=`../src/normalize -qn -j $jobs long.wav`
+    if test x"$NORM" != x"$LVL_LONG"; then
+	echo "FAIL: level of long.wav measured with -j $jobs is incorrect:" >&3
+	echo "    should be: $LVL_LONG" >&3
+	echo "    got:       $NORM" >&3
+	exit 1
+    fi
+done
+
+echo "long.wav measured in segments successfully..." >&3
+
+# Make a file big enough to be adjusted in slices, and check that the
+# slices come out the same as adjusting it all at once, clippings and
+# all, even when the file is shorter than its header says
+../src/mktestwav -a 0.9 -b 4 -c 2 -s 3528000 slice.wav
+head -c 20000000 slice.wav > truncated.wav
+for f in slice.wav truncated.wav; do
+    for opts in "-g 1.5 --clipping" "-g 0.5 -w 16"; do
+	cp $f slice1.wav
+	cp $f sliceN.wav
+	CLIP1=`../src/normalize -v $opts -j 1 slice1.wav 2>&1 | grep clippings`
+	CLIPN=`../src/normalize -v $opts -j 4 sliceN.wav 2>&1 | grep clippings`
+	if cmp -s $f slice1.wav; then
+	    echo "FAIL: $f wasn't adjusted with $opts" >&3
+	    exit 1
+	fi
+	if ! cmp -s slice1.wav sliceN.wav; then
+	    echo "FAIL: $f adjusted with $opts in slices differs" >&3
+	    exit 1
+	fi
+	if test x"$CLIPN" != x"$CLIP1"; then
+	    echo "FAIL: clippings of $f adjusted in slices are wrong:" >&3
+	    echo "    should be: $CLIP1" >&3
+	    echo "    got:       $CLIPN" >&3
+	    exit 1
+	fi
+    done
+done
+rm -f slice.wav truncated.wav slice1.wav sliceN.wav
+
+echo "slice.wav adjusted in slices successfully..." >&3
+echo "PASSED!" >&3
+
+exit 0
@@ -0,0 +1,15 @@
+#!/bin/sh
+
+exec 3>> test.log
+echo "Testing sample kernels..." >&3
+
+# Check every kernel, for every pair of widths, against the loop it
+# replaced
+if ../src/kernelbench -c >&3 2>&1; then :; else
+    echo "FAIL: a kernel gave the wrong samples!" >&3
+    exit 1
+fi
+
+echo "PASSED!" >&3
+
+exit 0
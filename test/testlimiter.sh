@@ -0,0 +1,50 @@
+#!/bin/sh
+
+LC_ALL=POSIX
+LC_NUMERIC=POSIX
+export LC_ALL LC_NUMERIC
+
+# correct answers
+LIMITED_24=63d6db83d46a55c2718756eacaadedb7f0ce6560
+
+exec 3>> test.log
+echo "Testing the limiter..." >&3
+
+../src/mktestwav -a 0.5 -b 3 -c 2 limited.wav
+cp limited.wav exact.wav
+cp limited.wav limited32.wav
+cp limited.wav exact32.wav
+
+# Four times the gain pushes most of the samples into the limiter; at
+# 24 bits the approximate curve gives just what the exact one does
+../src/normalize -q -g 4 limited.wav
+../src/normalize -q -g 4 --exact-limiter exact.wav
+CHKSUM=`tail -c +44 exact.wav | shasum`
+case "$CHKSUM" in
+    $LIMITED_24*) ;;
+    *) echo "FAIL: exact.wav limited with --exact-limiter has bad checksum!" >&3; exit 1 ;;
+esac
+if cmp -s limited.wav exact.wav; then :; else
+    echo "FAIL: limiting to 24 bits differs from --exact-limiter" >&3
+    exit 1
+fi
+
+echo "limited.wav limited to 24 bits successfully..." >&3
+
+# At 32 bits it may be off by one in the last bit, but no more
+../src/normalize -q -g 1.7 -w 32 limited32.wav
+../src/normalize -q -g 1.7 -w 32 --exact-limiter exact32.wav
+od -An -v -t d4 -w4 -j 44 limited32.wav > limited32.txt
+od -An -v -t d4 -w4 -j 44 exact32.wav > exact32.txt
+MAXDIFF=`paste limited32.txt exact32.txt | \
+    awk '{ d = $1 - $2; if (d < 0) d = -d; if (d > m) m = d } END { print m + 0 }'`
+rm -f limited32.txt exact32.txt
+if test x"$MAXDIFF" != x0 && test x"$MAXDIFF" != x1; then
+    echo "FAIL: limiting to 32 bits is off by $MAXDIFF from --exact-limiter" >&3
+    exit 1
+fi
+
+echo "limited32.wav limited to 32 bits successfully..." >&3
+echo "PASSED!" >&3
+
+exit 0
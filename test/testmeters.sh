@@ -0,0 +1,88 @@
+#!/bin/sh
+
+LC_ALL=POSIX
+LC_NUMERIC=POSIX
+export LC_ALL LC_NUMERIC
+
+# correct answers
+BURST_BEFORE=b3270e0150b6a26283d09dc3519b91538b9e69e3
+LVL_MEAN="-6.9470dBFS  -3.0106dBFS  -5.0530dB  burst.wav"
+LVL_MEDIAN="-6.0552dBFS  -3.0106dBFS  -5.9448dB  burst.wav"
+LVL_GAUSSIAN="-6.0796dBFS  -3.0106dBFS  -5.9204dB  burst.wav"
+LVL_LUFS="-19.3078LUFS -3.0106dBFS  -3.6922dB  burst.wav"
+LVL_PEAK="-6.9470dBFS  -3.0106dBFS  3.0106dB   burst.wav"
+LVL_TRUEPEAK="-6.9470dBFS  -3.0106dBFS  2.9980dB   burst.wav"
+LVL_FAST="-9.2817dBFS  -3.0106dBFS  -2.7183dB  burst.wav
+  (estimated from part of the file; likely no more than 0.0000dBFS)"
+
+exec 3>> test.log
+echo "Testing loudness meters..." >&3
+
+# A 40 second file that's quiet but for a loud burst a little shorter
+# than the smoothing window, so each meter sees it differently
+../src/mktestwav -s 1764000 burst.wav
+../src/mktestwav -a 0.1 -s 864360 part1.wav
+../src/mktestwav -a 0.5 -f 440 -s 35280 part2.wav
+../src/mktestwav -a 0.05 -f 3000 -s 864360 part3.wav
+(head -c 44 burst.wav; tail -c +45 part1.wav; tail -c +45 part2.wav; \
+ tail -c +45 part3.wav) > burst.tmp
+mv -f burst.tmp burst.wav
+rm -f part1.wav part2.wav part3.wav
+CHKSUM=`shasum burst.wav`
+case "$CHKSUM" in
+    $BURST_BEFORE*) ;;
+    *) echo "FAIL: created burst.wav has bad checksum!" >&3; exit 1 ;;
+esac
+
+echo "burst.wav created..." >&3
+
+check_level() {
+    NORM=`../src/normalize -qn $1 burst.wav`
+    if test x"$NORM" != x"$2"; then
+	echo "FAIL: level of burst.wav measured with $1 is incorrect:" >&3
+	echo "    should be: $2" >&3
+	echo "    got:       $NORM" >&3
+	exit 1
+    fi
+}
+
+# Check each smoothing filter, and that they put the segments of a
+# split analysis back together right
+check_level "" "$LVL_MEAN"
+check_level --smoothing=mean "$LVL_MEAN"
+check_level --smoothing=median "$LVL_MEDIAN"
+check_level "--smoothing=median -j 2" "$LVL_MEDIAN"
+check_level --smoothing=gaussian "$LVL_GAUSSIAN"
+check_level "--smoothing=gaussian -j 2" "$LVL_GAUSSIAN"
+
+echo "burst.wav smoothed successfully..." >&3
+
+# The gated loudness is over the whole file, so the burst counts for
+# less, and the target is -23LUFS
+check_level --loudness=lufs "$LVL_LUFS"
+
+echo "loudness of burst.wav measured successfully..." >&3
+
+# The peak between samples is a little higher than the highest sample
+check_level --peak "$LVL_PEAK"
+check_level --peak=true "$LVL_TRUEPEAK"
+check_level "--peak=true -j 2" "$LVL_TRUEPEAK"
+
+echo "true peak of burst.wav measured successfully..." >&3
+
+# Sampling half of it only catches some of the burst, and the estimate
+# is too uncertain to adjust by, so adjusting has to scan it in full
+check_level --fast=0.5 "$LVL_FAST"
+check_level --fast=50% "$LVL_FAST"
+cp burst.wav fast.wav
+../src/normalize -q --fast=0.5 fast.wav
+../src/normalize -q burst.wav
+if cmp -s fast.wav burst.wav; then :; else
+    echo "FAIL: adjusting with --fast didn't fall back to a full scan" >&3
+    exit 1
+fi
+
+echo "level of burst.wav estimated successfully..." >&3
+echo "PASSED!" >&3
+
+exit 0
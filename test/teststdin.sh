@@ -0,0 +1,74 @@
+#!/bin/sh
+
+LC_ALL=POSIX
+LC_NUMERIC=POSIX
+export LC_ALL LC_NUMERIC
+
+# correct answers
+LVL_16="-6.0211dBFS  -3.0106dBFS  -5.9789dB"
+LVL_8="-6.1497dBFS  -3.0883dBFS  -5.8503dB"
+LVL_24="-6.0206dBFS  -3.0104dBFS  -5.9794dB"
+
+exec 3>> test.log
+echo "Testing standard input and raw samples..." >&3
+
+../src/mktestwav -a 0.5 -b 1 -c 2 piped8.wav
+../src/mktestwav -a 0.5 -b 2 -c 2 piped16.wav
+../src/mktestwav -a 0.5 -b 3 -c 2 piped24.wav
+
+check_level() {
+    if test x"$1" != x"$2"; then
+	echo "FAIL: $3:" >&3
+	echo "    should be: $2" >&3
+	echo "    got:       $1" >&3
+	exit 1
+    fi
+}
+
+# A WAV file read through a pipe
+NORM=`cat piped16.wav | ../src/normalize -qn -`
+check_level "$NORM" "$LVL_16  STDIN" "level of a WAV on stdin is incorrect"
+NORM=`cat piped16.wav | ../src/normalize -qn -j 2 - piped16.wav`
+check_level "$NORM" "$LVL_16  STDIN
+$LVL_16  piped16.wav" "level of a WAV on stdin alongside a file is incorrect"
+
+echo "WAV read from stdin successfully..." >&3
+
+# The same samples without their headers, from files and from pipes
+tail -c +45 piped16.wav > piped16.raw
+NORM=`../src/normalize -qn --raw=s16le:2:44100 piped16.raw`
+check_level "$NORM" "$LVL_16  piped16.raw" "level of raw s16le samples is incorrect"
+NORM=`dd conv=swab if=piped16.raw 2>/dev/null | ../src/normalize -qn --raw=s16be:2:44100 -`
+check_level "$NORM" "$LVL_16  STDIN" "level of raw s16be samples on stdin is incorrect"
+NORM=`tail -c +45 piped8.wav | ../src/normalize -qn --raw=u8:2:44100 -`
+check_level "$NORM" "$LVL_8  STDIN" "level of raw u8 samples on stdin is incorrect"
+tail -c +45 piped24.wav > piped24.raw
+NORM=`../src/normalize -qn --raw=s24le:2:44100 piped24.raw`
+check_level "$NORM" "$LVL_24  piped24.raw" "level of raw s24le samples is incorrect"
+
+echo "raw samples read successfully..." >&3
+
+# With -g, stdin is adjusted onto stdout, just as the file would be
+# adjusted in place
+filter_check() {
+    cat $1 | ../src/normalize -q $2 - > filtered.wav
+    if cmp -s filtered.wav $1; then
+	echo "FAIL: $1 filtered with $2 wasn't adjusted" >&3
+	exit 1
+    fi
+    cp $1 adjusted.wav
+    ../src/normalize -q $2 adjusted.wav
+    if cmp -s filtered.wav adjusted.wav; then :; else
+	echo "FAIL: $1 filtered with $2 differs from $1 adjusted with $2" >&3
+	exit 1
+    fi
+}
+filter_check piped16.wav "-g -3dB"
+filter_check piped16.wav "-g 2"
+filter_check piped8.wav "-g -3dB -w 16"
+filter_check piped24.wav "-g -3dB -w 16"
+
+echo "stdin adjusted onto stdout successfully..." >&3
+echo "PASSED!" >&3
+
+exit 0